@@ -0,0 +1,280 @@
+#include "Benchmarks.hpp"
+
+#include "Game.hpp"
+#include "Histogram.hpp"
+#include "SPSCQueue.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static double ns_per(Clock::time_point start, Clock::time_point end, uint64_t count) {
+	return std::chrono::duration< double, std::nano >(end - start).count() / double(std::max< uint64_t >(1, count));
+}
+
+//(results are folded into this, so the optimizer can't discard the work that produced them)
+static volatile uint32_t sink = 0;
+
+//---------------------------------
+//Snapshots:
+
+//decoders are timed on a run of this many consecutive messages (each delta'd against the one before):
+static constexpr uint32_t MessageRun = 1024;
+
+//move the gun along x, so consecutive snapshots differ (in that one field):
+static void move_gun(Game &game, uint32_t step) {
+	game.gun.position.x = Game::PlayAreaMinX + float(step % MessageRun) * ((Game::PlayAreaMaxX - Game::PlayAreaMinX) / float(MessageRun));
+}
+
+static bool same_state(Snapshot const &a, Snapshot const &b) {
+	for (uint32_t i = 0; i < a.players.size(); ++i) {
+		if (a.players[i].position != b.players[i].position || a.players[i].gun_fired != b.players[i].gun_fired) return false;
+	}
+	return true;
+}
+
+static void report(char const *label, size_t bytes, double encode_ns, double decode_ns) {
+	std::cout << "  " << std::left << std::setw(23) << (std::string(label) + ":") << std::right << bytes << " bytes per snapshot; encode " << encode_ns << " ns/op, decode " << decode_ns << " ns/op" << std::endl;
+}
+
+//the byte-aligned format the bit-packed one replaced:
+// per player: position (3 x f32, host byte order) | gun_fired u8
+static void encode_aligned(Snapshot const &snapshot, std::vector< uint8_t > *to) {
+	to->clear();
+	for (auto const &player : snapshot.players) {
+		uint8_t const *position = reinterpret_cast< uint8_t const * >(&player.position);
+		to->insert(to->end(), position, position + sizeof(player.position));
+		to->emplace_back(uint8_t(player.gun_fired ? 1 : 0));
+	}
+}
+
+static void decode_aligned(std::vector< uint8_t > const &from, Snapshot *snapshot) {
+	size_t at = 0;
+	for (auto &player : snapshot->players) {
+		std::memcpy(&player.position, from.data() + at, sizeof(player.position));
+		at += sizeof(player.position);
+		player.gun_fired = (from[at] != 0);
+		at += 1;
+	}
+}
+
+static bool bench_aligned(uint32_t iterations) {
+	Game game;
+	std::vector< uint8_t > message;
+
+	//encode (including capturing the snapshot, as for the packed format):
+	auto start = Clock::now();
+	for (uint32_t i = 0; i < iterations; ++i) {
+		move_gun(game, i);
+		encode_aligned(game.make_snapshot(), &message);
+		sink = sink + uint32_t(message.size());
+	}
+	double encode_ns = ns_per(start, Clock::now(), iterations);
+
+	std::vector< std::vector< uint8_t > > messages(MessageRun);
+	std::vector< Snapshot > expected(MessageRun);
+	for (uint32_t m = 0; m < MessageRun; ++m) {
+		move_gun(game, m);
+		expected[m] = game.make_snapshot();
+		encode_aligned(expected[m], &messages[m]);
+	}
+
+	Snapshot decoded;
+	for (uint32_t m = 0; m < MessageRun; ++m) {
+		decode_aligned(messages[m], &decoded);
+		if (!same_state(decoded, expected[m])) {
+			std::cout << "[bench] MISMATCH: byte-aligned message " << m << " decoded to a different state than was encoded." << std::endl;
+			return false;
+		}
+	}
+
+	uint32_t runs = std::max(1u, iterations / MessageRun);
+	start = Clock::now();
+	for (uint32_t r = 0; r < runs; ++r) {
+		for (uint32_t m = 0; m < MessageRun; ++m) {
+			decode_aligned(messages[m], &decoded);
+			sink = sink + uint32_t(decoded.players[0].gun_fired);
+		}
+	}
+	double decode_ns = ns_per(start, Clock::now(), uint64_t(runs) * MessageRun);
+
+	report("byte-aligned (old)", message.size(), encode_ns, decode_ns);
+	return true;
+}
+
+//'delta': encode each snapshot against the one before it (so only the gun's x is sent), rather than in full:
+static bool bench_packed(uint32_t iterations, bool delta) {
+	Game game;
+	Snapshot previous = game.make_snapshot();
+
+	//encode (including capturing the snapshot, since the server does both every tick):
+	size_t bytes = 0;
+	auto start = Clock::now();
+	for (uint32_t i = 0; i < iterations; ++i) {
+		move_gun(game, i);
+		Snapshot snapshot = game.make_snapshot();
+		SharedBytes payload = Game::make_state_payload(snapshot, delta ? &previous : nullptr);
+		bytes = payload->size();
+		previous = snapshot;
+	}
+	double encode_ns = ns_per(start, Clock::now(), iterations);
+
+	//state messages as the client gets them (per-recipient header, then the shared payload):
+	Snapshot const baseline = previous;
+	std::vector< std::vector< uint8_t > > messages(MessageRun);
+	std::vector< Snapshot > expected(MessageRun);
+	for (uint32_t m = 0; m < MessageRun; ++m) {
+		move_gun(game, m);
+		expected[m] = game.make_snapshot();
+		SharedBytes payload = Game::make_state_payload(expected[m], delta ? &previous : nullptr);
+		messages[m].assign(1 + 4, 0);
+		messages[m][0] = 0xff; //(no player)
+		messages[m].insert(messages[m].end(), payload->begin(), payload->end());
+		previous = expected[m];
+	}
+
+	//decode the run (the client is reset to having just received the baseline, so ids increase again):
+	Game client;
+	auto decode_run = [&](bool check) {
+		client.latest_received = 0;
+		client.received[baseline.id % SnapshotHistory::Size] = baseline;
+		for (uint32_t m = 0; m < MessageRun; ++m) {
+			client.recv_state_message(Payload{messages[m].data(), messages[m].size()});
+			if (check && !same_state(client.received[expected[m].id % SnapshotHistory::Size], expected[m])) {
+				std::cout << "[bench] MISMATCH: packed " << (delta ? "delta" : "full") << " message " << m << " decoded to a different state than was encoded." << std::endl;
+				return false;
+			}
+		}
+		return true;
+	};
+	if (!decode_run(true)) return false;
+
+	uint32_t runs = std::max(1u, iterations / MessageRun);
+	start = Clock::now();
+	for (uint32_t r = 0; r < runs; ++r) {
+		decode_run(false);
+	}
+	double decode_ns = ns_per(start, Clock::now(), uint64_t(runs) * MessageRun);
+
+	report(delta ? "packed, 1-field delta" : "packed, full", bytes, encode_ns, decode_ns);
+	return true;
+}
+
+bool bench_snapshots(uint32_t iterations) {
+	std::cout << "[bench] state payloads, " << iterations << " iterations each (encode times include capturing the snapshot,\n"
+	             "        and packed ones allocating the payload):" << std::endl;
+	bool ok = bench_aligned(iterations);
+	ok = bench_packed(iterations, false) && ok;
+	ok = bench_packed(iterations, true) && ok;
+	return ok;
+}
+
+//---------------------------------
+//Queues:
+
+struct QueueItem {
+	uint64_t seq = 0;
+	Clock::time_point sent;
+};
+
+//(the same capacity as the shards' queues, see Rooms.hpp)
+static constexpr size_t QueueCapacity = 4096;
+typedef SPSCChannel< QueueItem, QueueCapacity > QueueChannel;
+
+//send 'items' numbered items from this thread to another, 'burst' at a time with 'pause' between bursts:
+// with 'stall', the consumer doesn't start until twice the queue's capacity has been sent, so the overflow must be used
+static bool bench_channel(char const *label, uint32_t items, uint32_t burst, std::chrono::microseconds pause, bool stall) {
+	auto channel = std::make_unique< QueueChannel >();
+	std::atomic< bool > consuming(!stall);
+	std::atomic< bool > stopped(false); //(consumer) done, or gave up
+
+	//consumer:
+	Histogram latency;
+	uint64_t received = 0;
+	bool out_of_order = false;
+	uint64_t unexpected = 0; //(if out_of_order) the seq that arrived instead of 'received'
+	std::thread consumer([&]() {
+		while (!consuming.load()) std::this_thread::yield();
+		auto last = Clock::now();
+		QueueItem item;
+		while (received < items) {
+			if (!channel->receive(&item)) {
+				//(if nothing arrives for a long while, the rest have gone missing)
+				if (Clock::now() - last > std::chrono::seconds(5)) break;
+				std::this_thread::yield();
+				continue;
+			}
+			last = Clock::now();
+			if (item.seq != received) {
+				out_of_order = true;
+				unexpected = item.seq;
+				break;
+			}
+			latency.add(std::chrono::duration< double >(last - item.sent).count());
+			received += 1;
+		}
+		stopped = true;
+	});
+
+	//producer:
+	uint64_t overflowed = 0; //items that went to the overflow rather than straight into the queue
+	size_t overflow_high_water = 0;
+	for (uint32_t seq = 0; seq < items && !stopped.load(); ) {
+		for (uint32_t b = 0; b < burst && seq < items; ++b, ++seq) {
+			channel->send(QueueItem{seq, Clock::now()});
+			//(an item that didn't fit is now at the back of the overflow)
+			if (!channel->overflow.empty()) {
+				overflowed += 1;
+				overflow_high_water = std::max(overflow_high_water, channel->overflow.size());
+			}
+			if (seq + 1 == 2 * QueueCapacity) consuming = true;
+		}
+		if (pause.count()) std::this_thread::sleep_for(pause);
+		channel->flush();
+	}
+	consuming = true; //(in case there were too few items to start it)
+	//hand over whatever is still waiting:
+	while (!channel->overflow.empty() && !stopped.load()) {
+		channel->flush();
+		std::this_thread::yield();
+	}
+	consumer.join();
+
+	std::cout << "  " << label << ": ";
+	if (out_of_order) {
+		std::cout << "FAILED: item " << unexpected << " arrived when item " << received << " was expected." << std::endl;
+		return false;
+	}
+	if (received != items) {
+		std::cout << "FAILED: only " << received << " of " << items << " items arrived." << std::endl;
+		return false;
+	}
+	if (stall && overflowed == 0) {
+		std::cout << "FAILED: no items went through the overflow." << std::endl;
+		return false;
+	}
+	std::cout << items << " items arrived in order (" << overflowed << " went through the overflow, at most "
+	          << overflow_high_water << " waiting there at once)\n"
+	          << "    latency: ";
+	latency.write_summary(std::cout);
+	std::cout << "\n    latency buckets (us:count): ";
+	latency.write_buckets(std::cout);
+	std::cout << std::endl;
+	return true;
+}
+
+bool bench_queues(uint32_t items) {
+	std::cout << "[bench] SPSCChannel (capacity " << QueueCapacity << ") between two threads, " << items << " items each:" << std::endl;
+	bool ok = bench_channel("paced (bursts of 256)", items, 256, std::chrono::microseconds(100), false);
+	ok = bench_channel("flood (bursts of 4x capacity, consumer starts late)", items, uint32_t(4 * QueueCapacity), std::chrono::microseconds(0), true) && ok;
+	return ok;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+/*
+ * Micro-benchmarks of pieces of the server that are hard to measure under real
+ *  load, run headless with ./server --bench-<name> (see server.cpp).
+ *
+ * Each prints its measurements and also checks the results of the code it
+ *  times, returning false (so the server exits with status 1) if they're wrong.
+ *
+ */
+
+#include <cstdint>
+
+//state message payloads: bytes per snapshot and encode/decode time for the bit-packed
+// format (full and one-field delta), against the byte-aligned format it replaced:
+// (each variant is run 'iterations' times; decoded states must match the encoded ones)
+bool bench_snapshots(uint32_t iterations);
+
+//the queues between a shard's I/O and simulation threads (SPSCChannel, see SPSCQueue.hpp): numbered items
+// are sent from one thread to another, paced (so the queue never fills) and as a flood (so items wait in
+// the producer's overflow), and their latency reported; every item must arrive exactly once, in order:
+bool bench_queues(uint32_t items);
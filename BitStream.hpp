@@ -0,0 +1,126 @@
+#pragma once
+
+/*
+ * Helpers for packing values into (and unpacking them from) a stream of bits.
+ *
+ * Bits are packed least-significant-first into bytes, so the format doesn't
+ *  depend on host endianness.
+ *
+ * Quantize maps floats in a fixed [min,max] range onto the fewest bits that
+ *  provide (at least) a requested precision.
+ *
+ */
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <vector>
+#include <stdexcept>
+#include <cassert>
+#include <algorithm>
+
+struct BitWriter {
+	BitWriter(std::vector< uint8_t > *to_) : to(*to_) { }
+
+	//append the low 'bits' bits of 'value' (bits <= 32):
+	void write(uint32_t value, uint32_t bits) {
+		assert(bits <= 32);
+		assert(bits == 32 || (value >> bits) == 0);
+		pending |= uint64_t(value) << pending_bits;
+		pending_bits += bits;
+		while (pending_bits >= 8) {
+			to.emplace_back(uint8_t(pending));
+			pending >>= 8;
+			pending_bits -= 8;
+		}
+	}
+
+	void write_bool(bool value) {
+		write(value ? 1 : 0, 1);
+	}
+
+	//write any remaining bits (padding the last byte with zeros):
+	// (call when done writing)
+	void flush() {
+		if (pending_bits > 0) {
+			to.emplace_back(uint8_t(pending));
+			pending = 0;
+			pending_bits = 0;
+		}
+	}
+
+	std::vector< uint8_t > &to;
+	uint64_t pending = 0; //bits not yet written to 'to'
+	uint32_t pending_bits = 0;
+};
+
+struct BitReader {
+	BitReader(uint8_t const *data_, size_t size_) : data(data_), size(size_) { }
+
+	//read 'bits' bits (bits <= 32):
+	// throws if this would read past the end of the data
+	uint32_t read(uint32_t bits) {
+		assert(bits <= 32);
+		while (pending_bits < bits) {
+			if (at == size) throw std::runtime_error("Ran out of bits reading packed data.");
+			pending |= uint64_t(data[at]) << pending_bits;
+			at += 1;
+			pending_bits += 8;
+		}
+		uint32_t value = uint32_t(pending & ((uint64_t(1) << bits) - 1));
+		pending >>= bits;
+		pending_bits -= bits;
+		return value;
+	}
+
+	bool read_bool() {
+		return read(1) != 0;
+	}
+
+	//true if only (zero) padding bits remain:
+	bool at_end() const {
+		return at == size && pending == 0;
+	}
+
+	uint8_t const *data;
+	size_t size;
+	size_t at = 0; //next byte to load
+	uint64_t pending = 0; //bits loaded but not yet read
+	uint32_t pending_bits = 0;
+};
+
+//quantization of floats in [min,max] to integers in [0, 2^bits - 1]:
+struct Quantize {
+	//use the fewest bits that can represent [min,max] in steps of at most 'precision':
+	Quantize(float min_, float max_, float precision) : min(min_), max(max_) {
+		assert(max > min && precision > 0.0f);
+		double steps = std::ceil(double(max - min) / double(precision));
+		bits = 1;
+		while (bits < 32 && double((uint64_t(1) << bits) - 1) < steps) ++bits;
+		scale = float(double((uint64_t(1) << bits) - 1) / double(max - min));
+	}
+
+	//values outside [min,max] are clamped:
+	uint32_t encode(float value) const {
+		float t = (std::clamp(value, min, max) - min) * scale;
+		return uint32_t(std::lround(t));
+	}
+	float decode(uint32_t value) const {
+		return min + float(value) / scale;
+	}
+	//value as it will be after a trip over the wire:
+	float round_trip(float value) const {
+		return decode(encode(value));
+	}
+
+	void write(BitWriter &writer, float value) const {
+		writer.write(encode(value), bits);
+	}
+	float read(BitReader &reader) const {
+		return decode(reader.read(bits));
+	}
+
+	float min, max;
+	uint32_t bits;
+	float scale; //steps per unit
+};
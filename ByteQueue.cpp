@@ -0,0 +1,160 @@
+#include "ByteQueue.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+
+//---------------------------------
+
+void RecvBuffer::consume(size_t count) {
+	assert(count <= size());
+	head += count;
+	if (head == tail) {
+		//buffer drained, so it can be reused from the start for free:
+		head = tail = 0;
+	}
+}
+
+void RecvBuffer::append(void const *data_, size_t count) {
+	uint8_t *to = prepare(count);
+	std::memcpy(to, data_, count);
+	commit(count);
+}
+
+uint8_t *RecvBuffer::prepare(size_t count) {
+	if (storage.size() - tail < count) {
+		size_t live = tail - head;
+		if (head > 0 && live + count <= storage.size() && live <= storage.size() / 2) {
+			//enough room if consumed space is reclaimed, and there isn't too much to move:
+			std::memmove(storage.data(), storage.data() + head, live);
+		} else {
+			//otherwise, grow (geometrically, so appends stay amortized O(1)):
+			std::vector< uint8_t > bigger(std::max(storage.size() * 2, live + count));
+			std::memcpy(bigger.data(), storage.data() + head, live);
+			storage = std::move(bigger);
+		}
+		head = 0;
+		tail = live;
+	}
+	return storage.data() + tail;
+}
+
+void RecvBuffer::commit(size_t count) {
+	assert(tail + count <= storage.size());
+	tail += count;
+}
+
+//---------------------------------
+
+uint8_t &SendQueue::operator[](size_t i) {
+	assert(i < total);
+	//search from the back, since patches are usually to recently-appended data:
+	size_t end = total;
+	for (auto seg = segments.rbegin(); seg != segments.rend(); ++seg) {
+		size_t seg_size = (seg + 1 == segments.rend() ? seg->size() - head : seg->size());
+		if (i >= end - seg_size) {
+			assert(!seg->shared && "shared bytes may not be modified");
+			return seg->bytes[seg->size() - (end - i)];
+		}
+		end -= seg_size;
+	}
+	assert(0 && "index not found in segments");
+	return segments.front().bytes[head];
+}
+
+void SendQueue::append(void const *data_, size_t count) {
+	if (count == 0) return;
+	uint8_t const *data = reinterpret_cast< uint8_t const * >(data_);
+
+	//fill remaining capacity of the last segment first:
+	if (!segments.empty() && !segments.back().shared) {
+		auto &back = segments.back().bytes;
+		size_t room = back.capacity() - back.size();
+		size_t amt = std::min(room, count);
+		back.insert(back.end(), data, data + amt);
+		data += amt;
+		count -= amt;
+		total += amt;
+	}
+
+	//start a new segment for whatever remains:
+	if (count > 0) {
+		bool after_shared = (!segments.empty() && segments.back().shared);
+		segments.emplace_back();
+		auto &back = segments.back().bytes;
+		if (!spare.empty()) {
+			back = std::move(spare.back());
+			spare.pop_back();
+		}
+		assert(back.empty());
+		back.reserve(std::max(after_shared ? SmallSegmentSize : SegmentSize, count));
+		back.insert(back.end(), data, data + count);
+		total += count;
+	}
+}
+
+void SendQueue::append_shared(SharedBytes const &bytes) {
+	assert(bytes);
+	if (bytes->empty()) return;
+	segments.emplace_back();
+	segments.back().shared = bytes;
+	total += bytes->size();
+}
+
+uint8_t const *SendQueue::front_data() const {
+	assert(!segments.empty());
+	return segments.front().data() + head;
+}
+
+size_t SendQueue::front_size() const {
+	if (segments.empty()) return 0;
+	return segments.front().size() - head;
+}
+
+void SendQueue::peek(void *to_, size_t count) const {
+	assert(count <= total);
+	uint8_t *to = reinterpret_cast< uint8_t * >(to_);
+	size_t offset = head;
+	for (auto const &seg : segments) {
+		if (count == 0) break;
+		size_t step = std::min(count, seg.size() - offset);
+		std::memcpy(to, seg.data() + offset, step);
+		to += step;
+		count -= step;
+		offset = 0;
+	}
+}
+
+void SendQueue::consume(size_t count) {
+	assert(count <= total);
+	total -= count;
+	while (count > 0) {
+		assert(!segments.empty());
+		size_t avail = segments.front().size() - head;
+		if (count < avail) {
+			head += count;
+			break;
+		}
+		count -= avail;
+		recycle(std::move(segments.front().bytes));
+		segments.pop_front();
+		head = 0;
+	}
+}
+
+void SendQueue::clear() {
+	while (!segments.empty()) {
+		recycle(std::move(segments.front().bytes));
+		segments.pop_front();
+	}
+	head = 0;
+	total = 0;
+}
+
+void SendQueue::recycle(std::vector< uint8_t > &&seg) {
+	constexpr size_t MaxSpare = 4;
+	if (spare.size() < MaxSpare && seg.capacity() > 0 && seg.capacity() <= SegmentSize) {
+		seg.clear();
+		spare.emplace_back(std::move(seg));
+	}
+}
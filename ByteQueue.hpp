@@ -0,0 +1,113 @@
+#pragma once
+
+/*
+ * Byte queues used for Connection's send and receive buffers.
+ *
+ * RecvBuffer is a growable, contiguous byte buffer with O(1) consume() from
+ *  the front. Consumed space is reclaimed lazily (when more room is needed),
+ *  so each byte is moved at most a (small) constant number of times.
+ *  Because the data is always contiguous, parsers can look at data()/size()
+ *  directly.
+ *
+ * SendQueue is a chain of byte segments with O(1) append() to the back and
+ *  O(1) (amortized) consume() from the front. Data is never moved once queued.
+ *  Immutable, reference-counted SharedBytes can be queued without copying
+ *  (e.g., to send the same message to many connections).
+ *
+ */
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <deque>
+#include <memory>
+
+//immutable, reference-counted bytes (see SendQueue::append_shared):
+typedef std::shared_ptr< std::vector< uint8_t > const > SharedBytes;
+
+struct RecvBuffer {
+	//read view of unconsumed data:
+	uint8_t const *data() const { return storage.data() + head; }
+	size_t size() const { return tail - head; }
+	bool empty() const { return head == tail; }
+	uint8_t const &operator[](size_t i) const { return storage[head + i]; }
+
+	//discard 'count' bytes from the front:
+	void consume(size_t count);
+	void clear() { head = tail = 0; }
+
+	//append a copy of some bytes to the back:
+	void append(void const *data, size_t count);
+
+	//get space for (at least) 'count' more bytes at the back;
+	// write into it then call commit() with the number of bytes actually written:
+	uint8_t *prepare(size_t count);
+	void commit(size_t count);
+
+private:
+	std::vector< uint8_t > storage;
+	size_t head = 0; //first unconsumed byte
+	size_t tail = 0; //one past last byte
+};
+
+struct SendQueue {
+	//total bytes queued:
+	size_t size() const { return total; }
+	bool empty() const { return total == 0; }
+
+	//access a queued byte (e.g., to patch in a size field after the fact):
+	// NOTE: cost is linear in the number of segments after the one containing 'i',
+	//  so is constant-time for bytes near the back of the queue.
+	// NOTE: bytes queued with append_shared() may not be modified.
+	uint8_t &operator[](size_t i);
+
+	//copy some bytes onto the back of the queue:
+	void append(void const *data, size_t count);
+
+	//queue a reference to some shared bytes (without copying them):
+	void append_shared(SharedBytes const &bytes);
+
+	//contiguous view of the first queued segment:
+	uint8_t const *front_data() const;
+	size_t front_size() const;
+
+	//call 'fn(data, size)' for the first (up to) 'max' queued segments, in order:
+	template< typename F >
+	void for_each_segment(size_t max, F const &fn) const {
+		size_t offset = head;
+		for (auto const &seg : segments) {
+			if (max == 0) break;
+			fn(seg.data() + offset, seg.size() - offset);
+			offset = 0;
+			--max;
+		}
+	}
+
+	//copy the first 'count' queued bytes to 'to' (without removing them):
+	void peek(void *to, size_t count) const;
+
+	//remove 'count' bytes from the front:
+	void consume(size_t count);
+	void clear();
+
+	//new segments are allocated with this much capacity:
+	// (larger appends get a segment of their own)
+	static constexpr size_t SegmentSize = 16384;
+	//...except after shared bytes, which are often interleaved with small per-connection data:
+	static constexpr size_t SmallSegmentSize = 256;
+
+private:
+	struct Segment {
+		std::vector< uint8_t > bytes; //data owned by this queue (can be appended to)
+		SharedBytes shared; //...or, if set, shared data (which may not be modified)
+		uint8_t const *data() const { return shared ? shared->data() : bytes.data(); }
+		size_t size() const { return shared ? shared->size() : bytes.size(); }
+	};
+	std::deque< Segment > segments;
+	size_t head = 0; //first unconsumed byte of segments.front()
+	size_t total = 0; //total unconsumed bytes
+
+	//a few emptied segments are kept around to avoid re-allocating:
+	std::vector< std::vector< uint8_t > > spare;
+	void recycle(std::vector< uint8_t > &&seg);
+};
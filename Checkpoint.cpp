@@ -0,0 +1,209 @@
+#include "Checkpoint.hpp"
+
+#include "little_endian.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+static constexpr char Magic[4] = {'C', 'R', 'C', 'P'};
+static constexpr uint32_t Version = 1;
+
+static void put_vec3(std::vector< uint8_t > &to, glm::vec3 const &value) {
+	put_f32(to, value.x);
+	put_f32(to, value.y);
+	put_f32(to, value.z);
+}
+
+void Checkpoint::write_room(std::vector< uint8_t > &to, Game const &game, std::vector< Seat > const &seats) {
+	put_u32(to, game.seed);
+	put_u32(to, game.next_player_number);
+	put_u32(to, game.next_snapshot_id);
+	put_u8(to, uint8_t(game.gun_spawned) | (uint8_t(game.chicken_spawned) << 1) | (uint8_t(game.fired) << 2));
+	for (Player const *player : game.players()) {
+		put_vec3(to, player->position);
+		put_u8(to, uint8_t(player->gun_fired));
+	}
+	for (Snapshot const &snapshot : game.past) {
+		put_u32(to, snapshot.id);
+		for (Snapshot::PlayerState const &state : snapshot.players) {
+			put_vec3(to, state.position);
+			put_u8(to, uint8_t(state.gun_fired));
+		}
+	}
+
+	//(mt's state is a few kilobytes, so is only saved once something has drawn from it)
+	if (game.mt == std::mt19937(game.seed)) {
+		put_u32(to, 0);
+	} else {
+		std::ostringstream mt;
+		mt << game.mt;
+		std::string state = mt.str();
+		put_u32(to, uint32_t(state.size()));
+		to.insert(to.end(), state.begin(), state.end());
+	}
+
+	put_u8(to, uint8_t(seats.size()));
+	for (Seat const &seat : seats) {
+		put_u8(to, seat.player);
+		put_u64(to, seat.token);
+	}
+}
+
+std::vector< Checkpoint::RoomState > Checkpoint::load(std::string const &path) {
+	std::vector< RoomState > rooms;
+
+	if (!std::filesystem::exists(path)) return rooms;
+	std::ifstream in(path, std::ios::binary);
+	if (!in) throw std::runtime_error("Failed to open checkpoint '" + path + "'.");
+	std::vector< uint8_t > bytes(std::istreambuf_iterator< char >(in), (std::istreambuf_iterator< char >()));
+
+	size_t at = 0;
+	//(returns where the 'size' bytes taken start)
+	auto take = [&](size_t size) {
+		if (bytes.size() - at < size) throw std::runtime_error("Checkpoint '" + path + "' is truncated.");
+		uint8_t const *taken = bytes.data() + at;
+		at += size;
+		return taken;
+	};
+	auto take_u8 = [&]() { return *take(1); };
+	auto take_u32 = [&]() { return get_u32(take(4)); };
+	auto take_f32 = [&]() { return get_f32(take(4)); };
+	auto take_vec3 = [&]() {
+		float x = take_f32();
+		float y = take_f32();
+		float z = take_f32();
+		return glm::vec3(x, y, z);
+	};
+
+	if (std::memcmp(take(4), Magic, 4) != 0) throw std::runtime_error("'" + path + "' is not a checkpoint.");
+	uint32_t version = take_u32();
+	if (version != Version) {
+		throw std::runtime_error("Checkpoint '" + path + "' has version " + std::to_string(version) + " (expected " + std::to_string(Version) + ").");
+	}
+	uint32_t count = take_u32();
+
+	for (uint32_t r = 0; r < count; ++r) {
+		RoomState &room = rooms.emplace_back();
+		Game &game = room.game;
+		game = Game(take_u32());
+		game.next_player_number = take_u32();
+		game.next_snapshot_id = take_u32();
+		uint8_t flags = take_u8();
+		game.gun_spawned = (flags & 1) != 0;
+		game.chicken_spawned = (flags & 2) != 0;
+		game.fired = (flags & 4) != 0;
+		for (Player *player : game.players()) {
+			player->position = take_vec3();
+			player->gun_fired = take_u8() != 0;
+		}
+		for (Snapshot &snapshot : game.past) {
+			snapshot.id = take_u32();
+			for (Snapshot::PlayerState &state : snapshot.players) {
+				state.position = take_vec3();
+				state.gun_fired = take_u8() != 0;
+			}
+		}
+
+		uint32_t mt_size = take_u32();
+		if (mt_size) {
+			std::string state(mt_size, '\0');
+			std::memcpy(state.data(), take(mt_size), mt_size);
+			std::istringstream mt(state);
+			mt >> game.mt;
+			if (!mt) throw std::runtime_error("Checkpoint '" + path + "' has a bad random number generator state.");
+		}
+
+		uint8_t seats = take_u8();
+		if (seats > 2) throw std::runtime_error("Checkpoint '" + path + "' has a room with " + std::to_string(seats) + " seats.");
+		for (uint8_t s = 0; s < seats; ++s) {
+			Seat &seat = room.seats.emplace_back();
+			seat.player = take_u8();
+			seat.token = get_u64(take(8));
+			bool spawned = (seat.player == 0 ? game.gun_spawned : game.chicken_spawned);
+			if (seat.player > 1 || !spawned || (s == 1 && room.seats[0].player == seat.player)) {
+				throw std::runtime_error("Checkpoint '" + path + "' has a seat for a player who isn't in the game.");
+			}
+		}
+	}
+	if (at != bytes.size()) throw std::runtime_error("Checkpoint '" + path + "' has extra bytes at the end.");
+
+	return rooms;
+}
+
+//---------------------------------
+
+CheckpointWriter::CheckpointWriter(std::string const &path_, uint32_t parts_) : path(path_), parts(parts_) {
+	thread = std::thread(&CheckpointWriter::run, this);
+}
+
+CheckpointWriter::~CheckpointWriter() {
+	{
+		std::lock_guard< std::mutex > lock(mutex);
+		quit = true;
+	}
+	wake.notify_one();
+	if (thread.joinable()) thread.join();
+}
+
+void CheckpointWriter::submit(uint32_t part, uint32_t rooms, std::vector< uint8_t > &&bytes) {
+	{
+		std::lock_guard< std::mutex > lock(mutex);
+		assert(part < parts.size());
+		parts[part].rooms = rooms;
+		parts[part].bytes = std::move(bytes);
+		parts[part].fresh = true;
+	}
+	wake.notify_one();
+}
+
+void CheckpointWriter::run() {
+	auto any_fresh = [this]() { return std::any_of(parts.begin(), parts.end(), [](Part const &part) { return part.fresh; }); };
+	auto all_fresh = [this]() { return std::all_of(parts.begin(), parts.end(), [](Part const &part) { return part.fresh; }); };
+
+	std::string temporary = path + ".tmp";
+	std::vector< uint8_t > file;
+
+	std::unique_lock< std::mutex > lock(mutex);
+	while (true) {
+		wake.wait(lock, [&]() { return quit || any_fresh(); });
+		if (!quit) wake.wait_for(lock, std::chrono::duration< double >(GatherTime), [&]() { return quit || all_fresh(); });
+		if (!any_fresh()) break; //(quitting, with everything written)
+
+		//assemble the file from the newest rooms of every part:
+		// (parts with nothing new since the last write are written again as they were)
+		file.clear();
+		for (char c : Magic) put_u8(file, uint8_t(c));
+		put_u32(file, Version);
+		uint32_t rooms = 0;
+		for (Part const &part : parts) rooms += part.rooms;
+		put_u32(file, rooms);
+		for (Part &part : parts) {
+			file.insert(file.end(), part.bytes.begin(), part.bytes.end());
+			part.fresh = false;
+		}
+		lock.unlock();
+
+		{ //write a new file, then replace the old one with it:
+			std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+			out.write(reinterpret_cast< char const * >(file.data()), std::streamsize(file.size()));
+			out.close();
+			if (!out) {
+				std::cerr << "WARNING: failed to write checkpoint '" << temporary << "'." << std::endl;
+			} else {
+				std::error_code error;
+				std::filesystem::rename(temporary, path, error);
+				if (error) std::cerr << "WARNING: failed to replace checkpoint '" << path << "': " << error.message() << std::endl;
+			}
+		}
+
+		lock.lock();
+	}
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+/*
+ * Checkpoints let a restarted server pick its matches up where they left off.
+ *
+ * Every few seconds each shard writes the state of its occupied rooms -- each
+ *  room's Game, and which player each of its members controls -- into a buffer,
+ *  on its own thread (this is a few hundred bytes of copying per room). The
+ *  buffer is handed to a CheckpointWriter, whose thread combines the newest
+ *  buffer from every shard into one file. The file is written under a temporary
+ *  name and then renamed over the previous checkpoint, so a crash partway
+ *  through a write leaves the previous checkpoint intact.
+ *
+ * Sockets don't survive a restart, so members are saved by their session token
+ *  (see send_session_message in Game.hpp); a client that reconnects and presents
+ *  its token gets its old player back. A restored player nobody comes back for
+ *  is removed after a while.
+ *
+ * Players' controls, last_input, and input_budget aren't saved: they belong to a
+ *  connection's stream of inputs, which starts over when the client reconnects.
+ *
+ * File format (all values little-endian):
+ *  header: "CRCP" | version u32 | rooms u32
+ *  rooms:  seed u32 | next_player_number u32 | next_snapshot_id u32
+ *          | flags u8 (1 = gun spawned, 2 = chicken spawned, 4 = fired)
+ *          | gun, chicken: position 3 x f32 | gun_fired u8
+ *          | RewindTicks x past snapshot: id u32 | gun, chicken: position 3 x f32 | gun_fired u8
+ *          | mt state size u32 | mt state (as text; size 0 if mt hasn't been used since it was seeded)
+ *          | seats u8 | seats x (player u8 (0 = gun, 1 = chicken) | token u64)
+ *
+ */
+
+#include "Game.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Checkpoint {
+	//a player slot that someone is playing in (or, after a restore, may come back to):
+	struct Seat {
+		uint8_t player = 0; //0 = gun, 1 = chicken
+		uint64_t token = 0; //session token of the player's client
+	};
+
+	struct RoomState {
+		Game game;
+		std::vector< Seat > seats;
+	};
+
+	//append one room's state (in the format above) to 'to':
+	void write_room(std::vector< uint8_t > &to, Game const &game, std::vector< Seat > const &seats);
+
+	//read the rooms in the checkpoint at 'path':
+	// (returns no rooms if there is no file; throws if the file isn't a checkpoint, or is damaged)
+	std::vector< RoomState > load(std::string const &path);
+}
+
+//writes checkpoints (on its own thread) from rooms written by several producers (shards):
+struct CheckpointWriter {
+	//combine 'parts' producers' rooms into checkpoints at 'path':
+	CheckpointWriter(std::string const &path, uint32_t parts);
+	~CheckpointWriter(); //writes any submitted rooms not yet written, then joins the thread
+
+	CheckpointWriter(CheckpointWriter const &) = delete;
+	CheckpointWriter &operator=(CheckpointWriter const &) = delete;
+
+	//(thread-safe) replace producer 'part's rooms -- 'rooms' rooms written with Checkpoint::write_room() -- and wake the writer:
+	void submit(uint32_t part, uint32_t rooms, std::vector< uint8_t > &&bytes);
+
+	std::string path;
+
+	//once one producer submits, wait up to this long for the rest, so one file covers a whole round:
+	static constexpr double GatherTime = 0.5;
+
+private:
+	void run();
+
+	struct Part {
+		uint32_t rooms = 0;
+		std::vector< uint8_t > bytes;
+		bool fresh = false; //submitted since the last write
+	};
+
+	std::mutex mutex; //protects parts and quit:
+	std::condition_variable wake;
+	std::vector< Part > parts;
+	bool quit = false;
+
+	std::thread thread;
+};
@@ -0,0 +1,278 @@
+#include "ClientNetwork.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <stdexcept>
+
+//(for timers kept in seconds)
+static std::chrono::steady_clock::duration seconds(double s) {
+	return std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(s));
+}
+
+ClientNetwork::ClientNetwork(Client &client_, double input_rate) : client(client_), input_interval(seconds(1.0 / input_rate)) {
+	assert(input_rate > 0.0);
+
+	server_messages.on< Message::S2C_State >([](ClientNetwork &net, Payload const &payload) {
+		Game &decoder = net.game;
+		decoder.recv_state_message(payload);
+
+		Event event;
+		event.type = Event::State;
+		event.arrival = net.received_at;
+		event.snapshot_id = decoder.latest_received;
+		Snapshot const &snapshot = decoder.received[decoder.latest_received % SnapshotHistory::Size];
+		auto ps = decoder.players();
+		for (uint32_t i = 0; i < ps.size(); ++i) {
+			//(players left out of the state keep the position recv_state_message left them at)
+			event.players[i] = snapshot.players[i];
+			event.players[i].position = ps[i]->position;
+			if (ps[i] == decoder.local_player) event.local_player = uint8_t(i);
+		}
+		event.local_input_ack = decoder.local_input_ack;
+		net.emit(std::move(event));
+	});
+	server_messages.on< Message::Ping >([](ClientNetwork &net, Payload const &payload) {
+		recv_ping_message(&net.client.connection, payload);
+	});
+	server_messages.on< Message::Pong >([](ClientNetwork &net, Payload const &payload) {
+		recv_pong_message(&net.client.connection, payload);
+	});
+	server_messages.on< Message::S2C_Session >([](ClientNetwork &net, Payload const &payload) {
+		net.session = recv_session_message(payload);
+	});
+	server_messages.on< Message::S2C_Hit >([](ClientNetwork &net, Payload const &payload) {
+		Event event;
+		event.type = Event::Hit;
+		Game::recv_hit_message(payload, &event.hit_position);
+		net.emit(std::move(event));
+	});
+
+	thread = std::thread(&ClientNetwork::run, this);
+}
+
+ClientNetwork::~ClientNetwork() {
+	quit = true;
+	if (thread.joinable()) thread.join();
+}
+
+//add 'from's presses to 'to', and take its pressed state:
+static void merge_buttons(Player::Controls &to, Player::Controls const &from) {
+	auto merge = [](Button &a, Button const &b) {
+		a.downs = uint8_t(std::min(255, int(a.downs) + int(b.downs)));
+		a.pressed = b.pressed;
+	};
+	merge(to.left, from.left);
+	merge(to.right, from.right);
+	merge(to.up, from.up);
+	merge(to.down, from.down);
+	merge(to.jump, from.jump);
+}
+
+//---------------------------------
+//main thread:
+
+void ClientNetwork::set_buttons(Player::Controls const &buttons) {
+	//(presses that didn't fit in the queue last time are carried along)
+	merge_buttons(unsent_buttons, buttons);
+
+	Command command;
+	command.type = Command::Buttons;
+	command.controls = unsent_buttons;
+	if (commands.push(command)) unsent_buttons = Player::Controls();
+}
+
+void ClientNetwork::fire(Shot const &shot) {
+	Command command;
+	command.type = Command::Fire;
+	command.shot = shot;
+	if (!commands.push(command)) {
+		std::cerr << "[ClientNetwork] command queue is full; dropping a shot." << std::endl;
+	}
+}
+
+bool ClientNetwork::poll(Event *event) {
+	return events.pop(event);
+}
+
+//---------------------------------
+//network thread:
+
+void ClientNetwork::flush_backlog() {
+	while (!backlog.empty() && events.push(backlog.front())) backlog.pop_front();
+}
+
+void ClientNetwork::emit(Event &&event) {
+	//keep events in order: nothing goes in the queue while older ones are waiting outside it
+	flush_backlog();
+	if (!backlog.empty() || !events.push(event)) {
+		//(the main thread is running behind; a state older than the newest in the backlog isn't needed)
+		if (event.type == Event::State && !backlog.empty() && backlog.back().type == Event::State) backlog.pop_back();
+		backlog.emplace_back(std::move(event));
+	}
+}
+
+void ClientNetwork::run() {
+	auto now = std::chrono::steady_clock::now();
+	next_input = now;
+	next_ping = now;
+	next_stats = now + seconds(StatsInterval);
+
+	try {
+		while (!quit) {
+			step(std::chrono::steady_clock::now());
+		}
+	} catch (std::exception const &e) {
+		Event event;
+		event.type = Event::Lost;
+		event.reason = e.what();
+		emit(std::move(event));
+		//(the main thread stops when it sees Lost; keep handing over events until then)
+		while (!quit && !backlog.empty()) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			flush_backlog();
+		}
+	}
+}
+
+void ClientNetwork::step(std::chrono::steady_clock::time_point now) {
+	//(after losing the connection) start another attempt to get it back, once one is due:
+	if (reconnecting && !client.is_connecting()) {
+		if (now < next_attempt) {
+			std::this_thread::sleep_for(std::min(next_attempt - now, seconds(0.1)));
+			return;
+		}
+		reconnect(now);
+	}
+
+	//wait for messages until the next input is due:
+	// (while the connection is being opened, poll() carries on with that)
+	double timeout = std::max(0.0, std::chrono::duration< double >(next_input - now).count());
+	client.poll([this](Connection *c, Connection::Event evt) {
+		if (evt == Connection::OnOpen) {
+			std::cout << "[" << c->socket << "] opened" << std::endl;
+			opened = true;
+			if (reconnecting) resumed();
+		} else if (evt == Connection::OnClose) {
+			std::cout << "[" << c->socket << "] closed (!)" << std::endl;
+			if (!session) throw std::runtime_error(opened ? "Lost connection to server!" : "Failed to connect to server!");
+			//(a failed reconnection attempt leaves the loss time -- and the next attempt's time -- as they were)
+			if (!reconnecting) {
+				reconnecting = true;
+				lost_at = std::chrono::steady_clock::now();
+				next_attempt = lost_at;
+			}
+		} else {
+			assert(evt == Connection::OnRecv);
+			received_at = std::chrono::steady_clock::now();
+			uint32_t latest_received = game.latest_received;
+			try {
+				server_messages.dispatch(c, *this);
+			} catch (std::exception const &e) {
+				throw std::runtime_error("Malformed message from server: " + std::string(e.what()));
+			}
+			//acknowledge new state right away, so the server can send only changes from it:
+			if (game.latest_received != latest_received) game.send_ack_message(c);
+		}
+	}, timeout);
+
+	//nothing is sent until the connection is open (or back):
+	if (reconnecting || !client.connection) {
+		next_input = std::chrono::steady_clock::now() + input_interval;
+		return;
+	}
+
+	//take the main thread's latest buttons and shots:
+	Command command;
+	while (commands.pop(&command)) {
+		if (command.type == Command::Buttons) {
+			merge_buttons(controls, command.controls);
+		} else {
+			assert(command.type == Command::Fire);
+			shots.emplace_back(command.shot);
+		}
+	}
+
+	now = std::chrono::steady_clock::now();
+	if (now >= next_input) {
+		send_input();
+		next_input += input_interval;
+		if (now - next_input > input_interval * MaxCatchUpInputs) next_input = now + input_interval;
+	}
+
+	//measure the round-trip time to the server:
+	if (now >= next_ping) {
+		send_ping_message(&client.connection);
+		next_ping = now + seconds(PingInterval);
+	}
+
+	client.flush();
+
+	if (now >= next_stats) {
+		client.write_stats(std::cout, StatsInterval);
+		client.connection.stats.reset();
+		next_stats = now + seconds(StatsInterval);
+	}
+}
+
+void ClientNetwork::send_input() {
+	//every input covers the same (fixed) time, no matter how often frames are drawn:
+	controls.seq = next_input_seq++;
+	controls.elapsed = std::min(std::chrono::duration< float >(input_interval).count(), Game::MaxInputElapsed);
+	controls.send_controls_message(&client.connection);
+
+	//(shots go after the controls, so the server fires from the gun position they lead to)
+	for (Shot const &shot : shots) {
+		shot.send_shot_message(&client.connection);
+	}
+	shots.clear();
+
+	//let the main thread predict the input's effect:
+	Event event;
+	event.type = Event::Input;
+	event.controls = controls;
+	emit(std::move(event));
+
+	//reset button press counters:
+	controls.left.downs = 0;
+	controls.right.downs = 0;
+	controls.up.downs = 0;
+	controls.down.downs = 0;
+	controls.jump.downs = 0;
+}
+
+void ClientNetwork::reconnect(std::chrono::steady_clock::time_point now) {
+	next_attempt = now + seconds(ReconnectInterval);
+	double lost_for = std::chrono::duration< double >(now - lost_at).count();
+	if (lost_for >= ReconnectTimeout) throw std::runtime_error("Lost connection to server!");
+
+	try {
+		client.reconnect();
+	} catch (std::exception const &e) {
+		//(only UDP connects right away -- and so can fail right away)
+		std::cout << "[reconnect] " << e.what() << std::endl;
+		return;
+	}
+
+	//ask for the same player back (this has to be the first message sent -- it waits in send_buffer until the connection opens):
+	send_resume_message(&client.connection, session);
+}
+
+void ClientNetwork::resumed() {
+	auto now = std::chrono::steady_clock::now();
+	double lost_for = std::chrono::duration< double >(now - lost_at).count();
+
+	//the server (which may have restarted) numbers its snapshots and acknowledges inputs afresh:
+	game.received.fill(Snapshot());
+	game.latest_received = 0;
+	game.local_input_ack = 0;
+	shots.clear();
+
+	Event event;
+	event.type = Event::Reconnected;
+	emit(std::move(event));
+
+	std::cout << "[reconnect] reconnected after " << lost_for << "s; resuming session." << std::endl;
+	reconnecting = false;
+	next_input = now;
+}
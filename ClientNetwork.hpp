@@ -0,0 +1,137 @@
+#pragma once
+
+/*
+ * ClientNetwork runs the client's side of the connection on its own thread, so
+ *  that network traffic isn't tied to the frame rate.
+ *
+ * The network thread owns the Client: it waits on the socket, decodes state
+ *  messages as soon as they arrive (and acknowledges them), answers and sends
+ *  pings, and reconnects if the connection is lost. It also samples the
+ *  player's buttons and sends a controls message at a fixed rate -- so a slow
+ *  frame doesn't hold up input, and every input moves the player by the same
+ *  amount.
+ *
+ * The main thread and the network thread talk only through two lock-free
+ *  single-producer single-consumer queues (see SPSCQueue.hpp):
+ *  - commands (main -> network): the latest button state, and shots to fire;
+ *  - events (network -> main): decoded states, the inputs that were sent (so
+ *     the main thread can predict their effect), hits, and connection changes.
+ *  The main thread drains the events each frame with poll(), which never blocks.
+ *
+ */
+
+#include "Connection.hpp"
+#include "Game.hpp"
+#include "MessageDispatcher.hpp"
+#include "SPSCQueue.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct ClientNetwork {
+	//run 'client' (which shouldn't be touched by anyone else from here on), sending controls 'input_rate' times per second:
+	ClientNetwork(Client &client, double input_rate = DefaultInputRate);
+	~ClientNetwork(); //stops and joins the network thread
+
+	ClientNetwork(ClientNetwork const &) = delete;
+	ClientNetwork &operator=(ClientNetwork const &) = delete;
+
+	inline static constexpr double DefaultInputRate = 60.0;
+
+	//------ used by the main thread ------
+
+	//the player's buttons as of now (presses since the last call are in 'downs'):
+	// (the next controls message sent carries the presses, and the latest pressed state)
+	void set_buttons(Player::Controls const &controls);
+
+	//fire a shot, sent after the next controls message (so from where the gun will be after it):
+	void fire(Shot const &shot);
+
+	struct Event {
+		enum Type : uint8_t {
+			State, //a state message arrived
+			Input, //a controls message was sent
+			Hit, //the chicken was hit
+			Reconnected, //the connection was lost and is back (the server counts snapshots and inputs afresh)
+			Lost, //the connection is gone for good (the network thread has stopped)
+		} type = State;
+
+		//(State) when it arrived, the decoded snapshot, and the header fields:
+		// (players left out of the state keep their last known position -- see Interest.hpp)
+		std::chrono::steady_clock::time_point arrival;
+		uint32_t snapshot_id = 0;
+		std::array< Snapshot::PlayerState, 2 > players;
+		uint8_t local_player = 0xff; //(index in Game::players(); 0xff if none)
+		uint32_t local_input_ack = 0;
+
+		Player::Controls controls; //(Input) as sent
+		glm::vec3 hit_position = glm::vec3(0.0f); //(Hit)
+		std::string reason; //(Lost)
+	};
+
+	//take the next event, if there is one; returns false (immediately) if not:
+	bool poll(Event *event);
+
+	//------ network thread ------
+private:
+	void run();
+	void step(std::chrono::steady_clock::time_point now);
+	void send_input();
+	void reconnect(std::chrono::steady_clock::time_point now); //start another attempt (throws once it has been too long)
+	void resumed(); //(once the new connection opens)
+	void emit(Event &&event); //hand an event to the main thread
+	void flush_backlog();
+
+	Client &client;
+	std::chrono::steady_clock::duration input_interval;
+
+	struct Command {
+		enum Type : uint8_t { Buttons, Fire } type = Buttons;
+		Player::Controls controls; //(Buttons)
+		Shot shot; //(Fire)
+	};
+	SPSCQueue< Command, 256 > commands; //main -> network
+	SPSCQueue< Event, 1024 > events; //network -> main
+
+	//(main thread) presses not yet handed to the network thread (if the command queue was full):
+	Player::Controls unsent_buttons;
+
+	//(network thread) events that didn't fit in the queue, oldest first (handed over before any newer ones):
+	std::deque< Event > backlog;
+
+	//(network thread) decodes state messages (and keeps the baselines they are relative to):
+	Game game;
+	MessageDispatcher< ClientNetwork > server_messages;
+	std::chrono::steady_clock::time_point received_at; //(arrival time of messages being dispatched)
+
+	//(network thread) controls for the next input, and shots to send after it:
+	Player::Controls controls;
+	uint32_t next_input_seq = 1;
+	std::vector< Shot > shots;
+	std::chrono::steady_clock::time_point next_input;
+	std::chrono::steady_clock::time_point next_ping;
+	std::chrono::steady_clock::time_point next_stats;
+
+	//(network thread) if the connection is lost (e.g., because the server restarted), keep trying to reconnect,
+	// and ask to resume the session -- to get the same player back:
+	uint64_t session = 0; //(from the server) token of this client's session; 0 if none yet
+	bool opened = false; //has the connection ever opened?
+	bool reconnecting = false; //(from losing the connection until a new one opens)
+	std::chrono::steady_clock::time_point lost_at; //when the connection was lost
+	std::chrono::steady_clock::time_point next_attempt;
+
+	std::thread thread;
+	std::atomic< bool > quit{false};
+
+public:
+	inline static constexpr double PingInterval = 1.0; //seconds between pings (for round-trip times)
+	inline static constexpr double StatsInterval = 5.0; //seconds between printed connection stats
+	inline static constexpr double ReconnectInterval = 1.0;
+	inline static constexpr double ReconnectTimeout = 30.0; //(the server holds a restored player about this long)
+	//if sending falls this many inputs behind (e.g., the thread wasn't scheduled), skip ahead rather than send a burst:
+	inline static constexpr uint32_t MaxCatchUpInputs = 5;
+};
@@ -1,35 +1,9 @@
 
-//--------- OS-specific socket-related headers ---------
-#ifdef _WIN32
-#define _CRT_SECURE_NO_WARNINGS 1 //so we can use strerror()
-#ifndef WIN32_LEAN_AND_MEAN
-#define WIN32_LEAN_AND_MEAN 1
-#endif
-#undef APIENTRY
-#include <winsock2.h>
-#include <ws2tcpip.h> //for getaddrinfo
-#undef max
-#undef min
-
-#pragma comment(lib, "Ws2_32.lib") //link against the winsock2 library
-
-#define MSG_DONTWAIT 0 //on windows, sockets are set to non-blocking with an ioctl
-typedef int ssize_t;
-
-#else
-
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <arpa/inet.h>
-#include <netinet/ip.h>
-#include <unistd.h>
-#include <netdb.h>
-
-#define closesocket close
-
-#endif
+#include "sockets.hpp"
 
 #include "Connection.hpp"
+#include "UdpTransport.hpp"
+#include "ShmTransport.hpp"
 
 //------------------------------------------------------
 
@@ -38,6 +12,10 @@ typedef int ssize_t;
 #include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <system_error>
+#include <mutex>
+#include <sstream>
+#include <thread>
 
 //NOTE: much of the sockets code herein is based on http-tweak's single-header http server
 // see: https://github.com/ixchow/http-tweak
@@ -45,21 +23,639 @@ typedef int ssize_t;
 //Also, some help and examples for getaddrinfo from: https://beej.us/guide/bgnet/html/multi/syscalls.html
 
 
+Connection::Connection() = default;
+Connection::~Connection() = default;
+
+ReleasedConnection::ReleasedConnection() = default;
+ReleasedConnection::ReleasedConnection(ReleasedConnection &&) = default;
+ReleasedConnection &ReleasedConnection::operator=(ReleasedConnection &&) = default;
+ReleasedConnection::~ReleasedConnection() = default;
+
+//---------------------------------
+//Telemetry:
+
+uint32_t FrameCounter::feed(uint8_t const *data, size_t count, std::function< void(uint64_t) > const &ends) {
+	uint32_t frames = 0;
+	while (count > 0) {
+		size_t step;
+		if (header_have < 4) {
+			//(only frame headers are looked at; payloads are skipped over)
+			header[header_have++] = *data;
+			step = 1;
+			if (header_have == 4) remaining = uint32_t(header[1]) | (uint32_t(header[2]) << 8) | (uint32_t(header[3]) << 16);
+		} else {
+			step = std::min(size_t(remaining), count);
+			remaining -= uint32_t(step);
+		}
+		data += step;
+		count -= step;
+		offset += step;
+		if (header_have == 4 && remaining == 0) {
+			header_have = 0;
+			frames += 1;
+			if (ends) ends(offset);
+		}
+	}
+	return frames;
+}
+
+void ConnectionStats::add_rtt(double sample) {
+	rtt = sample;
+	rtt_min = std::min(rtt_min, sample);
+	if (rtt_samples == 0) {
+		rtt_smoothed = sample;
+		rtt_jitter = sample / 2.0;
+	} else {
+		rtt_jitter += 0.25 * (std::abs(sample - rtt_smoothed) - rtt_jitter);
+		rtt_smoothed += 0.125 * (sample - rtt_smoothed);
+	}
+	rtt_samples += 1;
+}
+
+void ConnectionStats::reset() {
+	bytes_in = bytes_out = 0;
+	messages_in = messages_out = 0;
+	send_queue_high_water = 0;
+	parse_latency.clear();
+	superseded = dropped = overflows = 0;
+}
+
+void ConnectionStats::merge(ConnectionStats const &other) {
+	bytes_in += other.bytes_in;
+	bytes_out += other.bytes_out;
+	messages_in += other.messages_in;
+	messages_out += other.messages_out;
+	send_queue_high_water = std::max(send_queue_high_water, other.send_queue_high_water);
+	parse_latency.merge(other.parse_latency);
+	superseded += other.superseded;
+	dropped += other.dropped;
+	overflows += other.overflows;
+}
+
+void Connection::send_latest(void const *header, size_t header_size, SharedBytes const &bytes) {
+	if (latest_waiting) stats.superseded += 1;
+	latest_header.assign(reinterpret_cast< uint8_t const * >(header), reinterpret_cast< uint8_t const * >(header) + header_size);
+	latest_bytes = bytes;
+	latest_waiting = true;
+	mark_pending();
+}
+
+void Connection::queue_latest() {
+	if (!latest_waiting) return;
+	send_buffer.append(latest_header.data(), latest_header.size());
+	if (latest_bytes && !latest_bytes->empty()) send_buffer.append_shared(latest_bytes);
+	latest_bytes.reset();
+	latest_waiting = false;
+}
+
+void Connection::note_received(size_t count) {
+	assert(count <= recv_buffer.size());
+	auto now = std::chrono::steady_clock::now();
+	stats.messages_in += recv_frames.feed(recv_buffer.data() + recv_buffer.size() - count, count, [&](uint64_t end) {
+		//(if messages are never parsed, stop remembering them rather than growing forever)
+		if (unparsed.size() >= 4096) unparsed.pop_front();
+		unparsed.emplace_back(end, now);
+	});
+}
+
+void Connection::note_sent(size_t count) {
+	assert(count <= send_buffer.size());
+	send_buffer.for_each_segment(std::numeric_limits< size_t >::max(), [&](uint8_t const *data, size_t size) {
+		size_t step = std::min(size, count);
+		if (step > 0) stats.messages_out += send_frames.feed(data, step);
+		count -= step;
+	});
+}
+
+void Connection::note_parsed() {
+	if (unparsed.empty()) return;
+	//every received byte has been fed to recv_frames, so whatever isn't still in recv_buffer was consumed:
+	uint64_t parsed = recv_frames.offset - recv_buffer.size();
+	auto now = std::chrono::steady_clock::now();
+	while (!unparsed.empty() && unparsed.front().first <= parsed) {
+		stats.parse_latency.add(std::chrono::duration< double >(now - unparsed.front().second).count());
+		unparsed.pop_front();
+	}
+}
+
+//name a connection for stats output (its socket, or -- since UDP connections on a server share a socket -- its address):
+static std::string describe_connection(Connection const &c) {
+	if (c.udp && !c.udp->address.empty()) {
+		char ip[INET6_ADDRSTRLEN] = "?";
+		uint16_t port = 0;
+		auto const *addr = reinterpret_cast< struct sockaddr const * >(c.udp->address.data());
+		if (addr->sa_family == AF_INET) {
+			auto const *in = reinterpret_cast< struct sockaddr_in const * >(addr);
+			inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip));
+			port = ntohs(in->sin_port);
+		} else if (addr->sa_family == AF_INET6) {
+			auto const *in6 = reinterpret_cast< struct sockaddr_in6 const * >(addr);
+			inet_ntop(AF_INET6, &in6->sin6_addr, ip, sizeof(ip));
+			port = ntohs(in6->sin6_port);
+		}
+		return std::string(ip) + ":" + std::to_string(port);
+	}
+	if (c.shm) return std::to_string(c.socket) + " (shm)";
+	return std::to_string(c.socket);
+}
+
+//one line per connection, plus a line of totals:
+// ('closed' holds counters from connections that have since closed, and is included in the totals)
+static void write_connection_stats(std::ostream &out, Connections const &connections, ConnectionStats const &closed, uint32_t closed_connections, double elapsed, size_t max_connections) {
+	elapsed = std::max(elapsed, 1e-6);
+	ConnectionStats total = closed;
+	std::vector< Connection const * > open;
+	for (auto const &c : connections) {
+		if (c.socket == InvalidSocket) continue;
+		open.emplace_back(&c);
+		total.merge(c.stats);
+	}
+	out << "[connections] " << open.size() << " open, " << closed_connections << " closed; in " << double(total.bytes_in) / elapsed / 1024.0 << " KiB/s ("
+	    << double(total.messages_in) / elapsed << " msgs/s), out " << double(total.bytes_out) / elapsed / 1024.0 << " KiB/s ("
+	    << double(total.messages_out) / elapsed << " msgs/s); largest send queue " << total.send_queue_high_water << " bytes; parse latency ";
+	total.parse_latency.write_summary(out);
+	out << "; latest-wins superseded " << total.superseded << ", dropped " << total.dropped << "; send limit overflows " << total.overflows << "\n";
+
+	//worst first -- most data backed up, then slowest round trip:
+	std::sort(open.begin(), open.end(), [](Connection const *a, Connection const *b) {
+		if (a->stats.send_queue_high_water != b->stats.send_queue_high_water) return a->stats.send_queue_high_water > b->stats.send_queue_high_water;
+		return a->stats.rtt_smoothed > b->stats.rtt_smoothed;
+	});
+	if (open.size() > max_connections) open.resize(max_connections);
+	for (Connection const *c : open) {
+		ConnectionStats const &st = c->stats;
+		out << "  [" << describe_connection(*c) << "] rtt " << st.rtt_smoothed * 1e3 << "ms (jitter " << st.rtt_jitter * 1e3 << "ms, min "
+		    << (st.rtt_samples ? st.rtt_min * 1e3 : 0.0) << "ms, " << st.rtt_samples << " samples); in "
+		    << double(st.bytes_in) / elapsed / 1024.0 << " KiB/s (" << double(st.messages_in) / elapsed << " msgs/s), out "
+		    << double(st.bytes_out) / elapsed / 1024.0 << " KiB/s (" << double(st.messages_out) / elapsed << " msgs/s); send queue max "
+		    << st.send_queue_high_water << " bytes; superseded " << st.superseded << "; parse p99 " << st.parse_latency.percentile(0.99) * 1e3 << "ms\n";
+	}
+	out.flush();
+}
+
 void Connection::close() {
+	if (latest_waiting) {
+		stats.dropped += 1;
+		latest_bytes.reset();
+		latest_waiting = false;
+	}
 	if (socket != InvalidSocket) {
-		::closesocket(socket);
+		if (udp) {
+			//(UDP connections on a server share the server's socket)
+			udp_close(*this);
+		} else if (shm) {
+			shm_close(*this);
+		} else {
+			::closesocket(socket);
+		}
 		socket = InvalidSocket;
 	}
 }
 
 //---------------------------------
-//Polling helper used by both server and client:
-void poll_connections(
+//Helpers used by both polling backends:
+
+//read everything currently available on a connection's socket into its recv_buffer:
+// (returns false if the connection was closed)
+static bool recv_connection(
+	char const *where,
+	Connection &c,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	bool until_would_block,
+	SyscallCounts &syscalls) {
+
+	if (c.shm) {
+		//(shared memory: take everything in the ring at once)
+		size_t received = 0;
+		bool open = shm_recv(c, &received, syscalls);
+		if (received > 0) {
+			c.stats.bytes_in += received;
+			c.note_received(received);
+			if (on_event) on_event(&c, Connection::OnRecv);
+			c.note_parsed();
+			if (c.socket == InvalidSocket) return false; //(handler may have closed the connection)
+		}
+		if (!open) {
+			std::cerr << "[" << where << "] shared-memory peer closed, disconnecting." << std::endl;
+			c.close();
+			if (on_event) on_event(&c, Connection::OnClose);
+			return false;
+		}
+		//(the wakeup may have been the other side making room for data waiting to go out)
+		if (c.has_queued()) c.mark_pending();
+		return true;
+	}
+
+	const uint32_t BufferSize = 20000;
+
+	while (true) { //read until more data left to read
+		//read directly into the end of recv_buffer:
+		char *buffer = reinterpret_cast< char * >(c.recv_buffer.prepare(BufferSize));
+		ssize_t ret = recv(c.socket, buffer, BufferSize, MSG_DONTWAIT);
+		syscalls.recv += 1;
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			//~no problem~ but no data
+			return true;
+		} else if (ret <= 0 || ret > (ssize_t)BufferSize) {
+			//~problem~ so remove connection
+			if (ret == 0) {
+				std::cerr << "[" << where << "] port closed, disconnecting." << std::endl;
+			} else if (ret < 0) {
+				std::cerr << "[" << where << "] recv() returned error " << errno << "(" << strerror(errno) << "), disconnecting." << std::endl;
+			} else {
+				std::cerr << "[" << where << "] recv() returned strange number of bytes, disconnecting." << std::endl;
+			}
+			c.close();
+			if (on_event) on_event(&c, Connection::OnClose);
+			return false;
+		} else { //ret > 0
+			c.recv_buffer.commit(size_t(ret));
+			c.stats.bytes_in += size_t(ret);
+			c.note_received(size_t(ret));
+			if (on_event) on_event(&c, Connection::OnRecv);
+			c.note_parsed();
+			if (c.socket == InvalidSocket) return false; //(handler may have closed the connection)
+			//with level-triggered readiness, a short read means no more data left to read;
+			// edge-triggered readiness requires reading until the socket would block:
+			if (!until_would_block && ret < (ssize_t)BufferSize) return true;
+		}
+	}
+}
+
+//note how much data is waiting in a connection's send_buffer, and close the connection if it is over its limit:
+// (call after sending what the socket will take -- or, if it can't take anything, instead of sending)
+// (returns false if the connection was closed)
+static bool check_send_limit(
+	char const *where,
+	Connection &c,
+	std::function< void(Connection *, Connection::Event event) > const &on_event) {
+
+	c.stats.send_queue_high_water = std::max(c.stats.send_queue_high_water, c.send_buffer.size());
+	if (c.send_buffer.size() <= c.send_limit) return true;
+	std::cerr << "[" << where << "] " << c.send_buffer.size() << " bytes waiting to be sent (limit " << c.send_limit << "), disconnecting." << std::endl;
+	c.stats.overflows += 1;
+	c.close();
+	if (on_event) on_event(&c, Connection::OnClose);
+	return false;
+}
+
+//write as much of a connection's send_buffer (and then its latest-wins slot) as the socket will take:
+// (returns false if the connection was closed)
+static bool send_connection(
+	char const *where,
+	Connection &c,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	SyscallCounts &syscalls) {
+
+	if (c.shm) {
+		//(shared memory: copy as much as fits into the ring; any more goes once the other side makes room)
+		if (!shm_send(c, syscalls)) {
+			std::cerr << "[" << where << "] shared-memory peer closed, disconnecting." << std::endl;
+			c.close();
+			if (on_event) on_event(&c, Connection::OnClose);
+			return false;
+		}
+		return check_send_limit(where, c, on_event);
+	}
+
+	//the latest-wins slot goes out once everything queued ahead of it has:
+	if (c.send_buffer.empty()) c.queue_latest();
+
+	c.stats.send_queue_high_water = std::max(c.stats.send_queue_high_water, c.send_buffer.size());
+
+	while (!c.send_buffer.empty()) {
+		#ifdef _WIN32
+		size_t count = c.send_buffer.front_size();
+		ssize_t ret = send(c.socket, reinterpret_cast< char const * >(c.send_buffer.front_data()), int(count), MSG_DONTWAIT);
+		#else
+		//gather (up to MaxSegments of) the queued segments into one sendmsg() call:
+		constexpr size_t MaxSegments = 64;
+		struct iovec iov[MaxSegments];
+		size_t segments = 0;
+		size_t count = 0;
+		c.send_buffer.for_each_segment(MaxSegments, [&](uint8_t const *data, size_t size) {
+			iov[segments].iov_base = const_cast< uint8_t * >(data);
+			iov[segments].iov_len = size;
+			count += size;
+			++segments;
+		});
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = segments;
+		//(a peer that has gone away shows up as an error here, rather than as a SIGPIPE that kills the process)
+		#ifdef MSG_NOSIGNAL
+		ssize_t ret = sendmsg(c.socket, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+		#else
+		ssize_t ret = sendmsg(c.socket, &msg, MSG_DONTWAIT);
+		#endif
+		#endif 
+		syscalls.send += 1;
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			//~no problem~, but don't keep trying
+			break;
+		} else if (ret <= 0 || ret > (ssize_t)count) {
+			if (ret < 0) {
+				std::cerr << "[" << where << "] send() returned error " << errno << ", disconnecting." << std::endl;
+			} else { assert(ret == 0 || ret > (ssize_t)count);
+				std::cerr << "[" << where << "] send() returned strange number of bytes [" << ret << " of " << count << "], disconnecting." << std::endl;
+			}
+			c.close();
+			if (on_event) on_event(&c, Connection::OnClose);
+			return false;
+		} else { //ret seems reasonable
+			c.stats.bytes_out += size_t(ret);
+			c.note_sent(size_t(ret));
+			c.send_buffer.consume(size_t(ret));
+			//short write means the socket buffer is full:
+			if (ret < (ssize_t)count) break;
+			if (c.send_buffer.empty()) c.queue_latest();
+		}
+	}
+	return check_send_limit(where, c, on_event);
+}
+
+//turn off Nagle's algorithm on a TCP socket:
+// (queued data already goes out in one gathering send per flush, so holding small writes back
+//  -- until the previous one is acknowledged, which delayed ACKs can put off -- only adds latency)
+static void set_no_delay(Socket s) {
+	#ifdef _WIN32
+	BOOL one = TRUE;
+	int ret = setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast< const char * >(&one), sizeof(one));
+	#else
+	int one = 1;
+	int ret = setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	#endif
+	if (ret != 0) {
+		std::cerr << "[note: couldn't set TCP_NODELAY] " << std::endl;
+	}
+}
+
+//accept a new connection from listen_socket (if possible) and add it to connections:
+// (returns the new connection, or nullptr if there are none waiting -- or on failure)
+static Connection *accept_connection(
 	char const *where,
-	std::list< Connection > &connections,
+	Connections &connections,
+	std::vector< Connection * > &pending,
+	Socket listen_socket,
+	SyscallCounts &syscalls) {
+
+	Socket got;
+	while (true) {
+		got = accept(listen_socket, NULL, NULL);
+		syscalls.accept += 1;
+		if (got != InvalidSocket) break;
+		#ifdef _WIN32
+		int err = WSAGetLastError();
+		if (err == WSAECONNRESET) continue; //(gave up while waiting; try the next one)
+		if (err != WSAEWOULDBLOCK) std::cerr << "[" << where << "] accept() returned error " << err << "." << std::endl;
+		#else
+		if (errno == EINTR || errno == ECONNABORTED) continue; //(interrupted, or gave up while waiting; try the next one)
+		if (errno != EAGAIN && errno != EWOULDBLOCK) std::cerr << "[" << where << "] accept() returned error " << errno << "(" << strerror(errno) << ")." << std::endl;
+		#endif
+		return nullptr;
+	}
+	#ifdef _WIN32
+	unsigned long one = 1;
+	if (0 != ioctlsocket(got, FIONBIO, &one)) {
+		closesocket(got);
+		return nullptr;
+	}
+	#endif
+	set_no_delay(got);
+	Connection &c = add_connection(connections);
+	c.socket = got;
+	c.pending = &pending;
+	std::cerr << "[" << where << "] client connected on " << c.socket << "." << std::endl; //INFO
+	return &c;
+}
+
+//each wakeup, accept at most this many connections (so a flood of them can't starve everything else for long):
+// (any more are picked up by the next poll, since the listen socket's readiness is level-triggered)
+static constexpr uint32_t MaxAcceptsPerPoll = 256;
+
+#ifdef __linux__
+//---------------------------------
+//epoll backend:
+// - sockets are registered once (when opened) and stay registered until closed
+// - connection sockets are edge-triggered, so are read until they would block
+// - EPOLLOUT is only requested while a connection has data it couldn't send immediately
+// - the listen socket (if any) is registered with a nullptr data.ptr, and the shared-memory
+//   listen socket (if any) with shm_listen_tag()
+// - shared-memory connections register their socket and eventfd (see ShmTransport.hpp), and
+//   never need EPOLLOUT (the other side signals the eventfd when it makes room)
+
+static Connection *shm_listen_tag() {
+	static char tag;
+	return reinterpret_cast< Connection * >(&tag);
+}
+
+static void epoll_watch(int epoll_fd, Connection &c, int op, bool want_write, SyscallCounts &syscalls) {
+	if (c.shm) {
+		if (op == EPOLL_CTL_ADD) shm_watch(epoll_fd, c, true, syscalls);
+		return;
+	}
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (want_write ? uint32_t(EPOLLOUT) : 0u);
+	ev.data.ptr = &c;
+	syscalls.control += 1;
+	if (epoll_ctl(epoll_fd, op, c.socket, &ev) != 0) {
+		throw std::system_error(errno, std::system_category(), "failed to update epoll registration");
+	}
+	c.write_armed = want_write;
+}
+
+//(shared memory) watch a connection that is still waiting for its segment, until it arrives:
+// (level-triggered, since each readiness is handled with a single recvmsg())
+static void epoll_watch_shm_setup(int epoll_fd, Connection &c, int op, SyscallCounts &syscalls) {
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLRDHUP;
+	ev.data.ptr = &c;
+	syscalls.control += 1;
+	if (epoll_ctl(epoll_fd, op, c.socket, (op == EPOLL_CTL_DEL ? nullptr : &ev)) != 0) {
+		throw std::system_error(errno, std::system_category(), "failed to update epoll registration (shared-memory setup)");
+	}
+}
+
+static void epoll_watch_listen(int epoll_fd, Socket listen_socket, Connection *tag = nullptr) {
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN; //level-triggered: stays ready while connections are waiting to be accepted
+	ev.data.ptr = tag;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_socket, &ev) != 0) {
+		throw std::system_error(errno, std::system_category(), "failed to add listen socket to epoll");
+	}
+}
+
+static int epoll_create_or_throw() {
+	int fd = epoll_create1(EPOLL_CLOEXEC);
+	if (fd < 0) {
+		throw std::system_error(errno, std::system_category(), "failed to create epoll instance");
+	}
+	return fd;
+}
+
+//send queued data on connections marked pending; arm EPOLLOUT on any that can't be fully flushed:
+static void flush_pending(
+	char const *where,
+	int epoll_fd,
+	std::vector< Connection * > &pending,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	SyscallCounts &syscalls) {
+
+	//(swap out the list, since OnClose handlers may queue more data)
+	static thread_local std::vector< Connection * > flushing;
+	flushing.clear();
+	std::swap(flushing, pending);
+
+	for (Connection *c : flushing) {
+		c->is_pending = false;
+		if (c->socket == InvalidSocket) continue;
+		//if EPOLLOUT is armed, wait for it rather than trying a send that will likely fail:
+		// (but don't let data pile up without limit while waiting)
+		if (c->write_armed) {
+			check_send_limit(where, *c, on_event);
+			continue;
+		}
+		if (!send_connection(where, *c, on_event, syscalls)) continue;
+		if (!c->send_buffer.empty() && !c->shm) epoll_watch(epoll_fd, *c, EPOLL_CTL_MOD, true, syscalls);
+	}
+}
+
+//(shared memory) try to take the segment of a connection in shm_accepting; once it has one, move it to connections:
+// (the emptied entry -- or, on failure, the closed one -- is discarded by Server::poll)
+static void finish_shm_setup(
+	char const *where,
+	int epoll_fd,
+	Connection &setup,
+	Connections &connections,
+	std::vector< Connection * > &pending,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	SyscallCounts &syscalls) {
+
+	ShmSetup result = shm_finish_accept(where, setup, syscalls);
+	if (result == ShmSetup::Waiting) return;
+	if (result == ShmSetup::Failed) {
+		setup.close(); //(which also removes it from epoll_fd)
+		return;
+	}
+
+	epoll_watch_shm_setup(epoll_fd, setup, EPOLL_CTL_DEL, syscalls);
+	Connection &added = add_connection(connections);
+	added.socket = setup.socket;
+	added.shm = std::move(setup.shm);
+	added.pending = &pending;
+	setup.socket = InvalidSocket;
+	std::cerr << "[" << where << "] client connected on " << added.socket << " (shared memory)." << std::endl; //INFO
+	epoll_watch(epoll_fd, added, EPOLL_CTL_ADD, false, syscalls);
+	if (on_event) on_event(&added, Connection::OnOpen);
+}
+
+static void poll_connections_epoll(
+	char const *where,
+	int epoll_fd,
+	Connections &connections,
+	std::vector< Connection * > &pending,
 	std::function< void(Connection *, Connection::Event event) > const &on_event,
 	double timeout,
-	Socket listen_socket = InvalidSocket) {
+	Socket listen_socket,
+	Socket shm_listen_socket,
+	Connections *shm_accepting,
+	SyscallCounts &syscalls) {
+
+	//data queued since the last poll can probably go right out:
+	flush_pending(where, epoll_fd, pending, on_event, syscalls);
+
+	constexpr int MaxEvents = 256;
+	static thread_local struct epoll_event events[MaxEvents];
+
+	int count;
+	{ //wait (until timeout) for sockets' data to become available:
+		//(epoll_wait has millisecond resolution; round up so that short timeouts wait instead of spinning)
+		int timeout_ms = int(std::ceil(std::max(0.0, timeout) * 1000.0));
+		count = epoll_wait(epoll_fd, events, MaxEvents, timeout_ms);
+		syscalls.wait += 1;
+		if (count < 0) {
+			if (errno != EINTR) {
+				std::cerr << "[" << where << "] epoll_wait returned an error " << errno << "(" << strerror(errno) << ")." << std::endl;
+			}
+			return;
+		}
+	}
+
+	for (int i = 0; i < count; ++i) {
+		Connection *c = reinterpret_cast< Connection * >(events[i].data.ptr);
+		if (c == nullptr) {
+			//add new connections -- every one waiting, up to a limit:
+			assert(listen_socket != InvalidSocket);
+			for (uint32_t accepted = 0; accepted < MaxAcceptsPerPoll; ++accepted) {
+				Connection *got = accept_connection(where, connections, pending, listen_socket, syscalls);
+				if (!got) break;
+				epoll_watch(epoll_fd, *got, EPOLL_CTL_ADD, false, syscalls);
+				if (on_event) on_event(got, Connection::OnOpen);
+			}
+			continue;
+		}
+		if (c == shm_listen_tag()) {
+			//accept new shared-memory connections -- likewise -- and watch them until their segments arrive:
+			assert(shm_listen_socket != InvalidSocket && shm_accepting);
+			auto deadline = std::chrono::steady_clock::now() + ShmSetupTimeout;
+			for (uint32_t accepted = 0; accepted < MaxAcceptsPerPoll; ++accepted) {
+				Socket got = shm_accept(where, shm_listen_socket, syscalls);
+				if (got == InvalidSocket) break;
+				Connection &setup = add_connection(*shm_accepting);
+				setup.socket = got;
+				setup.shm = std::make_unique< ShmPeer >();
+				setup.shm->setup_deadline = deadline;
+				epoll_watch_shm_setup(epoll_fd, setup, EPOLL_CTL_ADD, syscalls);
+				//(the client sends its segment right after connecting, so it has likely arrived already)
+				finish_shm_setup(where, epoll_fd, setup, connections, pending, on_event, syscalls);
+			}
+			continue;
+		}
+
+		//(connection may have been closed by a handler earlier in this batch)
+		if (c->socket == InvalidSocket) continue;
+
+		if (c->shm && !c->shm->segment) {
+			//a shared-memory connection's segment may have arrived:
+			finish_shm_setup(where, epoll_fd, *c, connections, pending, on_event, syscalls);
+			continue;
+		}
+
+		if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+			if (!recv_connection(where, *c, on_event, true, syscalls)) continue;
+		}
+
+		if ((events[i].events & EPOLLOUT) && c->write_armed) {
+			if (!send_connection(where, *c, on_event, syscalls)) continue;
+			if (c->send_buffer.empty()) epoll_watch(epoll_fd, *c, EPOLL_CTL_MOD, false, syscalls);
+		}
+	}
+
+	//data queued by handlers can go out now as well:
+	flush_pending(where, epoll_fd, pending, on_event, syscalls);
+}
+#endif //__linux__
+
+//---------------------------------
+//select backend (used where epoll isn't available):
+[[maybe_unused]] static void poll_connections_select(
+	char const *where,
+	Connections &connections,
+	std::vector< Connection * > &pending,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	double timeout,
+	Socket listen_socket,
+	SyscallCounts &syscalls) {
+
+	//the select backend scans every connection, so doesn't need the pending list:
+	for (Connection *c : pending) {
+		c->is_pending = false;
+	}
+	pending.clear();
 
 	fd_set read_fds, write_fds;
 	FD_ZERO(&read_fds);
@@ -74,11 +670,11 @@ void poll_connections(
 	}
 
 	//add each connection's socket to read (and possibly write) sets:
-	for (auto c : connections) {
+	for (auto const &c : connections) {
 		if (c.socket != InvalidSocket) {
 			max = std::max(max, int(c.socket));
 			FD_SET(c.socket, &read_fds);
-			if (!c.send_buffer.empty()) {
+			if (c.has_queued()) {
 				FD_SET(c.socket, &write_fds);
 			}
 		}
@@ -90,6 +686,7 @@ void poll_connections(
 		tv.tv_usec = std::lround((timeout - std::floor(timeout)) * 1e6);
 		//NOTE: on windows nfds is ignored -- https://msdn.microsoft.com/en-us/library/windows/desktop/ms740141(v=vs.85).aspx
 		int ret = select(max + 1, &read_fds, &write_fds, NULL, &tv);
+		syscalls.wait += 1;
 
 		if (ret < 0) {
 			std::cerr << "[" << where << "] Select returned an error; will attempt to read/write anyway." << std::endl;
@@ -99,92 +696,93 @@ void poll_connections(
 		}
 	}
 
-	//add new connections as needed:
+	//add new connections -- every one waiting, up to a limit:
 	if (listen_socket != InvalidSocket && FD_ISSET(listen_socket, &read_fds)) {
-		Socket got = accept(listen_socket, NULL, NULL);
-		if (got == InvalidSocket) {
-			//oh well.
-		} else {
-			#ifdef _WIN32
-			unsigned long one = 1;
-			if (0 == ioctlsocket(got, FIONBIO, &one)) {
-			#else
-			{
-			#endif
-				connections.emplace_back();
-				connections.back().socket = got;
-				std::cerr << "[" << where << "] client connected on " << connections.back().socket << "." << std::endl; //INFO
-				if (on_event) on_event(&connections.back(), Connection::OnOpen);
-			}
+		for (uint32_t accepted = 0; accepted < MaxAcceptsPerPoll; ++accepted) {
+			Connection *got = accept_connection(where, connections, pending, listen_socket, syscalls);
+			if (!got) break;
+			if (on_event) on_event(got, Connection::OnOpen);
 		}
 	}
 
-	const uint32_t BufferSize = 20000;
-	static thread_local char *buffer = new char[BufferSize];
-
 	//process requests:
 	for (auto &c : connections) {
 		//only read from valid sockets marked readable:
 		if (c.socket == InvalidSocket || !FD_ISSET(c.socket, &read_fds)) continue;
-
-		while (true) { //read until more data left to read
-			ssize_t ret = recv(c.socket, buffer, BufferSize, MSG_DONTWAIT);
-			if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-				//~no problem~ but no data
-				break;
-			} else if (ret <= 0 || ret > (ssize_t)BufferSize) {
-				//~problem~ so remove connection
-				if (ret == 0) {
-					std::cerr << "[" << where << "] port closed, disconnecting." << std::endl;
-				} else if (ret < 0) {
-					std::cerr << "[" << where << "] recv() returned error " << errno << "(" << strerror(errno) << "), disconnecting." << std::endl;
-				} else {
-					std::cerr << "[" << where << "] recv() returned strange number of bytes, disconnecting." << std::endl;
-				}
-				c.close();
-				if (on_event) on_event(&c, Connection::OnClose);
-				break;
-			} else { //ret > 0
-				c.recv_buffer.insert(c.recv_buffer.end(), buffer, buffer + ret);
-				if (on_event) on_event(&c, Connection::OnRecv);
-				if (ret < BufferSize) break; //ran out of data before buffer: no more data left to read
-			}
-		}
+		recv_connection(where, c, on_event, false, syscalls);
 	}
 
 	//process responses:
 	for (auto &c : connections) {
-		//don't bother with connections unless they are valid, have something to send, and are marked writable:
-		if (c.socket == InvalidSocket || c.send_buffer.empty() || !FD_ISSET(c.socket, &write_fds)) continue;
-		
-		#ifdef _WIN32
-		ssize_t ret = send(c.socket, reinterpret_cast< char const * >(c.send_buffer.data()), int(c.send_buffer.size()), MSG_DONTWAIT);
-		#else
-		ssize_t ret = send(c.socket, reinterpret_cast< char const * >(c.send_buffer.data()), c.send_buffer.size(), MSG_DONTWAIT);
-		#endif 
-		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-			//~no problem~, but don't keep trying
-			break;
-		} else if (ret <= 0 || ret > (ssize_t)c.send_buffer.size()) {
-			if (ret < 0) {
-				std::cerr << "[" << where << "] send() returned error " << errno << ", disconnecting." << std::endl;
-			} else { assert(ret == 0 || ret > (ssize_t)c.send_buffer.size());
-				std::cerr << "[" << where << "] send() returned strange number of bytes [" << ret << " of " << c.send_buffer.size() << "], disconnecting." << std::endl;
-			}
-			c.close();
-			if (on_event) on_event(&c, Connection::OnClose);
-		} else { //ret seems reasonable
-			c.send_buffer.erase(c.send_buffer.begin(), c.send_buffer.begin() + ret);
-		}
+		//don't bother with connections unless they are valid and have something to send:
+		if (c.socket == InvalidSocket || !c.has_queued()) continue;
+		//...and only send on those marked writable:
+		if (FD_ISSET(c.socket, &write_fds)) send_connection(where, c, on_event, syscalls);
+		else check_send_limit(where, c, on_event);
 	}
 
-		
+	//(handlers may have queued more data, but the next select() will notice it)
+	for (Connection *c : pending) {
+		c->is_pending = false;
+	}
+	pending.clear();
 }
 
 //---------------------------------
+//Polling helper used by both server and client:
+static void poll_connections(
+	char const *where,
+	int epoll_fd,
+	Connections &connections,
+	std::vector< Connection * > &pending,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	double timeout,
+	Socket listen_socket,
+	Socket shm_listen_socket,
+	Connections *shm_accepting,
+	SyscallCounts &syscalls) {
 
+	#ifdef __linux__
+	assert(epoll_fd >= 0);
+	poll_connections_epoll(where, epoll_fd, connections, pending, on_event, timeout, listen_socket, shm_listen_socket, shm_accepting, syscalls);
+	#else
+	(void)epoll_fd;
+	(void)shm_listen_socket; //(shared memory is linux-only)
+	(void)shm_accepting;
+	poll_connections_select(where, connections, pending, on_event, timeout, listen_socket, syscalls);
+	#endif
+}
 
-Server::Server(std::string const &port) {
+//Flush helper used by both server and client:
+static void flush_connections(
+	char const *where,
+	int epoll_fd,
+	Connections &connections,
+	std::vector< Connection * > &pending,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	SyscallCounts &syscalls) {
+
+	#ifdef __linux__
+	assert(epoll_fd >= 0);
+	(void)connections;
+	flush_pending(where, epoll_fd, pending, on_event, syscalls);
+	#else
+	(void)epoll_fd;
+	for (Connection *c : pending) {
+		c->is_pending = false;
+	}
+	pending.clear();
+	for (auto &c : connections) {
+		if (c.socket == InvalidSocket || !c.has_queued()) continue;
+		send_connection(where, c, on_event, syscalls);
+	}
+	#endif
+}
+
+//---------------------------------
+
+
+Server::Server(std::string const &port, Transport transport, ListenSettings const &listen) {
 
 	#ifdef _WIN32
 	{ //init winsock:
@@ -195,6 +793,13 @@ Server::Server(std::string const &port) {
 	}
 	#endif
 
+	if (transport == Transport::UDP) {
+		udp = std::make_unique< UdpEndpoint >();
+		udp->is_server = true;
+		udp->socket = udp_bind(port);
+		return;
+	}
+
 	{ //use getaddrinfo to look up how to bind to port:
 		struct addrinfo hints;
 		memset(&hints, 0, sizeof(hints));
@@ -247,6 +852,21 @@ Server::Server(std::string const &port) {
 				}
 			}
 
+			if (listen.reuse_port) { //let several sockets (e.g., on different threads) listen on the port:
+				#ifdef SO_REUSEPORT
+				int one = 1;
+				if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0) {
+					std::cout << "(failed to set SO_REUSEPORT: " << strerror(errno) << ")" << std::endl;
+					closesocket(s);
+					continue;
+				}
+				#else
+				std::cout << "(SO_REUSEPORT isn't supported on this platform)" << std::endl;
+				closesocket(s);
+				continue;
+				#endif
+			}
+
 			int ret = bind(s, info->ai_addr, int(info->ai_addrlen));
 			if (ret < 0) {
 				std::cout << "(failed to bind: " << strerror(errno) << ")" << std::endl;
@@ -266,28 +886,387 @@ Server::Server(std::string const &port) {
 	}
 
 	{ //listen on socket
-		int ret = ::listen(listen_socket, 5);
+		// (the kernel queues up to 'backlog' connections for accept(); beyond that, new ones have to retry,
+		//  which takes a second or more -- so a burst of (re)connecting clients needs a deep queue)
+		int ret = ::listen(listen_socket, listen.backlog);
 		if (ret < 0) {
 			closesocket(listen_socket);
 			throw std::system_error(errno, std::system_category(), "failed to listen on socket");
 		}
 	}
+
+	{ //accept() is called until there are no more connections waiting, so mustn't block:
+		#ifdef _WIN32
+		unsigned long one = 1;
+		int ret = ioctlsocket(listen_socket, FIONBIO, &one);
+		#else
+		int ret = fcntl(listen_socket, F_SETFL, fcntl(listen_socket, F_GETFL) | O_NONBLOCK);
+		#endif
+		if (ret != 0) {
+			closesocket(listen_socket);
+			throw std::system_error(errno, std::system_category(), "failed to make listen socket non-blocking");
+		}
+	}
+
+	#ifdef __linux__
+	epoll_fd = epoll_create_or_throw();
+	epoll_watch_listen(epoll_fd, listen_socket);
+	#endif
+
+	if (!listen.shm_name.empty()) { //also listen for connections over shared memory:
+		shm_listen_socket = shm_listen(listen.shm_name);
+		#ifdef __linux__
+		epoll_watch_listen(epoll_fd, shm_listen_socket, shm_listen_tag());
+		#endif
+		std::cout << "[Server::Server] accepting shared-memory connections at shm:" << listen.shm_name << "." << std::endl;
+	}
+}
+
+Server::Server() {
+	#ifdef _WIN32
+	{ //init winsock:
+		WSADATA info;
+		if (WSAStartup((2 << 8) | 2, &info) != 0) {
+			throw std::runtime_error("WSAStartup failed.");
+		}
+	}
+	#endif
+
+	#ifdef __linux__
+	epoll_fd = epoll_create_or_throw();
+	#endif
+}
+
+Server::~Server() {
+	//close open connections (so their peers see them close -- for shared memory, this also unmaps the segment):
+	// (released connections aren't here, so whoever adopted them keeps them open)
+	for (auto &c : connections) {
+		c.close();
+	}
+	for (auto &c : shm_accepting) {
+		c.close();
+	}
+	if (listen_socket != InvalidSocket) {
+		closesocket(listen_socket);
+	}
+	if (shm_listen_socket != InvalidSocket) {
+		closesocket(shm_listen_socket); //(frees the name for another server)
+	}
+	if (udp) {
+		closesocket(udp->socket);
+	}
+	if (epoll_fd >= 0) {
+		::close(epoll_fd);
+		epoll_fd = -1;
+	}
 }
 
 void Server::poll(std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
-	poll_connections("Server::poll", connections, on_event, timeout, listen_socket);
+	if (udp) {
+		udp_poll("Server::poll", *udp, connections, pending, unreliable_messages, on_event, timeout, syscalls);
+	} else {
+		poll_connections("Server::poll", epoll_fd, connections, pending, on_event, timeout, listen_socket, shm_listen_socket, &shm_accepting, syscalls);
+	}
+
+	//give up on shared-memory connections that haven't sent their segments in time, and discard finished ones:
+	if (!shm_accepting.empty()) {
+		auto now = std::chrono::steady_clock::now();
+		for (Connection &c : shm_accepting) {
+			if (c.socket != InvalidSocket && now >= c.shm->setup_deadline) {
+				std::cerr << "[Server::poll] shared-memory client on " << c.socket << " didn't send its segment in time; closing its connection." << std::endl;
+				c.close();
+			}
+			if (c.socket == InvalidSocket) shm_accepting.erase(c.handle);
+		}
+	}
 
 	//reap closed clients:
-	for (auto connection = connections.begin(); connection != connections.end(); /*later*/) {
-		auto old = connection;
-		++connection;
-		if (old->socket == InvalidSocket) {
-			connections.erase(old);
+	// (their slots are reused for later connections; handles to them go stale)
+	for (Connection &c : connections) {
+		if (c.socket == InvalidSocket) {
+			if (c.is_pending) {
+				pending.erase(std::find(pending.begin(), pending.end(), &c));
+			}
+			if (udp) udp_forget(*udp, c);
+			closed_stats.merge(c.stats);
+			closed_connections += 1;
+			connections.erase(c.handle);
+		}
+	}
+}
+
+void Server::flush(std::function< void(Connection *, Connection::Event event) > const &on_event) {
+	if (udp) {
+		udp_flush("Server::flush", *udp, connections, pending, unreliable_messages, on_event, syscalls);
+	} else {
+		flush_connections("Server::flush", epoll_fd, connections, pending, on_event, syscalls);
+	}
+}
+
+ReleasedConnection Server::release(Connection *connection) {
+	assert(connection && *connection);
+	assert(!connection->udp && "can't release UDP connections (they share the server's socket)");
+
+	#ifdef __linux__
+	if (connection->shm) {
+		shm_watch(epoll_fd, *connection, false, syscalls);
+	} else {
+		syscalls.control += 1;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->socket, nullptr) != 0) {
+			throw std::system_error(errno, std::system_category(), "failed to remove socket from epoll");
 		}
 	}
+	connection->write_armed = false;
+	#endif
+
+	ReleasedConnection released;
+	released.socket = connection->socket;
+	released.shm = std::move(connection->shm);
+	connection->socket = InvalidSocket;
+	return released;
+}
+
+Connection *Server::adopt(ReleasedConnection &&released) {
+	assert(released.socket != InvalidSocket);
+	assert(!udp && "can't adopt sockets into a UDP server");
+
+	Connection &c = add_connection(connections);
+	c.socket = released.socket;
+	c.shm = std::move(released.shm);
+	c.pending = &pending;
+	released.socket = InvalidSocket;
+
+	#ifdef __linux__
+	//(edge-triggered registration still reports data that arrived before the socket was added)
+	epoll_watch(epoll_fd, c, EPOLL_CTL_ADD, false, syscalls);
+	#endif
+
+	return &c;
+}
+
+void Server::write_stats(std::ostream &out, double elapsed, size_t max_connections) const {
+	write_connection_stats(out, connections, closed_stats, closed_connections, elapsed, max_connections);
 }
 
-Client::Client(std::string const &host, std::string const &port) : connections(1), connection(connections.front()) {
+void Server::reset_stats() {
+	for (auto &c : connections) {
+		c.stats.reset();
+	}
+	closed_stats = ConnectionStats();
+	closed_connections = 0;
+}
+
+void Server::broadcast(SharedBytes const &bytes, std::function< void(Connection *) > const &send_header) {
+	for (auto &c : connections) {
+		if (!c) continue;
+		if (send_header) send_header(&c);
+		c.send_shared(bytes);
+	}
+}
+
+//---------------------------------
+//Client connection attempts:
+// The server's addresses are looked up -- on a helper thread if that might mean asking a DNS server --
+// and then tried "Happy Eyeballs" style (RFC 8305): address families are interleaved, and a non-blocking
+// connect() to the next address starts every attempt_delay seconds (or as soon as an attempt fails),
+// until one connects (the rest are abandoned), all have failed, or the timeout passes.
+
+struct ConnectAddress {
+	struct sockaddr_storage address;
+	socklen_t length = 0;
+	int family = AF_UNSPEC;
+};
+
+//an address lookup running on a helper thread:
+// (shared with the thread, since a lookup stuck on a slow DNS server may outlive the attempt that started it)
+struct AddressLookup {
+	std::mutex mutex; //protects:
+	bool done = false;
+	std::vector< ConnectAddress > addresses;
+	std::string error; //(if the lookup failed)
+};
+
+struct ConnectAttempt {
+	std::chrono::steady_clock::time_point started;
+	std::shared_ptr< AddressLookup > lookup; //(until the lookup finishes)
+	std::vector< ConnectAddress > addresses; //in the order to try them
+	size_t next = 0; //index of the next address to try...
+	std::chrono::steady_clock::time_point next_at; //...and when to start on it, if no attempt in flight has finished by then
+	struct InFlight {
+		Socket socket;
+		size_t address;
+	};
+	std::vector< InFlight > in_flight; //sockets with a connect() in progress
+	std::string error; //why the latest attempt failed
+
+	ConnectAttempt() = default;
+	ConnectAttempt(ConnectAttempt const &) = delete;
+	ConnectAttempt &operator=(ConnectAttempt const &) = delete;
+	~ConnectAttempt() {
+		for (InFlight const &f : in_flight) {
+			closesocket(f.socket);
+		}
+	}
+};
+
+static std::string describe_address(ConnectAddress const &a) {
+	char ip[INET6_ADDRSTRLEN] = "";
+	if (a.family == AF_INET) {
+		struct sockaddr_in const *s = reinterpret_cast< struct sockaddr_in const * >(&a.address);
+		inet_ntop(AF_INET, &s->sin_addr, ip, sizeof(ip));
+		return std::string(ip) + ":" + std::to_string(ntohs(s->sin_port));
+	} else if (a.family == AF_INET6) {
+		struct sockaddr_in6 const *s = reinterpret_cast< struct sockaddr_in6 const * >(&a.address);
+		inet_ntop(AF_INET6, &s->sin6_addr, ip, sizeof(ip));
+		return "[" + std::string(ip) + "]:" + std::to_string(ntohs(s->sin6_port));
+	} else {
+		return "[unknown ai_family]";
+	}
+}
+
+//look up host:port (as TCP addresses); returns getaddrinfo's result:
+static int lookup_addresses(std::string const &host, std::string const &port, int flags, std::vector< ConnectAddress > *addresses_) {
+	assert(addresses_);
+	auto &addresses = *addresses_;
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	hints.ai_flags = flags;
+
+	struct addrinfo *res = nullptr;
+	int ret = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+	if (ret != 0) return ret;
+	for (struct addrinfo *info = res; info != nullptr; info = info->ai_next) {
+		if (info->ai_addrlen > sizeof(ConnectAddress::address)) continue;
+		ConnectAddress a;
+		memcpy(&a.address, info->ai_addr, info->ai_addrlen);
+		a.length = socklen_t(info->ai_addrlen);
+		a.family = info->ai_family;
+		addresses.emplace_back(a);
+	}
+	freeaddrinfo(res);
+	return 0;
+}
+
+//order addresses for trying: alternate between families, starting with the family listed first
+// (so if one family is broken -- e.g., IPv6 routes that go nowhere -- the other gets a try right away):
+static std::vector< ConnectAddress > interleave_families(std::vector< ConnectAddress > const &addresses) {
+	std::vector< ConnectAddress > first, other;
+	for (ConnectAddress const &a : addresses) {
+		(a.family == addresses[0].family ? first : other).emplace_back(a);
+	}
+	std::vector< ConnectAddress > ret;
+	for (size_t i = 0; i < std::max(first.size(), other.size()); ++i) {
+		if (i < first.size()) ret.emplace_back(first[i]);
+		if (i < other.size()) ret.emplace_back(other[i]);
+	}
+	return ret;
+}
+
+//start connect() calls to the attempt's next addresses, if they are due:
+// (one is due if nothing is in flight, or the latest has had its head start)
+static void start_due_connects(ConnectAttempt &a, int epoll_fd, std::chrono::steady_clock::time_point now, ConnectSettings const &settings, SyscallCounts &syscalls) {
+	while (a.next < a.addresses.size() && (a.in_flight.empty() || now >= a.next_at)) {
+		ConnectAddress const &address = a.addresses[a.next];
+		size_t index = a.next;
+		a.next += 1;
+		a.next_at = now + std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(settings.attempt_delay));
+
+		std::cout << "\ttrying " << describe_address(address) << "..." << std::endl;
+		Socket s = socket(address.family, SOCK_STREAM, IPPROTO_TCP);
+		if (s == InvalidSocket) {
+			a.error = "failed to create socket: " + std::string(strerror(errno));
+			continue;
+		}
+		#ifdef _WIN32
+		unsigned long one = 1;
+		if (0 != ioctlsocket(s, FIONBIO, &one)) {
+			a.error = "failed to make socket non-blocking";
+			closesocket(s);
+			continue;
+		}
+		#else
+		if (fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK) != 0) {
+			a.error = "failed to make socket non-blocking: " + std::string(strerror(errno));
+			closesocket(s);
+			continue;
+		}
+		#endif
+
+		int ret = ::connect(s, reinterpret_cast< struct sockaddr const * >(&address.address), address.length);
+		#ifdef _WIN32
+		bool in_progress = (ret != 0 && WSAGetLastError() == WSAEWOULDBLOCK);
+		#else
+		bool in_progress = (ret != 0 && errno == EINPROGRESS);
+		#endif
+		if (ret != 0 && !in_progress) {
+			a.error = describe_address(address) + ": " + std::string(strerror(errno));
+			closesocket(s);
+			continue;
+		}
+		//(even a connect() that finished right away -- e.g., to a local address -- is picked up by the next wait)
+
+		#ifdef __linux__
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLOUT; //(errors are always reported)
+		ev.data.fd = s;
+		syscalls.control += 1;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, s, &ev) != 0) {
+			closesocket(s);
+			throw std::system_error(errno, std::system_category(), "failed to watch connecting socket");
+		}
+		#else
+		(void)epoll_fd;
+		(void)syscalls;
+		#endif
+		a.in_flight.emplace_back(ConnectAttempt::InFlight{s, index});
+	}
+}
+
+//wait up to 'timeout' for connect() calls in flight to finish; returns the sockets that have:
+static std::vector< Socket > wait_for_connects(ConnectAttempt const &a, int epoll_fd, double timeout, SyscallCounts &syscalls) {
+	std::vector< Socket > finished;
+	#ifdef __linux__
+	(void)a;
+	//(while connecting, the connecting sockets are all that epoll_fd holds)
+	constexpr int MaxEvents = 16;
+	struct epoll_event events[MaxEvents];
+	int count = epoll_wait(epoll_fd, events, MaxEvents, int(std::ceil(std::max(0.0, timeout) * 1000.0)));
+	syscalls.wait += 1;
+	for (int i = 0; i < count; ++i) {
+		finished.emplace_back(Socket(events[i].data.fd));
+	}
+	#else
+	(void)epoll_fd;
+	//(windows reports failed connects in the 'except' set)
+	fd_set write_fds, except_fds;
+	FD_ZERO(&write_fds);
+	FD_ZERO(&except_fds);
+	int max = 0;
+	for (auto const &f : a.in_flight) {
+		max = std::max(max, int(f.socket));
+		FD_SET(f.socket, &write_fds);
+		FD_SET(f.socket, &except_fds);
+	}
+	struct timeval tv;
+	tv.tv_sec = std::lround(std::floor(timeout));
+	tv.tv_usec = std::lround((timeout - std::floor(timeout)) * 1e6);
+	int ret = select(max + 1, &write_fds, NULL, &except_fds, &tv);
+	syscalls.wait += 1;
+	if (ret > 0) {
+		for (auto const &f : a.in_flight) {
+			if (FD_ISSET(f.socket, &write_fds) || FD_ISSET(f.socket, &except_fds)) finished.emplace_back(f.socket);
+		}
+	}
+	#endif
+	return finished;
+}
+
+Client::Client(std::string const &host_, std::string const &port_, Transport transport_, ConnectSettings const &settings_) : connection(add_connection(connections)), host(host_), port(port_), transport(transport_), settings(settings_) {
 	#ifdef _WIN32
 	{ //init winsock:
 		WSADATA info;
@@ -297,65 +1276,213 @@ Client::Client(std::string const &host, std::string const &port) : connections(1
 	}
 	#endif
 
-	{ //use getaddrinfo to look up how to bind to host/port:
-		struct addrinfo hints;
-		memset(&hints, 0, sizeof(hints));
-		hints.ai_family = AF_UNSPEC;
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_protocol = IPPROTO_TCP;
+	if (transport == Transport::UDP && !shm_address(host)) {
+		udp = std::make_unique< UdpEndpoint >();
+	} else {
+		#ifdef __linux__
+		epoll_fd = epoll_create_or_throw();
+		#endif
+	}
 
-		struct addrinfo *res = nullptr;
-		int addrinfo_ret = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
-		if (addrinfo_ret != 0) {
-			throw std::runtime_error("getaddrinfo error: " + std::string(gai_strerror(addrinfo_ret)));
-		}
+	connect();
+}
 
-		std::cout << "[Client::Client] connecting to " << host << ":" << port << ":" << std::endl;
-		//based on example code in the 'man getaddrinfo' man page on OSX:
-		for (struct addrinfo *info = res; info != nullptr; info = info->ai_next) {
-			{ //DEBUG: dump info about this address:
-				std::cout << "\ttrying ";
-				char ip[INET6_ADDRSTRLEN];
-				if (info->ai_family == AF_INET) {
-					struct sockaddr_in *s = reinterpret_cast< struct sockaddr_in * >(info->ai_addr);
-					inet_ntop(res->ai_family, &s->sin_addr, ip, sizeof(ip));
-					std::cout << ip << ":" << ntohs(s->sin_port);
-				} else if (info->ai_family == AF_INET6) {
-					struct sockaddr_in6 *s = reinterpret_cast< struct sockaddr_in6 * >(info->ai_addr);
-					inet_ntop(res->ai_family, &s->sin6_addr, ip, sizeof(ip));
-					std::cout << ip << ":" << ntohs(s->sin6_port);
-				} else {
-					std::cout << "[unknown ai_family]";
-				}
-				std::cout << "... "; std::cout.flush();
-			}
+void Client::reconnect() {
+	connection.close();
+	attempt.reset();
 
-			Socket s = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
-			if (s == InvalidSocket) {
-				std::cout << "(failed to create socket: " << strerror(errno) << ")" << std::endl;
-				continue;
-			}
-			int ret = connect(s, info->ai_addr, int(info->ai_addrlen));
-			if (ret < 0) {
-				std::cout << "(failed to connect: " << strerror(errno) << ")" << std::endl;
-				continue;
-			}
-			std::cout << "success!" << std::endl;
+	//start over with an empty connection:
+	// (stats carry on, so telemetry covers the whole session)
+	if (connection.is_pending) {
+		pending.erase(std::find(pending.begin(), pending.end(), &connection));
+		connection.is_pending = false;
+	}
+	connection.send_buffer.clear();
+	connection.recv_buffer.clear();
+	connection.write_armed = false;
+	connection.udp.reset();
+	connection.shm.reset();
+	connection.recv_frames = FrameCounter();
+	connection.send_frames = FrameCounter();
+	connection.unparsed.clear();
 
-			connection.socket = s;
-			break;
+	connect();
+}
+
+void Client::connect() {
+	assert(!connection);
+	assert(!attempt);
+
+	std::string shm_name;
+	if (shm_address(host, &shm_name)) {
+		shm_connect(shm_name, &connection, syscalls);
+		connection.pending = &pending;
+		#ifdef __linux__
+		epoll_watch(epoll_fd, connection, EPOLL_CTL_ADD, false, syscalls);
+		#endif
+		announce_open = true;
+		return;
+	}
+
+	if (udp) {
+		udp_connect(host, port, &connection, syscalls);
+		udp->socket = connection.socket;
+		connection.pending = &pending;
+		announce_open = true;
+		return;
+	}
+
+	std::cout << "[Client::connect] connecting to " << host << ":" << port << ":" << std::endl;
+	attempt = std::make_unique< ConnectAttempt >();
+	attempt->started = std::chrono::steady_clock::now();
+
+	//numeric addresses need no lookup, so the first connect() can start right away:
+	std::vector< ConnectAddress > addresses;
+	if (lookup_addresses(host, port, AI_NUMERICHOST, &addresses) == 0) {
+		attempt->addresses = interleave_families(addresses);
+		start_due_connects(*attempt, epoll_fd, attempt->started, settings, syscalls);
+		return;
+	}
+
+	//anything else may take a while to look up (e.g., if the DNS server is slow), so do that on a helper thread:
+	auto lookup = std::make_shared< AddressLookup >();
+	attempt->lookup = lookup;
+	std::thread([lookup, host = host, port = port]() {
+		std::vector< ConnectAddress > found;
+		int ret = lookup_addresses(host, port, 0, &found);
+		std::lock_guard< std::mutex > lock(lookup->mutex);
+		if (ret != 0) lookup->error = "getaddrinfo error: " + std::string(gai_strerror(ret));
+		lookup->addresses = std::move(found);
+		lookup->done = true;
+	}).detach();
+}
+
+//how often poll() checks on an address lookup (which has no socket to wait on):
+static constexpr double LookupCheckInterval = 0.005;
+
+void Client::continue_connect(std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
+	assert(attempt);
+	ConnectAttempt &a = *attempt;
+	auto now = std::chrono::steady_clock::now();
+
+	//give up (reporting OnClose, as for a connection that closes):
+	auto fail = [&](std::string const &why) {
+		std::cerr << "[Client::poll] failed to connect to " << host << ":" << port << " (" << why << ")." << std::endl;
+		attempt.reset();
+		if (on_event) on_event(&connection, Connection::OnClose);
+	};
+
+	//take the lookup's addresses, once it is done:
+	if (a.lookup) {
+		std::unique_lock< std::mutex > lock(a.lookup->mutex);
+		if (a.lookup->done) {
+			if (!a.lookup->error.empty()) {
+				std::string error = a.lookup->error;
+				lock.unlock();
+				fail(error);
+				return;
+			}
+			a.addresses = interleave_families(a.lookup->addresses);
+			lock.unlock();
+			a.lookup.reset();
 		}
+	}
 
-		freeaddrinfo(res);
+	start_due_connects(a, epoll_fd, now, settings, syscalls);
+
+	double elapsed = std::chrono::duration< double >(now - a.started).count();
+	if (!a.lookup && a.in_flight.empty()) {
+		fail(a.addresses.empty() ? "no addresses found" : a.error);
+		return;
+	}
+	if (elapsed >= settings.timeout) {
+		std::ostringstream why;
+		why << "timed out after " << settings.timeout << "s";
+		fail(why.str());
+		return;
+	}
+
+	//wait for a connect() to finish -- but no longer than until the next is due (or the lookup may be done, or time is up):
+	double wait = std::min(timeout, settings.timeout - elapsed);
+	if (a.lookup) wait = std::min(wait, LookupCheckInterval);
+	if (a.next < a.addresses.size()) wait = std::min(wait, std::chrono::duration< double >(a.next_at - now).count());
+	std::vector< Socket > finished = wait_for_connects(a, epoll_fd, std::max(0.0, wait), syscalls);
+
+	for (Socket s : finished) {
+		auto f = std::find_if(a.in_flight.begin(), a.in_flight.end(), [s](ConnectAttempt::InFlight const &in_flight) { return in_flight.socket == s; });
+		assert(f != a.in_flight.end());
+		ConnectAddress const &address = a.addresses[f->address];
 
-		if (!connection) {
-			throw std::runtime_error("Failed to connect to any of the addresses tried for server.");
+		int err = 0;
+		socklen_t err_size = sizeof(err);
+		if (getsockopt(s, SOL_SOCKET, SO_ERROR, reinterpret_cast< char * >(&err), &err_size) != 0) err = errno;
+		if (err != 0) {
+			//this address failed; the next one (if any) can start right away:
+			a.error = describe_address(address) + ": " + std::string(strerror(err));
+			std::cout << "\t(failed to connect to " << a.error << ")" << std::endl;
+			closesocket(s); //(which also removes it from epoll_fd)
+			a.in_flight.erase(f);
+			a.next_at = now;
+			continue;
 		}
+
+		//connected! (the other attempts are abandoned)
+		std::cout << "\tconnected to " << describe_address(address) << "." << std::endl;
+		a.in_flight.erase(f);
+		set_no_delay(s);
+		#ifdef __linux__
+		syscalls.control += 1;
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s, nullptr);
+		#endif
+		attempt.reset();
+
+		connection.socket = s;
+		connection.pending = &pending;
+		#ifdef __linux__
+		epoll_watch(epoll_fd, connection, EPOLL_CTL_ADD, false, syscalls);
+		#endif
+		if (connection.has_queued()) connection.mark_pending();
+		if (on_event) on_event(&connection, Connection::OnOpen);
+		return;
+	}
+}
+
+Client::~Client() {
+	attempt.reset(); //(closes any sockets still connecting)
+	connection.close();
+	if (epoll_fd >= 0) {
+		::close(epoll_fd);
+		epoll_fd = -1;
 	}
 }
 
 
 void Client::poll(std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
-	poll_connections("Client::poll", connections, on_event, timeout, InvalidSocket);
+	if (announce_open) {
+		announce_open = false;
+		if (on_event) on_event(&connection, Connection::OnOpen);
+		timeout = 0.0; //(the handler may have queued data)
+	}
+	if (attempt) {
+		continue_connect(on_event, timeout);
+		if (!connection) return;
+		timeout = 0.0; //(just opened: send anything queued, and see if anything has arrived already)
+	}
+	if (udp) {
+		udp_poll("Client::poll", *udp, connections, pending, unreliable_messages, on_event, timeout, syscalls);
+	} else {
+		poll_connections("Client::poll", epoll_fd, connections, pending, on_event, timeout, InvalidSocket, InvalidSocket, nullptr, syscalls);
+	}
+}
+
+void Client::flush(std::function< void(Connection *, Connection::Event event) > const &on_event) {
+	if (udp) {
+		udp_flush("Client::flush", *udp, connections, pending, unreliable_messages, on_event, syscalls);
+	} else {
+		flush_connections("Client::flush", epoll_fd, connections, pending, on_event, syscalls);
+	}
 }
 
+void Client::write_stats(std::ostream &out, double elapsed) const {
+	write_connection_stats(out, connections, ConnectionStats(), 0, elapsed, 1);
+}
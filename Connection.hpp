@@ -14,8 +14,8 @@ int main(int argc, char **argv) {
 		server.poll([](Connection *connection, Connection::Event evt){
 			if (evt == Connection::OnRecv) {
 				//extract and erase data from the connection's recv_buffer:
-				std::vector< uint8_t > data = connection->recv_buffer;
-				connection->recv_buffer.clear();
+				std::vector< uint8_t > data(connection->recv_buffer.data(), connection->recv_buffer.data() + connection->recv_buffer.size());
+				connection->recv_buffer.consume(data.size());
 				//send to other connections:
 
 			}
@@ -27,7 +27,7 @@ int main(int argc, char **argv) {
 
 //simple client
 int main(int argc, char **argv) {
-	Client client("localhost", "1337"); //connect to a local server at port 1337
+	Client client("localhost", "1337"); //start connecting to a local server at port 1337 (poll() reports OnOpen once connected)
 	while (true) {
 		client.poll([](Connection *connection, Connection::Event evt){
 			
@@ -60,13 +60,73 @@ int main(int argc, char **argv) {
 #endif
 //--------- ---------------------------------- ---------
 
+#include "ByteQueue.hpp"
+#include "Histogram.hpp"
+#include "SlotMap.hpp"
+
 #include <vector>
-#include <list>
+#include <deque>
 #include <string>
+#include <chrono>
 #include <functional>
+#include <memory>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+
+struct UdpPeer;
+struct UdpEndpoint;
+struct ShmPeer;
+struct ConnectAttempt;
+
+//Counts [type][size (24 bits)][payload] message frames in a byte stream that is fed to it in pieces:
+struct FrameCounter {
+	//feed the next 'count' bytes of the stream; returns the number of frames completed:
+	// (if 'ends' is given, the stream offset just past each completed frame is passed to it)
+	uint32_t feed(uint8_t const *data, size_t count, std::function< void(uint64_t) > const &ends = nullptr);
+
+	uint64_t offset = 0; //bytes fed so far
+private:
+	uint8_t header[4];
+	uint32_t header_have = 0; //bytes of the current frame's header seen so far
+	uint32_t remaining = 0; //payload bytes left in the current frame (once its header is complete)
+};
+
+//Per-connection telemetry:
+// counters accumulate until reset(); round-trip times come from ping/pong messages (see Game.hpp)
+struct ConnectionStats {
+	uint64_t bytes_in = 0; //bytes received (for UDP, whole packets)
+	uint64_t bytes_out = 0; //bytes sent (for UDP, whole packets)
+	uint64_t messages_in = 0; //complete messages received
+	uint64_t messages_out = 0; //complete messages sent
+	size_t send_queue_high_water = 0; //most bytes seen waiting in send_buffer
+	Histogram parse_latency; //time from a message arriving to it being consumed from recv_buffer
+	uint64_t superseded = 0; //latest-wins messages replaced by newer ones before they were sent (see Connection::send_latest)
+	uint64_t dropped = 0; //latest-wins messages still unsent when the connection closed
+	uint64_t overflows = 0; //times the connection was closed for exceeding its send_limit
+
+	//round-trip time estimates (seconds), updated by add_rtt():
+	uint32_t rtt_samples = 0;
+	double rtt = 0.0; //latest sample
+	double rtt_smoothed = 0.0; //moving average (weight 1/8, as in TCP)
+	double rtt_jitter = 0.0; //moving average of |sample - rtt_smoothed| (weight 1/4, as in TCP)
+	double rtt_min = std::numeric_limits< double >::infinity();
+	void add_rtt(double sample);
+
+	//clear the counters (but keep the round-trip estimates):
+	void reset();
+
+	//add another connection's counters to these (for totals; round-trip estimates aren't merged):
+	void merge(ConnectionStats const &other);
+};
 
 //Thin wrapper around a (polling-based) TCP socket connection:
+// (or, with Transport::UDP, a connection over the UDP transport in UdpTransport.hpp;
+//  or, to "shm:<name>" addresses, a connection over the shared-memory transport in ShmTransport.hpp)
 struct Connection {
+	Connection();
+	~Connection();
+
 	//Helper that will append any type to the send buffer:
 	template< typename T >
 	void send(T const &t) {
@@ -74,8 +134,34 @@ struct Connection {
 	}
 	//Helper that will append raw bytes to the send buffer:
 	void send_raw(void const *data, size_t size) {
-		send_buffer.insert(send_buffer.end(), reinterpret_cast< uint8_t const * >(data), reinterpret_cast< uint8_t const * >(data) + size);
+		send_buffer.append(data, size);
+		mark_pending();
 	}
+	//Helper that will queue shared bytes in the send buffer without copying them:
+	void send_shared(SharedBytes const &bytes) {
+		send_buffer.append_shared(bytes);
+		mark_pending();
+	}
+
+	//Latest-wins slot, for messages (like state updates) where only the newest is worth sending:
+	// send_latest() puts a message -- a small header (copied) followed by shared bytes (not copied) --
+	// in the slot, replacing any message still waiting there (counted in stats.superseded).
+	// The slot is moved to the back of send_buffer only once everything queued ahead of it has been
+	// sent, so a reader that falls behind gets the newest message when it catches up rather than a
+	// backlog of stale ones. (messages queued after it with send() may go out before it)
+	void send_latest(void const *header, size_t header_size, SharedBytes const &bytes);
+	bool has_latest() const { return latest_waiting; }
+	//(used by the transports) move the slot's message (if any) to the back of send_buffer:
+	void queue_latest();
+
+	//is anything waiting to be sent?
+	bool has_queued() const { return !send_buffer.empty() || latest_waiting; }
+
+	//send_buffer may hold at most this many bytes once as much as possible has been sent;
+	// a connection whose reader falls further behind is closed (counted in stats.overflows):
+	// (messages other than latest-wins ones have nowhere else to go, so this bounds memory per connection)
+	size_t send_limit = DefaultSendLimit;
+	static constexpr size_t DefaultSendLimit = size_t(1) << 20;
 
 	//Call 'close' to mark a connection for discard:
 	void close();
@@ -83,13 +169,43 @@ struct Connection {
 	//so you can if(connection) ... to check for validity:
 	explicit operator bool() { return socket != InvalidSocket; }
 
-	//To send data over a connection, append it to send_buffer:
-	std::vector< uint8_t > send_buffer;
+	//To send data over a connection, use send() / send_raw() to append it to send_buffer:
+	// (if you append to send_buffer directly, call mark_pending() afterward so poll() notices)
+	SendQueue send_buffer;
 	//When the connection receives data, it is appended to recv_buffer:
-	std::vector< uint8_t > recv_buffer;
+	// (parse from recv_buffer.data() and call recv_buffer.consume() to remove handled messages)
+	RecvBuffer recv_buffer;
 
 	//internals:
 	Socket socket = InvalidSocket;
+	SlotHandle handle; //this connection's name in its owner's connections (see SlotMap.hpp)
+
+	std::vector< uint8_t > latest_header; //latest-wins slot contents (see send_latest)
+	SharedBytes latest_bytes;
+	bool latest_waiting = false;
+
+	//connections with queued data note themselves in their owner's pending list,
+	// so poll() doesn't need to scan every connection to find data to send:
+	void mark_pending() {
+		if (pending && !is_pending && socket != InvalidSocket) {
+			pending->emplace_back(this);
+			is_pending = true;
+		}
+	}
+	std::vector< Connection * > *pending = nullptr; //set by owning Server/Client
+	bool is_pending = false; //is this connection in the pending list?
+	bool write_armed = false; //(epoll backend) is EPOLLOUT currently requested for this socket?
+	std::unique_ptr< UdpPeer > udp; //(UDP transport) sequencing / reliability state
+	std::unique_ptr< ShmPeer > shm; //(shared-memory transport) rings and wakeups
+
+	ConnectionStats stats;
+	//(used by the transports to keep stats) note that 'count' bytes were just appended to recv_buffer, or sent:
+	void note_received(size_t count);
+	void note_sent(size_t count); //(call before removing the sent bytes from send_buffer)
+	//...and, after an OnRecv handler returns, that it may have parsed some messages:
+	void note_parsed();
+	FrameCounter recv_frames, send_frames;
+	std::deque< std::pair< uint64_t, std::chrono::steady_clock::time_point > > unparsed; //(stream offset of end, arrival time) of unparsed messages
 
 	enum Event {
 		OnOpen,
@@ -98,8 +214,85 @@ struct Connection {
 	};
 };
 
+//Server and Client keep their connections in a slot map, so each can be named by a (stable, checkable) handle:
+typedef SlotMap< Connection > Connections;
+
+//(used by Server, Client, and the transports) add a new (not yet open) connection:
+inline Connection &add_connection(Connections &connections) {
+	SlotHandle handle = connections.emplace();
+	Connection &connection = connections[handle];
+	connection.handle = handle;
+	return connection;
+}
+
+//Counts of socket-related system calls made by a Server or Client, for profiling:
+// (e.g., sample before and after a tick to get per-tick counts)
+struct SyscallCounts {
+	uint64_t wait = 0; //epoll_wait() or select()
+	uint64_t recv = 0; //recv()
+	uint64_t send = 0; //send() or sendmsg()
+	uint64_t accept = 0; //accept()
+	uint64_t control = 0; //epoll_ctl()
+
+	uint64_t total() const { return wait + recv + send + accept + control; }
+	SyscallCounts operator-(SyscallCounts const &o) const {
+		SyscallCounts ret;
+		ret.wait = wait - o.wait;
+		ret.recv = recv - o.recv;
+		ret.send = send - o.send;
+		ret.accept = accept - o.accept;
+		ret.control = control - o.control;
+		return ret;
+	}
+};
+
+//NOTE: on linux, Server and Client use a persistent, edge-triggered epoll registration
+// for their sockets; on other platforms they fall back to select().
+
+//Server and Client can talk over TCP (the default) or UDP:
+// With UDP, messages queued in send_buffer must be framed as [type][size (24 bits)][payload].
+//  Messages whose type is listed in 'unreliable_messages' may be dropped (and stale ones are
+//  never delivered after newer ones); all other messages are resent until acknowledged and are
+//  delivered in order. This keeps a lost state update from delaying the ones after it.
+enum class Transport {
+	TCP,
+	UDP,
+};
+
+//(TCP only) how a Server listens for connections:
+struct ListenSettings {
+	int backlog = 1024; //connections the kernel queues for accept() (capped by the system, e.g. net.core.somaxconn on linux)
+	bool reuse_port = false; //set SO_REUSEPORT, so several Servers can listen on the port (and the kernel spreads connections between them)
+	std::string shm_name; //if set, also accept connections from Clients on this machine to "shm:<shm_name>" (see ShmTransport.hpp; linux only)
+};
+
+//a connection taken out of one Server with release(), to be added to another with adopt():
+struct ReleasedConnection {
+	Socket socket = InvalidSocket;
+	std::unique_ptr< ShmPeer > shm; //(shared-memory connections)
+
+	ReleasedConnection();
+	ReleasedConnection(ReleasedConnection &&);
+	ReleasedConnection &operator=(ReleasedConnection &&);
+	~ReleasedConnection();
+};
+
+//(TCP only) how a Client connects:
+// the server's addresses are tried "Happy Eyeballs" style (RFC 8305): IPv6 and IPv4 addresses are
+// interleaved, and if an attempt hasn't finished after attempt_delay the next one starts alongside it
+// (so a dead address costs a fraction of a second rather than a full TCP timeout); the first to connect wins.
+struct ConnectSettings {
+	double timeout = 10.0; //give up (seconds) if no attempt has connected by then
+	double attempt_delay = 0.25; //head start (seconds) each attempt gets before the next one starts
+};
+
 struct Server {
-	Server(std::string const &port); //pass the port number to listen on, as a string (servname, really)
+	//pass the port number to listen on, as a string (servname, really):
+	Server(std::string const &port, Transport transport = Transport::TCP, ListenSettings const &listen = ListenSettings());
+	Server(); //a server that doesn't listen, and only has connections passed to adopt()
+	~Server();
+	Server(Server const &) = delete;
+	Server &operator=(Server const &) = delete;
 
 	//poll() updates the list of active connections and sends/receives data if possible:
 	// (will wait up to 'timeout' for first event)
@@ -108,13 +301,70 @@ struct Server {
 		double timeout = 0.0 //timeout (seconds)
 	);
 
-	std::list< Connection > connections;
+	//flush() immediately sends as much queued data as possible without waiting:
+	// (each connection's queued data is written with a single gathering sendmsg() where supported;
+	//  e.g., call after queuing per-tick updates so they don't wait for the next poll)
+	void flush(
+		std::function< void(Connection *, Connection::Event event) > const &connection_event = nullptr
+	);
+
+	//broadcast() queues the same (immutable) bytes on every open connection without copying them:
+	// (if supplied, 'send_header' is called for each connection first, to queue any per-connection data)
+	void broadcast(
+		SharedBytes const &bytes,
+		std::function< void(Connection *) > const &send_header = nullptr
+	);
+
+	//(TCP and shared memory only) move connections between Servers (e.g., from an accepting thread to a worker thread):
+	//release() stops watching a connection's socket and returns it (with any shared-memory state); the connection
+	// is marked closed (without an OnClose event) and discarded by the next poll(). Any data already in its buffers
+	// is lost, so take it first (or call this from the OnOpen handler).
+	ReleasedConnection release(Connection *connection);
+	//adopt() adds a connection for an already-connected socket (or one released from another Server):
+	Connection *adopt(ReleasedConnection &&released);
+
+	//open connections (and, until the next poll(), closed ones):
+	// (a connection's address stays the same while it is open; c->handle names it, and
+	//  connections.get(handle) returns nullptr once it has been discarded -- see SlotMap.hpp)
+	Connections connections;
 	Socket listen_socket = InvalidSocket;
+	Socket shm_listen_socket = InvalidSocket; //(if listening for shared-memory connections)
+
+	SyscallCounts syscalls; //running count of syscalls made by poll() and flush()
+
+	//describe open connections' stats (see ConnectionStats), as collected over the last 'elapsed' seconds:
+	// (totals, then the 'max_connections' connections with the most queued data or slowest round trips)
+	void write_stats(std::ostream &out, double elapsed, size_t max_connections = 10) const;
+	//reset every connection's stats counters:
+	void reset_stats();
+	//counters from connections closed since the last reset_stats() (so totals include them):
+	ConnectionStats closed_stats;
+	uint32_t closed_connections = 0;
+
+	//(UDP transport) message types that may be sent unreliably:
+	std::vector< uint8_t > unreliable_messages;
+
+	//internals:
+	std::vector< Connection * > pending; //connections with data waiting in send_buffer
+	int epoll_fd = -1; //(linux only) epoll instance holding listen_socket and all connections
+	std::unique_ptr< UdpEndpoint > udp; //(UDP transport) socket and peers; listen_socket is unused
+	Connections shm_accepting; //(shared memory) connections accepted, but still waiting for their segments (see ShmTransport.hpp)
 };
 
 
 struct Client {
-	Client(std::string const &host, std::string const &port);
+	//start connecting to host:port:
+	// (TCP) returns right away: the address is looked up -- on a helper thread, unless it is numeric -- and
+	//  connected to without blocking (see ConnectSettings), so the caller can get on with other work (e.g.,
+	//  loading assets) meanwhile. poll() reports OnOpen once the connection is open, or OnClose if it can't be
+	//  opened. Data sent before then waits in send_buffer, and goes out once the connection opens.
+	// (UDP) the handshake is done here, and blocks (throws if the server can't be reached); poll() still reports OnOpen.
+	// A host of "shm:<name>" connects over shared memory to a Server on this machine listening under that name
+	//  (see ListenSettings::shm_name; the port and transport are ignored). That is quick, so is done here too.
+	Client(std::string const &host, std::string const &port, Transport transport = Transport::TCP, ConnectSettings const &settings = ConnectSettings());
+	~Client();
+	Client(Client const &) = delete;
+	Client &operator=(Client const &) = delete;
 
 	//poll() checks the status of the active connection and sends/receives data if possible:
 	// (will wait up to 'timeout' for first event)
@@ -123,6 +373,39 @@ struct Client {
 		double timeout = 0.0 //timeout (seconds)
 	);
 
-	std::list< Connection > connections; //will only ever contain exactly one connection
+	//flush() immediately sends as much queued data as possible without waiting:
+	void flush(
+		std::function< void(Connection *, Connection::Event event) > const &connection_event = nullptr
+	);
+
+	//reconnect() replaces a lost (or open) connection with a new one to the same server:
+	// (the connection starts over with nothing queued or received, and connects as in the constructor --
+	//  so OnOpen or OnClose follows from poll(); with UDP, throws if the server can't be reached)
+	void reconnect();
+
+	//is the connection still being opened? (by the constructor or reconnect())
+	bool is_connecting() const { return bool(attempt); }
+
+	Connections connections; //will only ever contain exactly one connection
+
+	SyscallCounts syscalls; //running count of syscalls made by poll() and flush()
 	Connection &connection; //reference to the only connection in the connections list
+
+	//describe the connection's stats (see ConnectionStats), as collected over the last 'elapsed' seconds:
+	void write_stats(std::ostream &out, double elapsed) const;
+
+	//(UDP transport) message types that may be sent unreliably:
+	std::vector< uint8_t > unreliable_messages;
+
+	//internals:
+	std::vector< Connection * > pending; //connections with data waiting in send_buffer
+	int epoll_fd = -1; //(linux only) epoll instance holding the connection's socket
+	std::unique_ptr< UdpEndpoint > udp; //(UDP transport) connection's socket
+	std::string host, port; //(where connect() connects to)
+	Transport transport;
+	ConnectSettings settings;
+	void connect(); //start opening 'connection' (which must be closed)
+	std::unique_ptr< ConnectAttempt > attempt; //(TCP) lookup and connect() calls in progress; null once finished
+	void continue_connect(std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout);
+	bool announce_open = false; //(UDP) connection opened by connect(), but not yet reported by poll()
 };
@@ -1,10 +1,13 @@
 #include "Game.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <glm/gtx/norm.hpp>
 #include <iostream>
 #include <stdexcept>
 
+#include "BitStream.hpp"
 #include "Connection.hpp"
 #include "LitColorTextureProgram.hpp"
 #include "Load.hpp"
@@ -24,23 +27,22 @@ Player *Game::spawn_player() {
 }
 
 void Game::remove_player(Player *player) {
-  bool found = false;
-	std::vector<Player> players{gun, chicken};
-  for (auto pi = players.begin(); pi != players.end(); ++pi) {
-    if (&*pi == player) {
-      players.erase(pi);
-      found = true;
-      break;
-    }
-  }
-  assert(found);
+	assert(player == &gun || player == &chicken);
+	//(clear controls, so the slot's next player doesn't start out holding the last one's buttons)
+	player->controls = Player::Controls();
+	player->input_budget = 0.0f;
+	if (player == &gun) {
+		gun_spawned = false;
+	} else {
+		chicken_spawned = false;
+	}
 }
 
 void Player::Controls::send_controls_message(Connection *connection_) const {
   assert(connection_);
   auto &connection = *connection_;
 
-  uint32_t size = 5;
+  uint32_t size = 5 + 4 + 4;
   connection.send(Message::C2S_Controls);
   connection.send(uint8_t(size));
   connection.send(uint8_t(size >> 8));
@@ -58,25 +60,13 @@ void Player::Controls::send_controls_message(Connection *connection_) const {
   send_button(up);
   send_button(down);
   send_button(jump);
-}
 
-bool Player::Controls::recv_controls_message(Connection *connection_) {
-  assert(connection_);
-  auto &connection = *connection_;
-
-  auto &recv_buffer = connection.recv_buffer;
-
-  // expecting [type, size_low0, size_mid8, size_high8]:
-  if (recv_buffer.size() < 4) return false;
-  if (recv_buffer[0] != uint8_t(Message::C2S_Controls)) return false;
-  uint32_t size = (uint32_t(recv_buffer[3]) << 16) |
-                  (uint32_t(recv_buffer[2]) << 8) | uint32_t(recv_buffer[1]);
-  if (size != 5)
-    throw std::runtime_error("Controls message with size " +
-                             std::to_string(size) + " != 5!");
+  connection.send(seq);
+  connection.send(elapsed);
+}
 
-  // expecting complete message:
-  if (recv_buffer.size() < 4 + size) return false;
+void Player::Controls::recv_controls_message(Payload const &payload) {
+  assert(payload.size == MessageSize<Message::C2S_Controls>::Min);
 
   auto recv_button = [](uint8_t byte, Button *button) {
     button->pressed = (byte & 0x80);
@@ -88,144 +78,427 @@ bool Player::Controls::recv_controls_message(Connection *connection_) {
     button->downs = uint8_t(d);
   };
 
-  recv_button(recv_buffer[4 + 0], &left);
-  recv_button(recv_buffer[4 + 1], &right);
-  recv_button(recv_buffer[4 + 2], &up);
-  recv_button(recv_buffer[4 + 3], &down);
-  recv_button(recv_buffer[4 + 4], &jump);
+  recv_button(payload[0], &left);
+  recv_button(payload[1], &right);
+  recv_button(payload[2], &up);
+  recv_button(payload[3], &down);
+  recv_button(payload[4], &jump);
 
-  // delete message from buffer:
-  recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + 4 + size);
+  std::memcpy(&seq, payload.data + 5, sizeof(seq));
+  std::memcpy(&elapsed, payload.data + 5 + 4, sizeof(elapsed));
+  if (!(elapsed >= 0.0f)) throw std::runtime_error("Controls message with bad elapsed time.");
+  elapsed = std::min(elapsed, Game::MaxInputElapsed);
+}
 
-  return true;
+void Shot::send_shot_message(Connection *connection_) const {
+  assert(connection_);
+  auto &connection = *connection_;
+
+  uint32_t size = 4 + 4;
+  connection.send(Message::C2S_Shot);
+  connection.send(uint8_t(size));
+  connection.send(uint8_t(size >> 8));
+  connection.send(uint8_t(size >> 16));
+  connection.send(view_snapshot);
+  connection.send(view_blend);
+}
+
+void Shot::recv_shot_message(Payload const &payload) {
+  assert(payload.size == MessageSize<Message::C2S_Shot>::Min);
+
+  std::memcpy(&view_snapshot, payload.data, sizeof(view_snapshot));
+  std::memcpy(&view_blend, payload.data + 4, sizeof(view_blend));
+  if (!(view_blend >= 0.0f && view_blend <= 1.0f))
+    throw std::runtime_error("Shot message with bad view blend.");
+}
+
+//(ping timestamps are microseconds on the sender's steady clock)
+static uint64_t ping_clock() {
+  return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::steady_clock::now().time_since_epoch())
+                      .count());
+}
+
+// (ping, pong, session, and resume messages all carry a single u64)
+static void send_u64_message(Connection *connection_, Message type,
+                             uint64_t value) {
+  assert(connection_);
+  auto &connection = *connection_;
+
+  uint32_t size = 8;
+  connection.send(type);
+  connection.send(uint8_t(size));
+  connection.send(uint8_t(size >> 8));
+  connection.send(uint8_t(size >> 16));
+  connection.send(value);
+}
+
+static uint64_t recv_u64_message(Payload const &payload) {
+  assert(payload.size == 8);
+  uint64_t value;
+  std::memcpy(&value, payload.data, sizeof(value));
+  return value;
+}
+
+void send_ping_message(Connection *connection) {
+  send_u64_message(connection, Message::Ping, ping_clock());
+}
+
+void recv_ping_message(Connection *connection, Payload const &payload) {
+  send_u64_message(connection, Message::Pong, recv_u64_message(payload));
+}
+
+void recv_pong_message(Connection *connection, Payload const &payload) {
+  uint64_t timestamp = recv_u64_message(payload);
+  // (a timestamp from the future can only be bogus, so isn't counted)
+  uint64_t now = ping_clock();
+  if (timestamp <= now) connection->stats.add_rtt(double(now - timestamp) * 1e-6);
+}
+
+void send_session_message(Connection *connection, uint64_t token) {
+  send_u64_message(connection, Message::S2C_Session, token);
+}
+
+uint64_t recv_session_message(Payload const &payload) {
+  return recv_u64_message(payload);
+}
+
+void send_resume_message(Connection *connection, uint64_t token) {
+  send_u64_message(connection, Message::C2S_Resume, token);
+}
+
+uint64_t recv_resume_message(Payload const &payload) {
+  return recv_u64_message(payload);
 }
 
 //-----------------------------------------
 
-Game::Game() : mt(0x15466666) {
+Game::Game(uint32_t seed_) : seed(seed_), mt(seed_) {
 	gun.position = glm::vec3(-0.221, -2.811, 1.733);
 	chicken.position = glm::vec3(0.037534, 24.196751, 2.877845);
 }
 
 
-void Game::update(float elapsed) {
-	
-	//move gun:
-	{
+void Game::update() {
+	{ // fire gun
+		// (shots themselves are handled as they arrive, in fire(); this just lets clients show them)
+		gun.gun_fired = fired;
+		fired = false;
+	}
+}
+
+void Game::move(glm::vec3 &position, Player::Controls const &controls, float speed, float elapsed) {
+	//combine inputs into a move:
+	glm::vec2 move = glm::vec2(0.0f);
+	if (controls.left.pressed && !controls.right.pressed) move.x =-1.0f;
+	if (!controls.left.pressed && controls.right.pressed) move.x = 1.0f;
+	if (controls.down.pressed && !controls.up.pressed) move.y =-1.0f;
+	if (!controls.down.pressed && controls.up.pressed) move.y = 1.0f;
+
+	//make it so that moving diagonally doesn't go faster:
+	if (move != glm::vec2(0.0f)) move = glm::normalize(move) * speed * elapsed;
 
-		//combine inputs into a move:
-		constexpr float GunSpeed = 5.0f;
-		glm::vec2 move = glm::vec2(0.0f);
-		if (gun.controls.left.pressed && !gun.controls.right.pressed) move.x =-1.0f;
-		if (!gun.controls.left.pressed && gun.controls.right.pressed) move.x = 1.0f;
-		if (gun.controls.down.pressed && !gun.controls.up.pressed) move.y =-1.0f;
-		if (!gun.controls.down.pressed && gun.controls.up.pressed) move.y = 1.0f;
+	position.x += move.x;
+	position.z += move.y;
+
+	position.x = std::clamp(position.x, PlayAreaMinX, PlayAreaMaxX);
+	position.z = std::clamp(position.z, PlayAreaMinZ, PlayAreaMaxZ);
+}
 
-		//make it so that moving diagonally doesn't go faster:
-		if (move != glm::vec2(0.0f)) move = glm::normalize(move) * GunSpeed * elapsed;
+void Game::apply_controls(Player *player) {
+	assert(player);
+	Player::Controls &controls = player->controls;
 
-		gun.position.x += move.x;
-		gun.position.z += move.y;
+	//(seq only moves forward, so a replayed message can't move the player twice)
+	if (controls.seq <= player->last_input) return;
+	player->last_input = controls.seq;
+
+	//(a client can't make time pass faster by sending more messages: beyond the budget, inputs don't move the player)
+	float elapsed = std::min(controls.elapsed, player->input_budget);
+	player->input_budget -= elapsed;
+	move(player->position, controls, speed(player), elapsed);
+
+	//reset button press counters:
+	controls.left.downs = 0;
+	controls.right.downs = 0;
+	controls.up.downs = 0;
+	controls.down.downs = 0;
+}
 
-		//reset button press counters:
-		gun.controls.left.downs = 0;
-		gun.controls.right.downs = 0;
-		gun.controls.up.downs = 0;
-		gun.controls.down.downs = 0;
+void Game::refill_input_budget(float elapsed) {
+	for (Player *player : players()) {
+		player->input_budget = std::min(player->input_budget + elapsed, MaxInputBudget);
 	}
+}
 
-	{ // fire gun
-		gun.gun_fired = gun.controls.jump.pressed;
-		gun.controls.jump.downs = 0;
+bool Game::fire(Shot const &shot, glm::vec3 *hit_position) {
+	assert(hit_position);
+	if (fired) return false;
+	fired = true;
+	if (!chicken_spawned) return false;
+
+	//where was the chicken at the shooter's view time?
+	// (views older than the kept snapshots are clamped to the oldest -- so lag can't be used to
+	//  shoot arbitrarily far into the past -- and views past the newest use the newest)
+	glm::vec3 target = chicken.position;
+	uint32_t latest = next_snapshot_id - 1;
+	if (latest != 0) {
+		uint32_t oldest = (latest > RewindTicks ? latest - RewindTicks + 1 : 1);
+		uint32_t id = std::clamp(shot.view_snapshot, oldest, latest);
+		target = past[id % RewindTicks].players[1].position;
+		if (id == shot.view_snapshot && id < latest) {
+			glm::vec3 const &next = past[(id + 1) % RewindTicks].players[1].position;
+			target = glm::mix(target, next, shot.view_blend);
+		}
 	}
 
-	{ // move chicken
-		glm::vec2 move = glm::vec2(0.0f);
-		if (chicken.controls.left.pressed && !chicken.controls.right.pressed) move.x =-1.0f;
-		if (!chicken.controls.left.pressed && chicken.controls.right.pressed) move.x = 1.0f;
-		if (chicken.controls.down.pressed && !chicken.controls.up.pressed) move.y =-1.0f;
-		if (!chicken.controls.down.pressed && chicken.controls.up.pressed) move.y = 1.0f;
+	//the shot lands at a fixed offset from the gun's current position:
+	glm::vec2 impact = glm::vec2(gun.position.x + ShotOffset, gun.position.z + ShotOffset);
+	if (glm::length2(impact - glm::vec2(target.x, target.z)) >= HitRadius * HitRadius) return false;
 
-		//make it so that moving diagonally doesn't go faster:
-		constexpr float ChickenSpeed = 8.f;
-		if (move != glm::vec2(0.0f)) move = glm::normalize(move) * ChickenSpeed * elapsed;
+	*hit_position = target;
+	return true;
+}
 
-		chicken.position.x += move.x;
-		chicken.position.z += move.y;
+//index used to identify players in state messages:
+// (0xff means 'no player')
+static constexpr uint8_t NoPlayer = 0xff;
+
+//State message payload format (bit-packed, see BitStream.hpp):
+// snapshot id                      32 bits
+// snapshot id - baseline id         6 bits (0 if no baseline)
+// per player:
+//   relevant                        1 bit (if not, nothing else is sent; see Interest.hpp)
+//   change mask (if relevant)       4 bits (ChangedPositionX | ... )
+//   position.x (if changed)         PositionX.bits
+//   position.y (if changed)         PositionY.bits
+//   position.z (if changed)         PositionZ.bits
+//   gun_fired (if changed)          1 bit
+// (zero-padded to a whole byte)
+
+//bits used in the per-player change mask of a state message:
+enum : uint8_t {
+  ChangedPositionX = 0x1,
+  ChangedPositionY = 0x2,
+  ChangedPositionZ = 0x4,
+  ChangedGunFired = 0x8,
+  ChangedAll = 0xf
+};
+static constexpr uint32_t ChangeMaskBits = 4;
+static constexpr uint32_t BaselineDistanceBits = 6;
+static_assert(SnapshotHistory::Size < (1 << BaselineDistanceBits),
+              "baseline distance must fit in its field");
+
+static Quantize const PositionX(Game::PlayAreaMinX, Game::PlayAreaMaxX, Game::PositionPrecision);
+static Quantize const PositionY(Game::HeightMin, Game::HeightMax, Game::PositionPrecision);
+static Quantize const PositionZ(Game::PlayAreaMinZ, Game::PlayAreaMaxZ, Game::PositionPrecision);
+
+void SnapshotHistory::record(Snapshot const &snapshot) {
+  assert(snapshot.id > latest_sent);
+  sent[snapshot.id % Size] = snapshot;
+  latest_sent = snapshot.id;
+}
 
-		chicken.position.x = std::clamp(chicken.position.x, -17.f, 17.f);
-		chicken.position.z = std::clamp(chicken.position.z, -6.f, 12.f);
+Snapshot const *SnapshotHistory::baseline() const {
+  if (acked == 0) return nullptr;
+  Snapshot const &snapshot = sent[acked % Size];
+  if (snapshot.id != acked) return nullptr;  // (overwritten by a newer snapshot)
+  return &snapshot;
+}
 
-		//reset button press counters:
-		chicken.controls.left.downs = 0;
-		chicken.controls.right.downs = 0;
-		chicken.controls.up.downs = 0;
-		chicken.controls.down.downs = 0;
-	}
+void SnapshotHistory::recv_ack_message(Payload const &payload) {
+  assert(payload.size == MessageSize<Message::C2S_Ack>::Min);
+
+  uint32_t id;
+  std::memcpy(&id, payload.data, sizeof(id));
+  if (id > latest_sent)
+    throw std::runtime_error("Ack for snapshot " + std::to_string(id) +
+                             " which was never sent!");
+
+  // acks may arrive after newer ones, so only move forward:
+  acked = std::max(acked, id);
 }
 
-void Game::send_state_message(Connection *connection_,
-                              Player *connection_player) const {
+void Game::send_ack_message(Connection *connection_) const {
   assert(connection_);
   auto &connection = *connection_;
 
-  connection.send(Message::S2C_State);
-  // will patch message size in later, for now placeholder bytes:
-  connection.send(uint8_t(0));
-  connection.send(uint8_t(0));
-  connection.send(uint8_t(0));
-  size_t mark = connection.send_buffer
-                    .size();  // keep track of this position in the buffer
-
-  // send player info helper:
-  auto send_player = [&](Player const &player) {
-    connection.send(player.position);
-		connection.send(player.gun_fired);
-  };
+  uint32_t size = 4;
+  connection.send(Message::C2S_Ack);
+  connection.send(uint8_t(size));
+  connection.send(uint8_t(size >> 8));
+  connection.send(uint8_t(size >> 16));
+  connection.send(latest_received);
+}
+
+Snapshot Game::make_snapshot() {
+  Snapshot snapshot;
+  snapshot.id = next_snapshot_id++;
+  auto ps = players();
+  for (uint32_t i = 0; i < ps.size(); ++i) {
+    // (store positions as the client will see them, so deltas are computed on quantized values)
+    snapshot.players[i].position = glm::vec3(
+        PositionX.round_trip(ps[i]->position.x),
+        PositionY.round_trip(ps[i]->position.y),
+        PositionZ.round_trip(ps[i]->position.z));
+    snapshot.players[i].gun_fired = ps[i]->gun_fired;
+  }
+  past[snapshot.id % RewindTicks] = snapshot;
+  return snapshot;
+}
 
-  // player count:
-  for (auto const &player : {gun, chicken}) {
-    send_player(player);
+SharedBytes Game::make_state_payload(Snapshot const &snapshot,
+                                     Snapshot const *baseline) {
+  auto payload = std::make_shared< std::vector< uint8_t > >();
+  {  // (reserve enough space for a full snapshot)
+    uint32_t max_bits = 32 + BaselineDistanceBits +
+        uint32_t(snapshot.players.size()) *
+            (1 + ChangeMaskBits + PositionX.bits + PositionY.bits + PositionZ.bits + 1);
+    payload->reserve((max_bits + 7) / 8);
+  }
+  BitWriter writer(payload.get());
+
+  writer.write(snapshot.id, 32);
+  if (baseline) {
+    assert(baseline->id < snapshot.id);
+    assert(snapshot.id - baseline->id < (1u << BaselineDistanceBits));
+    writer.write(snapshot.id - baseline->id, BaselineDistanceBits);
+  } else {
+    writer.write(0, BaselineDistanceBits);
   }
 
-  // compute the message size and patch into the message header:
-  uint32_t size = uint32_t(connection.send_buffer.size() - mark);
-  connection.send_buffer[mark - 3] = uint8_t(size);
-  connection.send_buffer[mark - 2] = uint8_t(size >> 8);
-  connection.send_buffer[mark - 1] = uint8_t(size >> 16);
+  for (uint32_t i = 0; i < snapshot.players.size(); ++i) {
+    Snapshot::PlayerState const &player = snapshot.players[i];
+    writer.write_bool(player.relevant);
+    if (!player.relevant) continue;
+    uint8_t mask = ChangedAll;
+    if (baseline) {
+      Snapshot::PlayerState const &base = baseline->players[i];
+      mask = 0;
+      if (player.position.x != base.position.x) mask |= ChangedPositionX;
+      if (player.position.y != base.position.y) mask |= ChangedPositionY;
+      if (player.position.z != base.position.z) mask |= ChangedPositionZ;
+      if (player.gun_fired != base.gun_fired) mask |= ChangedGunFired;
+    }
+    writer.write(mask, ChangeMaskBits);
+    if (mask & ChangedPositionX) PositionX.write(writer, player.position.x);
+    if (mask & ChangedPositionY) PositionY.write(writer, player.position.y);
+    if (mask & ChangedPositionZ) PositionZ.write(writer, player.position.z);
+    if (mask & ChangedGunFired) writer.write_bool(player.gun_fired);
+  }
+
+  writer.flush();
+  return payload;
+}
+
+void Game::send_state(Connection *connection_, Player *connection_player,
+                      SharedBytes const &payload) const {
+  assert(connection_);
+  auto &connection = *connection_;
+  assert(payload);
+
+  uint8_t player_index = NoPlayer;
+  if (connection_player == &gun) player_index = 0;
+  else if (connection_player == &chicken) player_index = 1;
+  uint32_t input_ack = connection_player ? connection_player->last_input : 0;
+
+  // message size covers the header's player index, input ack, and the payload:
+  uint32_t size = uint32_t(1 + 4 + payload->size());
+  std::array<uint8_t, 4 + 1 + 4> header = {
+      uint8_t(Message::S2C_State), uint8_t(size), uint8_t(size >> 8),
+      uint8_t(size >> 16), player_index};
+  std::memcpy(&header[4 + 1], &input_ack, sizeof(input_ack));
+
+  // (a newer state replaces one the connection hasn't been able to send yet)
+  connection.send_latest(header.data(), header.size(), payload);
+}
+
+void Game::send_state_message(Connection *connection_,
+                              Player *connection_player) {
+  send_state(connection_, connection_player,
+             make_state_payload(make_snapshot(), nullptr));
 }
 
-bool Game::recv_state_message(Connection *connection_) {
+void Game::send_hit_message(Connection *connection_, glm::vec3 const &position) {
   assert(connection_);
   auto &connection = *connection_;
-  auto &recv_buffer = connection.recv_buffer;
-
-  if (recv_buffer.size() < 4) return false;
-  if (recv_buffer[0] != uint8_t(Message::S2C_State)) return false;
-  uint32_t size = (uint32_t(recv_buffer[3]) << 16) |
-                  (uint32_t(recv_buffer[2]) << 8) | uint32_t(recv_buffer[1]);
-  uint32_t at = 0;
-  // expecting complete message:
-  if (recv_buffer.size() < 4 + size) return false;
-
-  // copy bytes from buffer and advance position:
-  auto read = [&](auto *val) {
-    if (at + sizeof(*val) > size) {
-      throw std::runtime_error("Ran out of bytes reading state message.");
+
+  uint32_t size = 3 * 4;
+  connection.send(Message::S2C_Hit);
+  connection.send(uint8_t(size));
+  connection.send(uint8_t(size >> 8));
+  connection.send(uint8_t(size >> 16));
+  connection.send(position.x);
+  connection.send(position.y);
+  connection.send(position.z);
+}
+
+void Game::recv_hit_message(Payload const &payload, glm::vec3 *position) {
+  assert(payload.size == MessageSize<Message::S2C_Hit>::Min);
+  assert(position);
+
+  std::memcpy(&position->x, payload.data + 0, sizeof(float));
+  std::memcpy(&position->y, payload.data + 4, sizeof(float));
+  std::memcpy(&position->z, payload.data + 8, sizeof(float));
+}
+
+void Game::recv_state_message(Payload const &payload) {
+  // per-recipient header:
+  assert(payload.size >= MessageSize<Message::S2C_State>::Min);
+  uint8_t player_index = payload[0];
+  if (player_index == 0) local_player = &gun;
+  else if (player_index == 1) local_player = &chicken;
+  else if (player_index == NoPlayer) local_player = nullptr;
+  else throw std::runtime_error("Unknown player index in state message.");
+  std::memcpy(&local_input_ack, payload.data + 1, sizeof(local_input_ack));
+
+  // (bit-packed) payload:
+  BitReader reader(payload.data + 1 + 4, payload.size - 1 - 4);
+
+  Snapshot snapshot;
+  snapshot.id = reader.read(32);
+  uint32_t baseline_distance = reader.read(BaselineDistanceBits);
+  if (snapshot.id == 0 || snapshot.id <= latest_received)
+    throw std::runtime_error("Out-of-order snapshot in state message.");
+  if (baseline_distance >= snapshot.id)
+    throw std::runtime_error("Invalid baseline in state message.");
+
+  // start from the baseline (if any) and apply changed fields:
+  if (baseline_distance != 0) {
+    uint32_t baseline_id = snapshot.id - baseline_distance;
+    Snapshot const &baseline = received[baseline_id % SnapshotHistory::Size];
+    if (baseline.id != baseline_id)
+      throw std::runtime_error("State message baseline " +
+                               std::to_string(baseline_id) +
+                               " is no longer available.");
+    snapshot.players = baseline.players;
+  }
+
+  for (auto &player : snapshot.players) {
+    player.relevant = reader.read_bool();
+    if (!player.relevant) {
+      // (left out: keep what the baseline had -- see Interest::view)
+      player.gun_fired = false;
+      continue;
     }
-    std::memcpy(val, &recv_buffer[4 + at], sizeof(*val));
-    at += sizeof(*val);
-  };
+    uint8_t mask = uint8_t(reader.read(ChangeMaskBits));
+    if (baseline_distance == 0 && mask != ChangedAll)
+      throw std::runtime_error("Full state message is missing fields.");
+    if (mask & ChangedPositionX) player.position.x = PositionX.read(reader);
+    if (mask & ChangedPositionY) player.position.y = PositionY.read(reader);
+    if (mask & ChangedPositionZ) player.position.z = PositionZ.read(reader);
+    if (mask & ChangedGunFired) player.gun_fired = reader.read_bool();
+  }
 
-	read(&(gun.position));
-	read(&(gun.gun_fired));
-  read(&(chicken.position));
-	read(&(chicken.gun_fired));
-  
-  if (at != size) throw std::runtime_error("Trailing data in state message.");
+  if (!reader.at_end()) throw std::runtime_error("Trailing data in state message.");
 
-  // delete message from buffer:
-  recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + 4 + size);
+  received[snapshot.id % SnapshotHistory::Size] = snapshot;
+  latest_received = snapshot.id;
 
-  return true;
+  auto ps = players();
+  for (uint32_t i = 0; i < ps.size(); ++i) {
+    ps[i]->gun_fired = snapshot.players[i].gun_fired;
+    // (players left out stay where they were last seen)
+    if (snapshot.players[i].relevant) ps[i]->position = snapshot.players[i].position;
+  }
 }
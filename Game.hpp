@@ -5,22 +5,46 @@
 #include <string>
 #include <list>
 #include <random>
+#include <array>
 
 #include "Scene.hpp"
 #include "Sound.hpp"
-
-struct Connection;
+#include "ByteQueue.hpp"
+#include "MessageDispatcher.hpp"
 
 //Game state, separate from rendering.
 
-//Currently set up for a "client sends controls" / "server sends whole state" situation.
+//Currently set up for a "client sends controls" / "server sends state" situation.
+//State messages are delta-compressed against the latest snapshot the client has acknowledged.
 
 enum class Message : uint8_t {
 	C2S_Controls = 1, //Greg!
+	C2S_Ack = 'a',
+	C2S_Shot = 'f',
 	S2C_State = 's',
+	S2C_Hit = 'h',
+	Ping = 'p', //(either direction)
+	Pong = 'q', //(either direction)
+	S2C_Session = 'j',
+	C2S_Resume = 'r',
 	//...
 };
 
+//payload sizes of each message type (checked by MessageDispatcher before any handler sees a message):
+template< > struct MessageSize< Message::C2S_Controls > { static constexpr uint32_t Min = 5 + 4 + 4, Max = Min; }; //buttons, seq, elapsed
+template< > struct MessageSize< Message::C2S_Ack > { static constexpr uint32_t Min = 4, Max = Min; }; //snapshot id
+template< > struct MessageSize< Message::C2S_Shot > { static constexpr uint32_t Min = 4 + 4, Max = Min; }; //view snapshot, view blend
+template< > struct MessageSize< Message::S2C_State > { static constexpr uint32_t Min = 1 + 4 + 1, Max = MaxMessageSize; }; //player index, input ack, (bit-packed) snapshot
+template< > struct MessageSize< Message::S2C_Hit > { static constexpr uint32_t Min = 3 * 4, Max = Min; }; //position
+template< > struct MessageSize< Message::Ping > { static constexpr uint32_t Min = 8, Max = Min; }; //timestamp
+template< > struct MessageSize< Message::Pong > { static constexpr uint32_t Min = 8, Max = Min; }; //(echoed) timestamp
+template< > struct MessageSize< Message::S2C_Session > { static constexpr uint32_t Min = 8, Max = Min; }; //session token
+template< > struct MessageSize< Message::C2S_Resume > { static constexpr uint32_t Min = 8, Max = Min; }; //session token
+
+//messages are read by handlers registered with a MessageDispatcher; the recv_*_message
+// functions below parse a message's payload (whose size has already been checked),
+// and throw on malformed contents.
+
 //used to represent a control input:
 struct Button {
 	uint8_t downs = 0; //times the button has been pressed
@@ -33,48 +57,211 @@ struct Player {
 	struct Controls {
 		Button left, right, up, down, jump;
 
+		//(for client-side prediction) inputs are numbered, and move the player for 'elapsed' seconds:
+		uint32_t seq = 0;
+		float elapsed = 0.0f;
+
 		void send_controls_message(Connection *connection) const;
 
-		//returns 'false' if no message or not a controls message,
-		//returns 'true' if read a controls message,
-		//throws on malformed controls message
-		bool recv_controls_message(Connection *connection);
+		void recv_controls_message(Payload const &payload);
 	} controls;
 
 	//player state (sent from server):
 	bool gun_fired = false;
 	glm::vec3 position;
+
+	//(server) seq of the latest controls applied to position:
+	uint32_t last_input = 0;
+	//(server) seconds of movement the player's controls may still apply (see Game::refill_input_budget):
+	float input_budget = 0.0f;
+};
+
+//a shot fired by the gun (sent from client):
+// stamped with the time the shooter was seeing remote players at, so the server can
+// test the hit against where the chicken was drawn rather than where it is now
+struct Shot {
+	//view time, as a (fractional) snapshot id: 'view_blend' of the way from 'view_snapshot' to the next one:
+	uint32_t view_snapshot = 0;
+	float view_blend = 0.0f;
+
+	void send_shot_message(Connection *connection) const;
+
+	void recv_shot_message(Payload const &payload);
+};
+
+//round-trip time measurement (either side may ping the other):
+// a ping carries the sender's clock reading, which the receiver echoes back in a pong;
+// when the pong arrives, the round trip is added to the connection's stats (see ConnectionStats).
+void send_ping_message(Connection *connection);
+
+//queues a pong in reply:
+void recv_ping_message(Connection *connection, Payload const &payload);
+
+//records the round-trip time in connection's stats:
+void recv_pong_message(Connection *connection, Payload const &payload);
+
+//sessions (so a client can get its player back after reconnecting, e.g., to a restarted server):
+// the server gives each client a random token when it takes a player; a client that reconnects
+// sends the token as its first message to resume playing that player (see Checkpoint.hpp).
+void send_session_message(Connection *connection, uint64_t token);
+uint64_t recv_session_message(Payload const &payload);
+
+void send_resume_message(Connection *connection, uint64_t token);
+uint64_t recv_resume_message(Payload const &payload);
+
+//the replicated state of all players at one tick:
+// (used as a baseline for delta-compressed state messages)
+struct Snapshot {
+	uint32_t id = 0; //0 means 'no snapshot'
+	struct PlayerState {
+		glm::vec3 position = glm::vec3(0.0f);
+		bool gun_fired = false;
+		//(per recipient, see Interest.hpp) players that aren't relevant are left out of state messages;
+		// their fields keep the values from the baseline (i.e., what the recipient last knew)
+		bool relevant = true;
+	};
+	std::array< PlayerState, 2 > players; //gun, chicken (positions as quantized for sending)
+};
+
+//server-side record of the snapshots recently sent over one connection:
+struct SnapshotHistory {
+	//enough history to cover about a second of acknowledgement delay:
+	static constexpr uint32_t Size = 32;
+
+	std::array< Snapshot, Size > sent; //indexed by id % Size
+	uint32_t latest_sent = 0;
+	uint32_t acked = 0; //newest snapshot acknowledged by the client (0 if none)
+
+	//note that a snapshot was sent:
+	void record(Snapshot const &snapshot);
+
+	//the acknowledged snapshot, if it is still in the history (otherwise nullptr):
+	Snapshot const *baseline() const;
+
+	void recv_ack_message(Payload const &payload);
 };
 
 struct Game {
-	Player *spawn_player(); //add player the end of the players list (may also, e.g., play some spawn anim)
+	Player *spawn_player(); //add player the end of the players list (may also, e.g., play some spawn anim); nullptr if the game is full
 	void remove_player(Player *); //remove player from game (may also, e.g., play some despawn anim)
 	Player gun, chicken;
 
+	uint32_t seed; //initial state of mt (recorded in match logs)
 	std::mt19937 mt; //used for spawning players
 	uint32_t next_player_number = 1; //used for naming players
 
 	bool gun_spawned = false;
 	bool chicken_spawned = false;
 
-	Game();
+	Game(uint32_t seed = DefaultSeed);
+	inline static constexpr uint32_t DefaultSeed = 0x15466666;
+
+	//state update function, called once per tick:
+	// (players move as their controls arrive, in apply_controls(), by however long each says it was held --
+	//  within the budget refill_input_budget() gives them each tick -- so this doesn't need the tick's length)
+	void update();
+
+	//movement, shared by the server and the client's prediction:
+	//move 'position' by 'controls' held for 'elapsed' seconds at 'speed' (staying in the play area):
+	static void move(glm::vec3 &position, Player::Controls const &controls, float speed, float elapsed);
+	//movement speed of a player:
+	float speed(Player const *player) const { return player == &chicken ? ChickenSpeed : GunSpeed; }
+
+	//(server) move a player by its latest controls and note that they were applied:
+	// (the move is clamped to the player's input budget, so sending more controls messages doesn't move a player faster)
+	void apply_controls(Player *player);
 
-	//state update function:
-	void update(float elapsed);
+	//(server) let every player's controls move it for another 'elapsed' seconds; called once per tick:
+	// (unused budget carries over -- inputs arrive in bunches after network jitter -- up to MaxInputBudget)
+	void refill_input_budget(float elapsed);
+
+	//(server) fire the gun from its current position at the chicken as it was at the shot's view time:
+	// returns true (and sets 'hit_position' to where the chicken was) on a hit
+	// (the gun fires at most once per tick: while 'fired' is set, shots are ignored -- and return false -- without a hit test)
+	bool fire(Shot const &shot, glm::vec3 *hit_position);
+	bool fired = false; //a shot was fired since the last update() (which sets gun.gun_fired)
 
 	//constants:
 	//the update rate on the server:
 	inline static constexpr float Tick = 1.0f / 30.0f;
 
+	//player movement speeds (units per second):
+	inline static constexpr float GunSpeed = 5.0f;
+	inline static constexpr float ChickenSpeed = 8.0f;
+	//longest time one controls message may move a player for (limits the effect of bogus messages):
+	inline static constexpr float MaxInputElapsed = 0.1f;
+	//most movement time a player's input budget can bank (how far its inputs may run ahead of the server's clock):
+	inline static constexpr float MaxInputBudget = 0.25f;
+
+	//shots can be rewound this many ticks (about a second) into the past; older view times are clamped:
+	inline static constexpr uint32_t RewindTicks = 32;
+	//shots land this far (in x and z) from the gun, and hit if within HitRadius of the chicken:
+	inline static constexpr float ShotOffset = -1.5f;
+	inline static constexpr float HitRadius = 0.7071f;
+
+	//players are kept within this area of the x/z plane:
+	inline static constexpr float PlayAreaMinX = -17.0f;
+	inline static constexpr float PlayAreaMaxX =  17.0f;
+	inline static constexpr float PlayAreaMinZ =  -6.0f;
+	inline static constexpr float PlayAreaMaxZ =  12.0f;
+	//(player heights aren't simulated; this range covers the heights in the scene)
+	inline static constexpr float HeightMin = -32.0f;
+	inline static constexpr float HeightMax =  32.0f;
+
+	//positions are quantized to (at least) this precision in state messages:
+	inline static constexpr float PositionPrecision = 1.0f / 256.0f;
+
 	//---- communication helpers ----
 
+	//players in the order they appear in snapshots:
+	std::array< Player *, 2 > players() { return {&gun, &chicken}; }
+	std::array< Player const *, 2 > players() const { return {&gun, &chicken}; }
+
 	//used by client:
-	//set game state from data in connection buffer
-	// (return true if data was read)
-	bool recv_state_message(Connection *connection);
+	//set game state from a state message:
+	void recv_state_message(Payload const &payload);
+
+	//(set by recv_state_message) the player controlled by this client, if any:
+	Player *local_player = nullptr;
+	//(set by recv_state_message) seq of the latest controls reflected in the local player's position:
+	uint32_t local_input_ack = 0;
+
+	//(set by recv_state_message) recently received snapshots, indexed by id % SnapshotHistory::Size:
+	// (delta-compressed state messages are decoded against these)
+	std::array< Snapshot, SnapshotHistory::Size > received;
+	uint32_t latest_received = 0; //id of newest received snapshot
+
+	//acknowledge latest_received, so the server can use it as a baseline:
+	void send_ack_message(Connection *connection) const;
 
 	//used by server:
-	//send game state.
-	//  Will move "connection_player" to the front of the front of the sent list.
-	void send_state_message(Connection *connection, Player *connection_player = nullptr) const;
+	//capture the current state as a new snapshot:
+	Snapshot make_snapshot();
+	uint32_t next_snapshot_id = 1;
+	//(also kept here, indexed by id % RewindTicks, for rewinding to a shot's view time)
+	std::array< Snapshot, RewindTicks > past;
+
+	//serialize the part of the state message that is the same for every recipient:
+	// (fields are quantized and bit-packed; see Game.cpp for the format)
+	// 'baseline' (if not nullptr) is a snapshot the recipient has acknowledged; only fields
+	//   that differ from it are sent. Otherwise, all fields are sent.
+	// players that aren't relevant to the recipient (see Interest::view) are left out.
+	// (so the result can be shared between all recipients with the same baseline and relevant players)
+	static SharedBytes make_state_payload(Snapshot const &snapshot, Snapshot const *baseline);
+
+	//a state message is a small per-recipient header followed by the shared payload:
+	//  (the header tells the recipient which player, if any, is "connection_player", and which of its inputs have been applied)
+	//state messages go in the connection's latest-wins slot, so a newer one replaces any that hasn't been sent yet
+	//  (see Connection::send_latest)
+	void send_state(Connection *connection, Player *connection_player, SharedBytes const &payload) const;
+
+	//send game state (header and a full -- not delta-compressed -- payload):
+	void send_state_message(Connection *connection, Player *connection_player = nullptr);
+
+	//tell a client that the chicken was hit (at 'position'):
+	static void send_hit_message(Connection *connection, glm::vec3 const &position);
+
+	//used by client:
+	//sets 'position' to where the chicken was hit:
+	static void recv_hit_message(Payload const &payload, glm::vec3 *position);
 };
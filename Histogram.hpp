@@ -0,0 +1,86 @@
+#pragma once
+
+/*
+ * Histogram of durations, for telemetry (tick timing, latency, ...).
+ *
+ * Buckets are spaced logarithmically (four per doubling, starting at one
+ *  microsecond), so percentiles are accurate to within about 20% over a wide
+ *  range of values while add() stays constant-time and allocation-free.
+ *
+ */
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <ostream>
+
+struct Histogram {
+	//buckets per doubling:
+	static constexpr uint32_t Steps = 4;
+	//bucket 0 holds everything under 1us, the last bucket everything over ~2^26 us (about a minute):
+	static constexpr uint32_t Buckets = 26 * Steps + 1;
+
+	//record a value (in seconds; negative values count as zero):
+	void add(double seconds) {
+		double us = std::max(0.0, seconds * 1e6);
+		uint32_t bucket = 0;
+		if (us >= 1.0) bucket = std::min(Buckets - 1, 1 + uint32_t(std::log2(us) * Steps));
+		counts[bucket] += 1;
+		count += 1;
+		sum += seconds;
+		max = std::max(max, seconds);
+	}
+
+	//upper bound (in seconds) of values in a bucket:
+	static double bucket_limit(uint32_t bucket) {
+		if (bucket == 0) return 1e-6;
+		return std::exp2(double(bucket) / Steps) * 1e-6;
+	}
+
+	//approximate value (in seconds) below which fraction 'p' of values fall:
+	double percentile(double p) const {
+		if (count == 0) return 0.0;
+		uint64_t target = uint64_t(std::ceil(std::clamp(p, 0.0, 1.0) * double(count)));
+		uint64_t seen = 0;
+		for (uint32_t b = 0; b < Buckets; ++b) {
+			seen += counts[b];
+			if (seen >= target && seen > 0) return std::min(bucket_limit(b), max);
+		}
+		return max;
+	}
+
+	//add all of another histogram's values:
+	void merge(Histogram const &other) {
+		for (uint32_t b = 0; b < Buckets; ++b) counts[b] += other.counts[b];
+		count += other.count;
+		sum += other.sum;
+		max = std::max(max, other.max);
+	}
+
+	double mean() const { return count ? sum / double(count) : 0.0; }
+
+	void clear() { *this = Histogram(); }
+
+	//one-line summary, in milliseconds:
+	void write_summary(std::ostream &out) const {
+		out << "n " << count << " mean " << mean() * 1e3 << "ms p50 " << percentile(0.5) * 1e3
+		    << "ms p99 " << percentile(0.99) * 1e3 << "ms max " << max * 1e3 << "ms";
+	}
+
+	//non-empty buckets as "<upper limit in us>:<count>" pairs (for exporting to other tools):
+	void write_buckets(std::ostream &out) const {
+		bool first = true;
+		for (uint32_t b = 0; b < Buckets; ++b) {
+			if (counts[b] == 0) continue;
+			if (!first) out << ' ';
+			out << bucket_limit(b) * 1e6 << ':' << counts[b];
+			first = false;
+		}
+	}
+
+	std::array< uint64_t, Buckets > counts{};
+	uint64_t count = 0;
+	double sum = 0.0;
+	double max = 0.0;
+};
@@ -0,0 +1,94 @@
+#include "Interest.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <glm/gtx/norm.hpp>
+
+InterestGrid::InterestGrid(float cell_size_) : cell_size(cell_size_) {
+	assert(cell_size > 0.0f);
+	columns = std::max(1u, uint32_t(std::ceil((Game::PlayAreaMaxX - Game::PlayAreaMinX) / cell_size)));
+	rows = std::max(1u, uint32_t(std::ceil((Game::PlayAreaMaxZ - Game::PlayAreaMinZ) / cell_size)));
+	cells.resize(size_t(columns) * rows);
+}
+
+uint32_t InterestGrid::column(float x) const {
+	float c = std::floor((x - Game::PlayAreaMinX) / cell_size);
+	return uint32_t(std::clamp(c, 0.0f, float(columns - 1)));
+}
+
+uint32_t InterestGrid::row(float z) const {
+	float r = std::floor((z - Game::PlayAreaMinZ) / cell_size);
+	return uint32_t(std::clamp(r, 0.0f, float(rows - 1)));
+}
+
+void InterestGrid::clear() {
+	//(keeps each cell's storage, so steady-state ticks don't allocate)
+	for (auto &cell : cells) cell.clear();
+}
+
+void InterestGrid::insert(uint32_t entity, glm::vec3 const &position) {
+	cells[size_t(row(position.z)) * columns + column(position.x)].emplace_back(entity);
+}
+
+void InterestGrid::query(glm::vec3 const &center, float radius, std::vector< uint32_t > *entities) const {
+	assert(entities);
+	uint32_t c0 = column(center.x - radius), c1 = column(center.x + radius);
+	uint32_t r0 = row(center.z - radius), r1 = row(center.z + radius);
+	for (uint32_t r = r0; r <= r1; ++r) {
+		for (uint32_t c = c0; c <= c1; ++c) {
+			auto const &cell = cells[size_t(r) * columns + c];
+			entities->insert(entities->end(), cell.begin(), cell.end());
+		}
+	}
+}
+
+//---------------------------------
+
+Interest::Interest(Settings const &settings_) : settings(settings_) {
+}
+
+void Interest::update(Game const &game) {
+	grid.clear();
+	auto ps = game.players();
+	for (uint32_t i = 0; i < ps.size(); ++i) {
+		grid.insert(i, ps[i]->position);
+	}
+}
+
+uint32_t Interest::relevant(Game const &game, Player const *viewer, uint32_t previous) const {
+	if (!viewer) return AllPlayers;
+
+	uint32_t mask = 0;
+	auto ps = game.players();
+	for (uint32_t i = 0; i < ps.size(); ++i) {
+		if (ps[i] == viewer || ps[i]->gun_fired) mask |= (1u << i);
+	}
+
+	//nearby players (those already relevant get the extra 'hysteresis' before they're dropped):
+	float keep = settings.radius + settings.hysteresis;
+	candidates.clear();
+	grid.query(viewer->position, keep, &candidates);
+	for (uint32_t i : candidates) {
+		if (mask & (1u << i)) continue;
+		glm::vec2 offset = glm::vec2(ps[i]->position.x - viewer->position.x, ps[i]->position.z - viewer->position.z);
+		float limit = (previous & (1u << i) ? keep : settings.radius);
+		if (glm::length2(offset) <= limit * limit) mask |= (1u << i);
+	}
+	return mask;
+}
+
+Snapshot Interest::view(Snapshot const &snapshot, Snapshot const *baseline, uint32_t relevant) {
+	if (relevant == AllPlayers) return snapshot;
+
+	Snapshot ret = snapshot;
+	for (uint32_t i = 0; i < ret.players.size(); ++i) {
+		if (relevant & (1u << i)) continue;
+		Snapshot::PlayerState &player = ret.players[i];
+		player = (baseline ? baseline->players[i] : Snapshot::PlayerState());
+		//(shots are events, not state: a player left out didn't fire as far as the recipient knows)
+		player.gun_fired = false;
+		player.relevant = false;
+	}
+	return ret;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+/*
+ * Interest management decides which players each connection hears about.
+ *
+ * Sending every player to every connection costs O(N^2) bandwidth per room;
+ *  instead, each tick a room sorts its players into an InterestGrid (a uniform
+ *  grid over the play area), and each member's state messages carry only the
+ *  players relevant to it:
+ *  - the member's own player,
+ *  - players doing something everyone should see (firing the gun), and
+ *  - players within 'radius' (in x/z) of the member's player.
+ *
+ * A player that was relevant stays relevant until it is 'hysteresis' farther
+ *  than 'radius', so players near the edge don't flicker in and out.
+ *
+ * Players left out of a state message keep the values the recipient last knew
+ *  (see Snapshot::PlayerState::relevant); the client leaves them where they were.
+ *
+ * The default radius covers the whole play area, so with the default settings
+ *  every player is always relevant.
+ *
+ */
+
+#include "Game.hpp"
+
+#include <cstdint>
+#include <vector>
+
+//players (by index in Game::players()) sorted into cells over the play area:
+struct InterestGrid {
+	InterestGrid(float cell_size = DefaultCellSize);
+
+	inline static constexpr float DefaultCellSize = 4.0f;
+
+	void clear();
+	//(positions outside the play area go in the nearest cell)
+	void insert(uint32_t entity, glm::vec3 const &position);
+	//append entities in cells overlapping the square of half-width 'radius' around 'center':
+	// (a superset of the entities within 'radius'; callers check the actual distance)
+	void query(glm::vec3 const &center, float radius, std::vector< uint32_t > *entities) const;
+
+	float cell_size;
+	uint32_t columns, rows; //cells along x and z
+	std::vector< std::vector< uint32_t > > cells; //entities in each cell; indexed by row * columns + column
+
+private:
+	uint32_t column(float x) const;
+	uint32_t row(float z) const;
+};
+
+struct Interest {
+	struct Settings {
+		float radius = 40.0f; //players this close (in x/z) become relevant; (default covers the whole play area)
+		float hysteresis = 2.0f; //relevant players stay relevant until this much farther than radius
+	};
+
+	Interest(Settings const &settings);
+	Settings settings;
+
+	//bit 'i' set <=> player 'i' of Game::players() is relevant:
+	inline static constexpr uint32_t AllPlayers = (1u << std::tuple_size< decltype(Snapshot::players) >::value) - 1;
+
+	//(once per tick, before calling relevant()) sort players into the grid:
+	void update(Game const &game);
+
+	//players relevant to a member controlling 'viewer' (nullptr for a spectator, to whom everyone is relevant),
+	// given the players that were relevant to it last tick:
+	uint32_t relevant(Game const &game, Player const *viewer, uint32_t previous) const;
+
+	//'snapshot' as seen by a recipient to whom only 'relevant' players are relevant:
+	// (other players keep their values from 'baseline' -- or defaults, without a baseline -- so that
+	//  the recipient, which keeps its baseline's values for players left out of a state message, agrees)
+	static Snapshot view(Snapshot const &snapshot, Snapshot const *baseline, uint32_t relevant);
+
+	InterestGrid grid;
+
+private:
+	mutable std::vector< uint32_t > candidates; //(scratch space for relevant())
+};
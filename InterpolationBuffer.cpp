@@ -0,0 +1,93 @@
+#include "InterpolationBuffer.hpp"
+
+#include <algorithm>
+#include <vector>
+
+InterpolationBuffer::InterpolationBuffer(Settings const &settings_) : settings(settings_), delay(settings_.delay) {
+}
+
+void InterpolationBuffer::push(uint32_t id, Positions const &positions, double now) {
+	if (!entries.empty() && id <= entries.back().id) return; //(stale)
+
+	entries.emplace_back(Entry{id, positions, now});
+	while (entries.size() > Window) entries.pop_front();
+
+	//estimate the server's tick length from arrival times since the first snapshot:
+	// (arrival jitter is spread over more and more ticks, so this gets more accurate over time)
+	if (first_id == 0) {
+		first_id = id;
+		first_arrival = now;
+	} else if (id - first_id >= 16) {
+		tick = std::clamp((now - first_arrival) / double(id - first_id), 1.0 / 240.0, 1.0);
+	}
+
+	//how late did each snapshot arrive, relative to the least-delayed one?
+	static thread_local std::vector< double > transits;
+	transits.clear();
+	for (auto const &entry : entries) {
+		transits.emplace_back(entry.arrival - server_time(entry.id));
+	}
+	std::sort(transits.begin(), transits.end());
+	base_transit = transits.front();
+	jitter = transits.back() - base_transit;
+
+	if (settings.adaptive) {
+		double target = std::clamp(jitter + settings.margin, settings.min_delay, settings.max_delay);
+		//grow quickly (to stop running out of snapshots), shrink slowly (so one calm second doesn't undo it):
+		double rate = (target > delay ? 0.25 : 0.02);
+		delay += (target - delay) * rate;
+	} else {
+		delay = settings.delay;
+	}
+}
+
+bool InterpolationBuffer::sample(double now, Positions *positions_) {
+	if (entries.empty()) return false;
+	Positions &positions = *positions_;
+
+	//server time to draw:
+	double render = render_time(now);
+
+	//find the first snapshot at or after the render time:
+	auto after = std::find_if(entries.begin(), entries.end(), [&](Entry const &entry) {
+		return server_time(entry.id) >= render;
+	});
+
+	if (after == entries.begin()) {
+		//(before the oldest snapshot -- only happens briefly at startup or when the delay grows)
+		positions = after->positions;
+		interpolated_frames += 1;
+	} else if (after != entries.end()) {
+		//interpolate:
+		Entry const &before = *(after - 1);
+		double t0 = server_time(before.id);
+		double t1 = server_time(after->id);
+		float amt = float((render - t0) / (t1 - t0));
+		for (uint32_t i = 0; i < positions.size(); ++i) {
+			positions[i] = glm::mix(before.positions[i], after->positions[i], amt);
+		}
+		interpolated_frames += 1;
+	} else if (entries.size() >= 2) {
+		//past the newest snapshot; extrapolate (for a while):
+		Entry const &last = entries.back();
+		Entry const &prev = *(entries.end() - 2);
+		double t0 = server_time(prev.id);
+		double t1 = server_time(last.id);
+		double ahead = render - t1;
+		if (ahead > settings.max_extrapolation) {
+			ahead = settings.max_extrapolation;
+			held_frames += 1;
+		} else {
+			extrapolated_frames += 1;
+		}
+		float amt = float(ahead / (t1 - t0));
+		for (uint32_t i = 0; i < positions.size(); ++i) {
+			positions[i] = last.positions[i] + (last.positions[i] - prev.positions[i]) * amt;
+		}
+	} else {
+		positions = entries.back().positions;
+		held_frames += 1;
+	}
+
+	return true;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+/*
+ * Client-side buffer of recent server snapshots, used to draw remote players
+ *  smoothly no matter how unevenly state messages arrive.
+ *
+ * Each snapshot is stamped with its server time (snapshot id times the server's
+ *  tick length, which is estimated from arrival times) and its local arrival
+ *  time. Remote players are drawn at a render time that trails the newest
+ *  snapshot by an interpolation delay, so there are (usually) snapshots on both
+ *  sides of it to interpolate between. If snapshots run out, positions are
+ *  extrapolated (for at most max_extrapolation seconds) and then held.
+ *
+ * With 'adaptive' set, the delay tracks the recently observed arrival jitter
+ *  (how much later than the least-delayed recent snapshot the most-delayed
+ *  recent snapshot arrived) plus a safety margin, so it grows when the
+ *  network gets bumpy and shrinks again when it calms down.
+ *
+ */
+
+#include "Game.hpp"
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <deque>
+
+struct InterpolationBuffer {
+	struct Settings {
+		double delay = 0.1; //interpolation delay (seconds); with 'adaptive', the starting delay
+		bool adaptive = true; //adjust the delay to the observed jitter
+		double min_delay = 0.05; //(adaptive) delay limits
+		double max_delay = 0.5;
+		double margin = 0.01; //(adaptive) extra delay beyond the observed jitter
+		double max_extrapolation = 0.1; //longest time to extrapolate past the newest snapshot
+	};
+
+	InterpolationBuffer(Settings const &settings);
+
+	typedef std::array< glm::vec3, 2 > Positions; //(in snapshot player order)
+
+	//add a snapshot that arrived at local time 'now' (seconds):
+	void push(uint32_t id, Positions const &positions, double now);
+
+	//player positions at render time for local time 'now':
+	// (returns false if no snapshots have arrived yet)
+	bool sample(double now, Positions *positions);
+
+	//the server time drawn at local time 'now', as a (fractional) snapshot id:
+	// (used to stamp shots, so the server can test them against what was on screen)
+	double view(double now) const { return render_time(now) / tick; }
+
+	Settings settings;
+
+	//telemetry:
+	double delay; //interpolation delay currently in use (seconds)
+	double jitter = 0.0; //observed arrival jitter (seconds)
+	double tick = Game::Tick; //estimated server tick length (seconds)
+	uint64_t interpolated_frames = 0; //sample() calls that interpolated between snapshots
+	uint64_t extrapolated_frames = 0; //...that extrapolated past the newest snapshot
+	uint64_t held_frames = 0; //...that ran past the extrapolation limit (or had only one snapshot)
+
+private:
+	struct Entry {
+		uint32_t id;
+		Positions positions;
+		double arrival; //local time
+	};
+	//recent snapshots, oldest first (also the window over which jitter and tick length are measured):
+	std::deque< Entry > entries;
+	static constexpr size_t Window = 64;
+
+	double base_transit = 0.0; //smallest recent (arrival - server time)
+
+	uint32_t first_id = 0; //first snapshot received (for estimating tick)
+	double first_arrival = 0.0;
+
+	double server_time(uint32_t id) const { return double(id) * tick; }
+	double render_time(double now) const { return now - base_transit - delay; }
+};
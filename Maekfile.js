@@ -138,12 +138,24 @@ if (maek.OS === 'windows') {
 const client_names = [
 	maek.CPP('client.cpp'),
 	maek.CPP('PlayMode.cpp'),
+	maek.CPP('ClientNetwork.cpp'),
+	maek.CPP('InterpolationBuffer.cpp'),
 	//maek.CPP('ColorTextureProgram.cpp'),  //not used right now, but you might want it
 	
 ];
 
 const server_names = [
-	maek.CPP('server.cpp')
+	maek.CPP('server.cpp'),
+	maek.CPP('Rooms.cpp'),
+	maek.CPP('MatchLog.cpp'),
+	maek.CPP('Checkpoint.cpp'),
+	maek.CPP('Interest.cpp'),
+	maek.CPP('TickScheduler.cpp'),
+	maek.CPP('Benchmarks.cpp')
+];
+
+const bot_names = [
+	maek.CPP('bot.cpp')
 ];
 
 const common_names = [
@@ -165,6 +177,9 @@ const common_names = [
 	maek.CPP('GL.cpp'),
 	maek.CPP('Load.cpp'),
 	maek.CPP('Connection.cpp'),
+	maek.CPP('ByteQueue.cpp'),
+	maek.CPP('UdpTransport.cpp'),
+	maek.CPP('ShmTransport.cpp'),
 	maek.CPP('hex_dump.cpp')
 ];
 
@@ -187,11 +202,12 @@ const show_scene_names = [
 //returns exeFile: exeFileBase + a platform-dependant suffix (e.g., '.exe' on windows)
 const client_exe = maek.LINK([...client_names, ...common_names], 'dist/client');
 const server_exe = maek.LINK([...server_names, ...common_names], 'dist/server');
+const bot_exe = maek.LINK([...bot_names, ...common_names], 'dist/bot');
 const show_meshes_exe = maek.LINK([...show_meshes_names, ...common_names], 'scenes/show-meshes');
 const show_scene_exe = maek.LINK([...show_scene_names, ...common_names], 'scenes/show-scene');
 
 //set the default target to the game (and copy the readme files):
-maek.TARGETS = [client_exe, server_exe, show_meshes_exe, show_scene_exe, ...copies];
+maek.TARGETS = [client_exe, server_exe, bot_exe, show_meshes_exe, show_scene_exe, ...copies];
 
 //the '[targets =] RULE(targets, prerequisites[, recipe])' rule defines a Makefile-style task
 // targets: array of targets the task produces (can include both files and ':abstract targets')
@@ -0,0 +1,243 @@
+#include "MatchLog.hpp"
+
+#include "little_endian.hpp"
+
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+static constexpr char Magic[4] = {'C', 'R', 'M', 'L'};
+static constexpr uint32_t Version = 1;
+
+//index of a player in the log (same order as snapshots):
+static uint8_t player_index(Game const &game, Player const *player) {
+	assert(player == &game.gun || player == &game.chicken);
+	return (player == &game.gun ? 0 : 1);
+}
+
+uint32_t MatchLog::state_hash(Game const &game) {
+	//FNV-1a over the little-endian bytes of each field (so a log's hashes check out on any host):
+	uint32_t hash = 0x811c9dc5;
+	auto add = [&hash](uint32_t value, uint32_t bytes) {
+		for (uint32_t i = 0; i < bytes; ++i) {
+			hash ^= uint8_t(value >> (8 * i));
+			hash *= 0x01000193;
+		}
+	};
+	auto add_f32 = [&add](float value) {
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		add(bits, 4);
+	};
+	for (Player const *player : game.players()) {
+		add_f32(player->position.x);
+		add_f32(player->position.y);
+		add_f32(player->position.z);
+		add(player->last_input, 4);
+		add(uint8_t(player->gun_fired), 1);
+	}
+	add(uint8_t(game.gun_spawned) | (uint8_t(game.chicken_spawned) << 1) | (uint8_t(game.fired) << 2), 1);
+	return hash;
+}
+
+//---------------------------------
+
+static void put_vec3(std::vector< uint8_t > &to, glm::vec3 const &value) {
+	put_f32(to, value.x);
+	put_f32(to, value.y);
+	put_f32(to, value.z);
+}
+
+static glm::vec3 get_vec3(uint8_t const *at) {
+	return glm::vec3(get_f32(at), get_f32(at + 4), get_f32(at + 8));
+}
+
+MatchRecorder::MatchRecorder(std::string const &path_, Game const &game) : path(path_) {
+	out.open(path, std::ios::binary | std::ios::trunc);
+	if (!out) throw std::runtime_error("Failed to create match log '" + path + "'.");
+
+	record.clear();
+	for (char c : Magic) put_u8(record, uint8_t(c));
+	put_u32(record, Version);
+	put_u32(record, game.seed);
+	put_vec3(record, game.gun.position);
+	put_vec3(record, game.chicken.position);
+	write();
+}
+
+MatchRecorder::~MatchRecorder() {
+	out.flush();
+	if (!out) std::cerr << "WARNING: failed to write match log '" << path << "'; it is incomplete." << std::endl;
+}
+
+void MatchRecorder::begin(MatchLog::Record kind) {
+	record.clear();
+	put_u8(record, uint8_t(kind));
+	put_u32(record, ticks);
+}
+
+void MatchRecorder::write() {
+	//(if a write fails, the stream stays failed and later writes do nothing)
+	out.write(reinterpret_cast< char const * >(record.data()), std::streamsize(record.size()));
+}
+
+void MatchRecorder::spawn(Game const &game, Player const *player) {
+	begin(MatchLog::Record::Spawn);
+	put_u8(record, player_index(game, player));
+	write();
+}
+
+void MatchRecorder::remove(Game const &game, Player const *player) {
+	begin(MatchLog::Record::Remove);
+	put_u8(record, player_index(game, player));
+	write();
+}
+
+void MatchRecorder::controls(Game const &game, Player const *player, Payload const &payload) {
+	assert(payload.size == MessageSize< Message::C2S_Controls >::Min);
+	begin(MatchLog::Record::Controls);
+	put_u8(record, player_index(game, player));
+	record.insert(record.end(), payload.data, payload.data + payload.size);
+	write();
+}
+
+void MatchRecorder::shot(Payload const &payload) {
+	assert(payload.size == MessageSize< Message::C2S_Shot >::Min);
+	begin(MatchLog::Record::Shot);
+	record.insert(record.end(), payload.data, payload.data + payload.size);
+	write();
+}
+
+void MatchRecorder::tick(Game const &game, float elapsed) {
+	begin(MatchLog::Record::Tick);
+	put_f32(record, elapsed);
+	put_u32(record, MatchLog::state_hash(game));
+	write();
+	ticks += 1;
+	if (ticks % FlushTicks == 0) out.flush();
+}
+
+//---------------------------------
+
+MatchReplay::MatchReplay(std::string const &path_) : path(path_) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in) throw std::runtime_error("Failed to open match log '" + path + "'.");
+	records.assign(std::istreambuf_iterator< char >(in), std::istreambuf_iterator< char >());
+
+	constexpr size_t HeaderSize = 4 + 4 + 4 + 2 * 3 * 4;
+	if (records.size() < HeaderSize || std::memcmp(records.data(), Magic, 4) != 0) {
+		throw std::runtime_error("'" + path + "' is not a match log.");
+	}
+	uint32_t version = get_u32(records.data() + 4);
+	if (version != Version) {
+		throw std::runtime_error("Match log '" + path + "' has version " + std::to_string(version) + " (expected " + std::to_string(Version) + ").");
+	}
+	seed = get_u32(records.data() + 8);
+	gun_start = get_vec3(records.data() + 12);
+	chicken_start = get_vec3(records.data() + 12 + 3 * 4);
+	records.erase(records.begin(), records.begin() + HeaderSize);
+}
+
+MatchReplay::Result MatchReplay::run() const {
+	Result result;
+
+	Game game(seed);
+	game.gun.position = gun_start;
+	game.chicken.position = chicken_start;
+	Snapshot previous; //(state payloads are encoded against the previous tick, as for a client that keeps up)
+
+	size_t at = 0;
+	//(returns where the 'size' bytes taken start)
+	auto take = [&](size_t size) {
+		if (records.size() - at < size) {
+			throw std::runtime_error("Match log '" + path + "' is truncated at tick " + std::to_string(result.ticks) + ".");
+		}
+		uint8_t const *taken = records.data() + at;
+		at += size;
+		return taken;
+	};
+	//size of each kind of record, after kind and tick:
+	auto body_size = [&](MatchLog::Record kind) -> size_t {
+		switch (kind) {
+			case MatchLog::Record::Tick: return 4 + 4;
+			case MatchLog::Record::Spawn: return 1;
+			case MatchLog::Record::Remove: return 1;
+			case MatchLog::Record::Controls: return 1 + MessageSize< Message::C2S_Controls >::Min;
+			case MatchLog::Record::Shot: return MessageSize< Message::C2S_Shot >::Min;
+		}
+		throw std::runtime_error("Match log '" + path + "' has a record of unknown kind " + std::to_string(int(kind)) + ".");
+	};
+	auto take_player = [&]() -> Player * {
+		uint8_t index = *take(1);
+		if (index > 1) throw std::runtime_error("Match log '" + path + "' has a bad player index.");
+		return game.players()[index];
+	};
+	auto take_payload = [&](size_t size) {
+		return Payload{take(size), size};
+	};
+
+	auto before = std::chrono::steady_clock::now();
+	while (at < records.size()) {
+		//(a log cut off by a crash ends partway through a record; replay up to there)
+		if (records.size() - at < 1 + 4 || records.size() - at < 1 + 4 + body_size(MatchLog::Record(records[at]))) {
+			result.truncated = true;
+			break;
+		}
+
+		MatchLog::Record kind = MatchLog::Record(*take(1));
+		uint32_t tick = get_u32(take(4));
+		if (tick != result.ticks) {
+			throw std::runtime_error("Match log '" + path + "' has a record for tick " + std::to_string(tick) + " during tick " + std::to_string(result.ticks) + ".");
+		}
+
+		if (kind == MatchLog::Record::Tick) {
+			float elapsed = get_f32(take(4));
+			uint32_t hash = get_u32(take(4));
+			//(the same per-tick work as Room::tick, minus the sending)
+			game.update();
+			game.refill_input_budget(elapsed);
+			Snapshot snapshot = game.make_snapshot();
+			SharedBytes payload = Game::make_state_payload(snapshot, previous.id ? &previous : nullptr);
+			previous = snapshot;
+			(void)payload;
+
+			result.final_hash = MatchLog::state_hash(game);
+			if (result.final_hash != hash) {
+				if (result.mismatches == 0) result.first_mismatch = result.ticks;
+				result.mismatches += 1;
+			}
+			result.ticks += 1;
+			result.simulated += elapsed;
+			continue;
+		}
+
+		result.events += 1;
+		if (kind == MatchLog::Record::Spawn) {
+			Player *expected = take_player();
+			if (game.spawn_player() != expected) {
+				throw std::runtime_error("Match log '" + path + "' spawns a player the game doesn't at tick " + std::to_string(tick) + ".");
+			}
+		} else if (kind == MatchLog::Record::Remove) {
+			Player *player = take_player();
+			if (!(player == &game.gun ? game.gun_spawned : game.chicken_spawned)) {
+				throw std::runtime_error("Match log '" + path + "' removes a player who isn't there at tick " + std::to_string(tick) + ".");
+			}
+			game.remove_player(player);
+		} else if (kind == MatchLog::Record::Controls) {
+			Player *player = take_player();
+			player->controls.recv_controls_message(take_payload(MessageSize< Message::C2S_Controls >::Min));
+			game.apply_controls(player);
+		} else if (kind == MatchLog::Record::Shot) {
+			Shot shot;
+			shot.recv_shot_message(take_payload(MessageSize< Message::C2S_Shot >::Min));
+			glm::vec3 hit_position;
+			game.fire(shot, &hit_position);
+		}
+	}
+	result.seconds = std::chrono::duration< double >(std::chrono::steady_clock::now() - before).count();
+
+	return result;
+}
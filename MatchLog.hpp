@@ -0,0 +1,101 @@
+#pragma once
+
+/*
+ * Match logs record everything needed to re-run one room's game exactly:
+ *  the game's seed and starting positions, then every event that changed the
+ *  game, in the order the server applied it -- players joining and leaving,
+ *  each accepted controls and shot message (as received), and each tick.
+ *
+ * Ticks also record a hash of the resulting state, so a replay can check that
+ *  the simulation still does what it did when the match was played (e.g., to
+ *  reproduce a bug report, or to check that a change to the simulation didn't
+ *  change its results).
+ *
+ * Replays run headless and as fast as possible, which also makes them a handy
+ *  benchmark of the per-tick simulation and serialization work.
+ *
+ * File format (all values little-endian):
+ *  header:  "CRML" | version u32 | seed u32 | gun position 3 x f32 | chicken position 3 x f32
+ *  records: kind u8 | tick u32 (ticks recorded before this one) | ...
+ *    Tick:     elapsed f32 | state hash u32 (after the tick)
+ *    Spawn:    player u8 (0 = gun, 1 = chicken)
+ *    Remove:   player u8
+ *    Controls: player u8 | controls message payload
+ *    Shot:     shot message payload (only shots from the gun are recorded)
+ *
+ */
+
+#include "Game.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace MatchLog {
+	enum class Record : uint8_t {
+		Tick = 't',
+		Spawn = '+',
+		Remove = '-',
+		Controls = 'c',
+		Shot = 'f',
+	};
+
+	//hash of the simulated state (positions, flags) of a game:
+	uint32_t state_hash(Game const &game);
+}
+
+//appends a match log as a game is played:
+struct MatchRecorder {
+	//start a log of 'game' (as it is now) at 'path':
+	// (throws if the file can't be created)
+	MatchRecorder(std::string const &path, Game const &game);
+	~MatchRecorder(); //(flushes)
+
+	void spawn(Game const &game, Player const *player);
+	void remove(Game const &game, Player const *player);
+	void controls(Game const &game, Player const *player, Payload const &payload);
+	void shot(Payload const &payload);
+	//call after each tick's update() and make_snapshot():
+	void tick(Game const &game, float elapsed);
+
+	std::string path;
+	uint32_t ticks = 0; //ticks recorded so far
+
+	//the log is flushed to disk this often (so a crash loses at most about a second):
+	static constexpr uint32_t FlushTicks = 32;
+
+private:
+	std::ofstream out;
+	std::vector< uint8_t > record; //(scratch space for the record being written)
+	void begin(MatchLog::Record kind);
+	void write();
+};
+
+//re-runs a match log:
+struct MatchReplay {
+	//load (and check the format of) the log at 'path':
+	// (throws on errors)
+	MatchReplay(std::string const &path);
+
+	struct Result {
+		uint32_t ticks = 0;
+		uint32_t events = 0; //records other than ticks
+		uint32_t mismatches = 0; //ticks whose state hash differs from the recorded one
+		uint32_t first_mismatch = 0; //(if mismatches) tick number of the first
+		uint32_t final_hash = 0;
+		bool truncated = false; //the log ended partway through a record
+		double seconds = 0.0; //time taken
+		double simulated = 0.0; //game time simulated (seconds)
+	};
+
+	//simulate the whole match, as fast as possible:
+	// (throws if the log contains events the game can't have produced, e.g., a player joining a full game)
+	Result run() const;
+
+	std::string path;
+	uint32_t seed = 0;
+	glm::vec3 gun_start = glm::vec3(0.0f);
+	glm::vec3 chicken_start = glm::vec3(0.0f);
+	std::vector< uint8_t > records; //everything after the header
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+/*
+ * Table-driven dispatch of received messages.
+ *
+ * All messages are framed as [type u8][size (24 bits, little endian)][payload].
+ * A MessageDispatcher maps each type byte to a handler, and dispatch() walks a
+ *  connection's recv_buffer once: for each complete frame it checks the type
+ *  and size against the table, then hands the handler a read-only view of the
+ *  payload (pointing into recv_buffer -- nothing is copied). Everything handled
+ *  is consumed from recv_buffer in one go at the end.
+ *
+ * Payload sizes are declared at compile time by specializing MessageSize for
+ *  each message type (see Game.hpp); registering a handler for a type with no
+ *  MessageSize fails to compile. At run time, unknown types and out-of-range
+ *  sizes are rejected (with an exception) as soon as a frame's header arrives,
+ *  before waiting for -- or buffering -- the rest of it.
+ *
+ */
+
+#include "Connection.hpp"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+//read-only view of a message's payload:
+// (points into recv_buffer, so is only valid until the handler returns)
+struct Payload {
+	uint8_t const *data = nullptr;
+	size_t size = 0;
+	uint8_t operator[](size_t i) const { return data[i]; }
+};
+
+//specialize for each message type with the allowed range of payload sizes:
+// template< > struct MessageSize< Message::Example > { static constexpr uint32_t Min = 4, Max = 4; };
+template< auto Type >
+struct MessageSize;
+
+//largest size that fits in a frame header:
+constexpr uint32_t MaxMessageSize = (1u << 24) - 1;
+
+template< typename Context >
+struct MessageDispatcher {
+	typedef std::function< void(Context &, Payload const &) > Handler;
+
+	//handle messages of type 'Type' with 'handler':
+	template< auto Type >
+	void on(Handler handler) {
+		static_assert(MessageSize< Type >::Min <= MessageSize< Type >::Max, "message size range must not be empty");
+		static_assert(MessageSize< Type >::Max <= MaxMessageSize, "message size must fit in a frame header");
+		Entry &entry = table[uint8_t(Type)];
+		entry.handler = std::move(handler);
+		entry.min = MessageSize< Type >::Min;
+		entry.max = MessageSize< Type >::Max;
+	}
+
+	//handle every complete message in connection's recv_buffer:
+	// returns the number of messages handled;
+	// throws on messages of unknown type or bad size (and lets exceptions from handlers through)
+	// stops early if a handler closes the connection
+	uint32_t dispatch(Connection *connection, Context &context) const {
+		RecvBuffer &recv_buffer = connection->recv_buffer;
+		size_t at = 0; //start of next frame
+		uint32_t handled = 0;
+		try {
+			while (recv_buffer.size() - at >= 4) {
+				uint8_t const *frame = recv_buffer.data() + at;
+				uint32_t size = uint32_t(frame[1]) | (uint32_t(frame[2]) << 8) | (uint32_t(frame[3]) << 16);
+				Entry const &entry = table[frame[0]];
+				if (!entry.handler) {
+					throw std::runtime_error("Unexpected message type " + std::to_string(int(frame[0])) + ".");
+				}
+				if (size < entry.min || size > entry.max) {
+					throw std::runtime_error("Message of type " + std::to_string(int(frame[0])) + " with size " + std::to_string(size)
+						+ " (expected " + std::to_string(entry.min) + (entry.max != entry.min ? "-" + std::to_string(entry.max) : std::string()) + ").");
+				}
+				if (recv_buffer.size() - at < 4 + size) break; //(wait for the rest of the message)
+
+				entry.handler(context, Payload{frame + 4, size});
+				at += 4 + size;
+				handled += 1;
+				if (!*connection) break;
+			}
+		} catch (...) {
+			recv_buffer.consume(at);
+			throw;
+		}
+		recv_buffer.consume(at);
+		return handled;
+	}
+
+	//handle one message that has already been taken out of a connection's stream
+	// (e.g., by another thread's dispatch()):
+	// throws on messages of unknown type or bad size (and lets exceptions from handlers through)
+	void handle(uint8_t type, Payload const &payload, Context &context) const {
+		Entry const &entry = table[type];
+		if (!entry.handler) {
+			throw std::runtime_error("Unexpected message type " + std::to_string(int(type)) + ".");
+		}
+		if (payload.size < entry.min || payload.size > entry.max) {
+			throw std::runtime_error("Message of type " + std::to_string(int(type)) + " with size " + std::to_string(payload.size) + ".");
+		}
+		entry.handler(context, payload);
+	}
+
+private:
+	struct Entry {
+		Handler handler;
+		uint32_t min = 0;
+		uint32_t max = 0;
+	};
+	std::array< Entry, 256 > table; //indexed by type byte
+};
@@ -1,6 +1,8 @@
 #include "PlayMode.hpp"
 
+#include <algorithm>
 #include <array>
+#include <cmath>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/string_cast.hpp>
 #include <random>
@@ -59,17 +61,13 @@ Load<Scene> chicken_scene(LoadTagDefault, []() -> Scene const * {
       });
 });
 
-float dist_sqr(float x1, float y1, float x2, float y2) {
-  return (x1 - x2) * (x1 - x2) + (y1 - y2) * (y1 - y2);
-}
-
 void PlayMode::fire_gun() {
   Mesh const &mesh = chicken_meshes->lookup("Impact");
 
   Scene::Transform *transform = new Scene::Transform();
   transform->position =
-      glm::vec3(game.gun.position.x - 1.5, impact->position.y,
-                game.gun.position.z - 1.5);
+      glm::vec3(gun->position.x + Game::ShotOffset, impact->position.y,
+                gun->position.z + Game::ShotOffset);
   transform->scale = impact->scale;
   transform->rotation = impact->rotation;
 
@@ -83,12 +81,7 @@ void PlayMode::fire_gun() {
   drawable.pipeline.start = mesh.start;
   drawable.pipeline.count = mesh.count;
 
-  // check for hit
-  if (dist_sqr(transform->position.x, transform->position.z,
-               chicken->position.x, chicken->position.z) < 0.5f) {
-    hits++;
-    Sound::play(*hit_sample);
-  }
+  // (whether it hit is up to the server; see the S2C_Hit handling in update())
   Sound::play(*explosion_sample);
   gunshots++;
 }
@@ -101,7 +94,12 @@ Load<Sound::Sample> dusty_floor_sample(LoadTagDefault,
 
 PlayMode::~PlayMode() {}
 
-PlayMode::PlayMode(Client &client_) : scene(*chicken_scene), client(client_) {
+PlayMode::PlayMode(Client &client,
+                   InterpolationBuffer::Settings const &interpolation_settings,
+                   double input_rate)
+    : interpolation(interpolation_settings),
+      scene(*chicken_scene),
+      network(client, input_rate) {
   // get pointers to leg for convenience:
   for (auto &transform : scene.transforms) {
     if (transform.name == "Chicken")
@@ -125,7 +123,6 @@ PlayMode::PlayMode(Client &client_) : scene(*chicken_scene), client(client_) {
         "Expecting scene to have exactly one camera, but it has " +
         std::to_string(scene.cameras.size()));
   camera = &scene.cameras.front();
-
 }
 
 bool PlayMode::handle_event(SDL_Event const &evt,
@@ -150,6 +147,7 @@ bool PlayMode::handle_event(SDL_Event const &evt,
       controls.down.pressed = true;
       return true;
     } else if (evt.key.keysym.sym == SDLK_SPACE) {
+      controls.jump.downs += 1;
       controls.jump.pressed = true;
       return true;
     }
@@ -166,98 +164,156 @@ bool PlayMode::handle_event(SDL_Event const &evt,
     } else if (evt.key.keysym.sym == SDLK_s) {
       controls.down.pressed = false;
       return true;
-    } 
+    } else if (evt.key.keysym.sym == SDLK_SPACE) {
+      controls.jump.pressed = false;
+      return true;
+    }
   }
 
   return false;
 }
 
-void PlayMode::update(float elapsed) {
-	//combine inputs into a move:
-		constexpr float PlayerSpeed = 5.0f;
-		glm::vec2 move = glm::vec2(0.0f);
-		if (controls.left.pressed && !controls.right.pressed) move.x =-1.0f;
-		if (!controls.left.pressed && controls.right.pressed) move.x = 1.0f;
-		if (controls.down.pressed && !controls.up.pressed) move.y =-1.0f;
-		if (!controls.down.pressed && controls.up.pressed) move.y = 1.0f;
+void PlayMode::reconcile() {
+  // drop inputs that the server has applied:
+  while (!pending_inputs.empty() &&
+         pending_inputs.front().seq <= game.local_input_ack) {
+    pending_inputs.pop_front();
+  }
+
+  Player const *local = game.local_player;
+  if (!local) return;
 
-		//make it so that moving diagonally doesn't go faster:
-		if (move != glm::vec2(0.0f)) move = glm::normalize(move) * PlayerSpeed * elapsed;
+  if (!predicting) {
+    predicting = true;
+    camera_offset = camera->transform->position - local->position;
+  }
 
-  // queue data for sending to server:
-  controls.send_controls_message(&client.connection);
+  // start from the server's position and re-apply the inputs it hasn't seen:
+  predicted_position = local->position;
+  for (auto const &input : pending_inputs) {
+    Game::move(predicted_position, input, game.speed(local), input.elapsed);
+  }
+}
+
+void PlayMode::update(float elapsed) {
+  // hand this frame's buttons to the network thread, which sends them at a fixed rate:
+  network.set_buttons(controls);
+
+  // (gun) each press fires a shot, stamped with the time remote players were drawn at:
+  if (predicting && game.local_player == &game.gun) {
+    Shot shot;
+    double view = std::max(0.0, drawn_view);
+    shot.view_snapshot = uint32_t(view);
+    shot.view_blend = std::clamp(float(view - std::floor(view)), 0.0f, 1.0f);
+    for (uint32_t i = 0; i < controls.jump.downs; ++i) {
+      network.fire(shot);
+    }
+  }
 
   // reset button press counters:
   controls.left.downs = 0;
   controls.right.downs = 0;
   controls.up.downs = 0;
   controls.down.downs = 0;
-	controls.jump.pressed = false;
-
-  // send/receive data:
-  client.poll(
-      [this](Connection *c, Connection::Event event) {
-        if (event == Connection::OnOpen) {
-          std::cout << "[" << c->socket << "] opened" << std::endl;
-        } else if (event == Connection::OnClose) {
-          std::cout << "[" << c->socket << "] closed (!)" << std::endl;
-          throw std::runtime_error("Lost connection to server!");
-        } else {
-          assert(event == Connection::OnRecv);
-          // std::cout << "[" << c->socket << "] recv'd data. Current buffer:\n"
-          // << hex_dump(c->recv_buffer); std::cout.flush(); //DEBUG
-          bool handled_message;
-          try {
-            do {
-              handled_message = false;
-              if (game.recv_state_message(c)) handled_message = true;
-            } while (handled_message);
-          } catch (std::exception const &e) {
-            std::cerr << "[" << c->socket
-                      << "] malformed message from server: " << e.what()
-                      << std::endl;
-            // quit the game:
-            throw e;
-          }
-
-
-         
-        }
-      },
-      0.0);
-
-		 // move gun:
-          {
-            
-            gun->position = game.gun.position;
-						
-          }
-
-					// move camera
-					{
-							
-							camera->transform->position.x += move.x;
-							camera->transform->position.z += move.y;
-
-					}
-
-          {  // update listener to camera position:
-            glm::mat4x3 frame = camera->transform->make_local_to_parent();
-            glm::vec3 frame_right = frame[0];
-            glm::vec3 frame_at = frame[3];
-            Sound::listener.set_position_right(frame_at, frame_right,
-                                               1.0f / 60.0f);
-          }
-
-          {  // fire gun
-            if (game.gun.gun_fired) {
-              fire_gun();
-            }
-          }
-
-          {  // move chicken
-            chicken->position = game.chicken.position;
-          }
+  controls.jump.downs = 0;
+
+  // (local time, in seconds, for timestamping snapshots)
+  auto local_time = [this](std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration<double>(t - start_time).count();
+  };
+  double now = local_time(std::chrono::steady_clock::now());
+
+  // take whatever the network thread has received (and sent) since the last frame:
+  bool shot_fired = false;  // (did a new state show the gun firing?)
+  ClientNetwork::Event event;
+  while (network.poll(&event)) {
+    if (event.type == ClientNetwork::Event::Input) {
+      // predict the input's effect right away (it is replayed until the server acknowledges it):
+      // (if the server stops acknowledging, the oldest inputs are forgotten rather than kept forever)
+      constexpr size_t MaxPendingInputs = 1024;
+      if (pending_inputs.size() == MaxPendingInputs) pending_inputs.pop_front();
+      pending_inputs.emplace_back(event.controls);
+      if (predicting) {
+        Game::move(predicted_position, event.controls,
+                   game.speed(game.local_player), event.controls.elapsed);
+      }
+    } else if (event.type == ClientNetwork::Event::State) {
+      auto ps = game.players();
+      for (uint32_t i = 0; i < ps.size(); ++i) {
+        ps[i]->position = event.players[i].position;
+        ps[i]->gun_fired = event.players[i].gun_fired;
+      }
+      game.local_player =
+          (event.local_player < ps.size() ? ps[event.local_player] : nullptr);
+      game.local_input_ack = event.local_input_ack;
+      game.latest_received = event.snapshot_id;
+      interpolation.push(game.latest_received,
+                         {game.gun.position, game.chicken.position},
+                         local_time(event.arrival));
+      if (game.gun.gun_fired) shot_fired = true;
+      // correct the prediction to match it:
+      reconcile();
+    } else if (event.type == ClientNetwork::Event::Hit) {
+      hits++;
+      Sound::play(*hit_sample);
+    } else if (event.type == ClientNetwork::Event::Reconnected) {
+      // the server (which may have restarted) numbers its snapshots and acknowledges inputs afresh:
+      game.latest_received = 0;
+      game.local_input_ack = 0;
+      pending_inputs.clear();
+      interpolation = InterpolationBuffer(interpolation.settings);
+    } else {
+      assert(event.type == ClientNetwork::Event::Lost);
+      throw std::runtime_error(event.reason);
+    }
+  }
+
+  {  // move players (the local player is drawn where it is predicted to be):
+    InterpolationBuffer::Positions remote = {game.gun.position,
+                                             game.chicken.position};
+    interpolation.sample(now, &remote);
+    drawn_view = interpolation.view(now);
+    Player const *local = predicting ? game.local_player : nullptr;
+    gun->position = (local == &game.gun ? predicted_position : remote[0]);
+    chicken->position = (local == &game.chicken ? predicted_position : remote[1]);
+  }
+
+  telemetry_elapsed += elapsed;
+  if (telemetry_elapsed > 5.0) {  // report interpolation stats (the network thread reports connection stats):
+    uint64_t frames = interpolation.interpolated_frames +
+                      interpolation.extrapolated_frames +
+                      interpolation.held_frames;
+    auto percent = [&](uint64_t count) {
+      return frames ? 100.0 * double(count) / double(frames) : 0.0;
+    };
+    std::cout << "[interpolation] delay " << interpolation.delay * 1e3
+              << "ms, jitter " << interpolation.jitter * 1e3 << "ms, tick "
+              << interpolation.tick * 1e3 << "ms; frames extrapolated "
+              << percent(interpolation.extrapolated_frames) << "%, held "
+              << percent(interpolation.held_frames) << "%" << std::endl;
+    interpolation.interpolated_frames = 0;
+    interpolation.extrapolated_frames = 0;
+    interpolation.held_frames = 0;
+    telemetry_elapsed = 0.0;
+  }
+
+  if (predicting) {  // move camera along with local player:
+    camera->transform->position.x = predicted_position.x + camera_offset.x;
+    camera->transform->position.z = predicted_position.z + camera_offset.z;
+  }
+
+  {  // update listener to camera position:
+    glm::mat4x3 frame = camera->transform->make_local_to_parent();
+    glm::vec3 frame_right = frame[0];
+    glm::vec3 frame_at = frame[3];
+    Sound::listener.set_position_right(frame_at, frame_right, 1.0f / 60.0f);
+  }
+
+  {  // fire gun
+    if (shot_fired) {
+      fire_gun();
+    }
+  }
 }
 
 void PlayMode::draw(glm::uvec2 const &drawable_size) {
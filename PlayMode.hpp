@@ -1,15 +1,19 @@
 #include "Mode.hpp"
 
-#include "Connection.hpp"
+#include "ClientNetwork.hpp"
 #include "Game.hpp"
+#include "InterpolationBuffer.hpp"
 
 #include <glm/glm.hpp>
 
 #include <vector>
 #include <deque>
+#include <chrono>
 
 struct PlayMode : Mode {
-	PlayMode(Client &client);
+	//(the connection to the server is run by a ClientNetwork, sending controls 'input_rate' times per second)
+	PlayMode(Client &client, InterpolationBuffer::Settings const &interpolation_settings = InterpolationBuffer::Settings(),
+		double input_rate = ClientNetwork::DefaultInputRate);
 	virtual ~PlayMode();
 
 	//functions called by main loop:
@@ -25,6 +29,24 @@ struct PlayMode : Mode {
 	//latest game state (from server):
 	Game game;
 
+	//client-side prediction:
+	// the network thread numbers and sends controls at a fixed rate, and hands each one back
+	// to be applied to predicted_position right away. Controls the server hasn't acknowledged
+	// yet are kept and replayed on top of each state message from the server (see reconcile()).
+	std::deque< Player::Controls > pending_inputs;
+	glm::vec3 predicted_position = glm::vec3(0.0f);
+	bool predicting = false; //(set once the server has said which player is local)
+	void reconcile();
+
+	//the camera follows the local player, keeping the offset it had when prediction started:
+	glm::vec3 camera_offset = glm::vec3(0.0f);
+
+	//remote players are drawn from recent snapshots, a little in the past (so their motion is smooth):
+	InterpolationBuffer interpolation;
+	std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+	double telemetry_elapsed = 0.0; //time since interpolation stats were last printed
+	double drawn_view = 0.0; //server time remote players were last drawn at (as a fractional snapshot id; stamped on shots)
+
 	Scene::Transform *chicken = nullptr;
 	Scene::Transform *gun = nullptr;
 	Scene::Transform *wall = nullptr;
@@ -46,7 +68,7 @@ struct PlayMode : Mode {
 	//last message from server:
 	std::string server_message;
 
-	//connection to server:
-	Client &client;
+	//connection to server (on its own thread; reconnects and resumes the session if the connection is lost):
+	ClientNetwork network;
 
 };
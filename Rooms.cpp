@@ -0,0 +1,882 @@
+#include "Rooms.hpp"
+
+#include "MessageDispatcher.hpp"
+#include "hex_dump.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <random>
+
+//---------------------------------
+
+//what handlers of client messages work on:
+struct ClientMessageContext {
+	Peer *peer;
+	Room &room;
+	Room::Member &member;
+};
+
+//handlers for the messages a client sends to the simulation:
+// (stateless -- everything they touch comes from the context -- so one table serves every shard)
+static MessageDispatcher< ClientMessageContext > const &client_messages() {
+	static MessageDispatcher< ClientMessageContext > const dispatcher = [](){
+		MessageDispatcher< ClientMessageContext > d;
+		d.on< Message::C2S_Controls >([](ClientMessageContext &ctx, Payload const &payload) {
+			ctx.member.player->controls.recv_controls_message(payload);
+			if (ctx.room.recorder) ctx.room.recorder->controls(ctx.room.game, ctx.member.player, payload);
+			//(players move as their inputs arrive, so clients can predict their own movement exactly)
+			ctx.room.game.apply_controls(ctx.member.player);
+		});
+		d.on< Message::C2S_Ack >([](ClientMessageContext &ctx, Payload const &payload) {
+			ctx.member.snapshots.recv_ack_message(payload);
+		});
+		d.on< Message::C2S_Shot >([](ClientMessageContext &ctx, Payload const &payload) {
+			Shot shot;
+			shot.recv_shot_message(payload);
+			//(only the gun can shoot; the hit test rewinds the chicken to what the shooter saw)
+			Game &game = ctx.room.game;
+			if (ctx.member.player != &game.gun) return;
+			//(the gun fires at most once per tick, so a flood of shots can't each cost a rewound hit test; later ones are ignored)
+			if (game.fired) return;
+			if (ctx.room.recorder) ctx.room.recorder->shot(payload);
+			glm::vec3 hit_position;
+			if (game.fire(shot, &hit_position)) {
+				//(announced to every member at the next tick)
+				ctx.room.hit = hit_position;
+			}
+		});
+		return d;
+	}();
+	return dispatcher;
+}
+
+//what handlers of messages on the I/O thread work on:
+struct ConnectionMessageContext {
+	Connection *connection;
+	SPSCChannel< Shard::Incoming, 4096 > &incoming;
+	uint64_t &dropped; //messages that didn't fit in 'incoming'
+};
+
+//(I/O thread) pass a message on to the simulation thread:
+// (if the simulation has fallen so far behind that incoming's overflow is full, the message is dropped instead)
+template< Message Type >
+static void forward_message(ConnectionMessageContext &ctx, Payload const &payload) {
+	static_assert(MessageSize< Type >::Max <= std::tuple_size< decltype(Shard::Incoming::payload) >::value, "forwarded messages must fit in an Incoming");
+	ctx.incoming.flush();
+	if (ctx.incoming.overflow.size() >= Shard::IncomingOverflowLimit) {
+		ctx.dropped += 1;
+		return;
+	}
+	Shard::Incoming in;
+	in.type = Shard::Incoming::Received;
+	in.connection = ctx.connection->handle;
+	in.message = uint8_t(Type);
+	in.size = uint8_t(payload.size);
+	std::copy(payload.data, payload.data + payload.size, in.payload.begin());
+	in.queued = std::chrono::steady_clock::now();
+	ctx.incoming.send(std::move(in));
+}
+
+//handlers for every message a client may send, as split out of its stream by the I/O thread:
+// pings are answered right there; everything else is passed to the simulation thread.
+static MessageDispatcher< ConnectionMessageContext > const &connection_messages() {
+	static MessageDispatcher< ConnectionMessageContext > const dispatcher = [](){
+		MessageDispatcher< ConnectionMessageContext > d;
+		d.on< Message::C2S_Controls >(forward_message< Message::C2S_Controls >);
+		d.on< Message::C2S_Ack >(forward_message< Message::C2S_Ack >);
+		d.on< Message::C2S_Shot >(forward_message< Message::C2S_Shot >);
+		d.on< Message::Ping >([](ConnectionMessageContext &ctx, Payload const &payload) {
+			recv_ping_message(ctx.connection, payload);
+		});
+		d.on< Message::Pong >([](ConnectionMessageContext &ctx, Payload const &payload) {
+			recv_pong_message(ctx.connection, payload);
+		});
+		d.on< Message::C2S_Resume >([](ConnectionMessageContext &, Payload const &) {
+			//(only a connection's first message can resume a session -- see take_resume() -- so later ones are ignored)
+		});
+		return d;
+	}();
+	return dispatcher;
+}
+
+//connections are placed in a room once their first message arrives, so one whose first message
+// is a resume message can go straight back to its old room:
+// returns false if the first message hasn't fully arrived; otherwise sets 'token' to the session
+// to resume (0 if none) and consumes the resume message, if any.
+static bool take_resume(Connection *c, uint64_t *token) {
+	RecvBuffer &recv_buffer = c->recv_buffer;
+	*token = 0;
+	if (recv_buffer.size() < 4) return false;
+	uint32_t size = uint32_t(recv_buffer[1]) | (uint32_t(recv_buffer[2]) << 8) | (uint32_t(recv_buffer[3]) << 16);
+	//(a bad resume message is left for the dispatcher to reject)
+	if (recv_buffer[0] != uint8_t(Message::C2S_Resume) || size != MessageSize< Message::C2S_Resume >::Min) return true;
+	if (recv_buffer.size() < 4 + size) return false;
+	*token = recv_resume_message(Payload{recv_buffer.data() + 4, size});
+	recv_buffer.consume(4 + size);
+	return true;
+}
+
+//session tokens are random, so a client can't easily guess (and take over) another's session:
+static uint64_t make_token() {
+	static thread_local std::random_device random;
+	uint64_t token = 0;
+	while (token == 0) token = (uint64_t(random()) << 32) | uint64_t(random());
+	return token;
+}
+
+//index of a player in checkpoints (same order as snapshots):
+static uint8_t player_index(Game const &game, Player const *player) {
+	assert(player == &game.gun || player == &game.chicken);
+	return (player == &game.gun ? 0 : 1);
+}
+
+//---------------------------------
+
+Room::Room(uint32_t id_, std::string const &record_directory_, Interest::Settings const &interest_) : id(id_), record_directory(record_directory_), interest(interest_) {
+}
+
+void Room::add(Peer *peer, uint64_t token) {
+	assert(free_slots() > 0);
+
+	//a new match is starting:
+	// (a restored match isn't recorded, since its log would be missing the start)
+	if (members.empty() && reserved.empty() && !record_directory.empty()) {
+		std::string path = record_directory + "/room" + std::to_string(id) + "-" + std::to_string(matches) + ".match";
+		try {
+			recorder = std::make_unique< MatchRecorder >(path, game);
+		} catch (std::exception const &e) {
+			std::cerr << "WARNING: not recording match: " << e.what() << std::endl;
+		}
+	}
+	if (members.empty() && reserved.empty()) matches += 1;
+
+	Member &member = members[peer];
+	member.player = game.spawn_player();
+	member.token = token;
+	assert(member.player);
+	if (recorder) recorder->spawn(game, member.player);
+	send_session_message(&peer->outbox, token);
+}
+
+void Room::remove(Peer *peer) {
+	auto f = members.find(peer);
+	assert(f != members.end());
+	if (recorder) recorder->remove(game, f->second.player);
+	game.remove_player(f->second.player);
+	members.erase(f);
+
+	//next match in this room starts fresh:
+	if (members.empty() && reserved.empty()) {
+		recorder.reset();
+		game = Game();
+		hit.reset();
+	}
+}
+
+void Room::restore(Checkpoint::RoomState const &state, std::chrono::steady_clock::time_point expires) {
+	assert(members.empty() && reserved.empty());
+	game = state.game;
+	for (Checkpoint::Seat const &seat : state.seats) {
+		reserved.emplace_back(Reservation{game.players()[seat.player], seat.token, expires});
+	}
+}
+
+bool Room::holds(uint64_t token) const {
+	return std::any_of(reserved.begin(), reserved.end(), [&](Reservation const &r) { return r.token == token; });
+}
+
+bool Room::resume(Peer *peer, uint64_t token) {
+	auto r = std::find_if(reserved.begin(), reserved.end(), [&](Reservation const &held) { return held.token == token; });
+	if (r == reserved.end()) return false;
+	assert(!members.count(peer));
+
+	Member &member = members[peer];
+	member.player = r->player;
+	member.token = token;
+	reserved.erase(r);
+	//(the reconnected client numbers its inputs afresh)
+	member.player->controls = Player::Controls();
+	member.player->last_input = 0;
+	member.player->input_budget = 0.0f;
+	send_session_message(&peer->outbox, token);
+	return true;
+}
+
+uint32_t Room::expire(std::chrono::steady_clock::time_point now) {
+	uint32_t removed = 0;
+	for (auto r = reserved.begin(); r != reserved.end(); /* later */) {
+		if (r->expires <= now) {
+			game.remove_player(r->player);
+			r = reserved.erase(r);
+			removed += 1;
+		} else {
+			++r;
+		}
+	}
+	if (removed && members.empty() && reserved.empty()) game = Game();
+	return removed;
+}
+
+void Room::checkpoint(std::vector< uint8_t > &to) const {
+	std::vector< Checkpoint::Seat > seats;
+	for (auto const &[peer, member] : members) {
+		seats.emplace_back(Checkpoint::Seat{player_index(game, member.player), member.token});
+	}
+	//(players still waiting for their clients to come back are saved too, so a second restart doesn't lose them)
+	for (Reservation const &r : reserved) {
+		seats.emplace_back(Checkpoint::Seat{player_index(game, r.player), r.token});
+	}
+	Checkpoint::write_room(to, game, seats);
+}
+
+void Room::tick(float elapsed) {
+	//tell every member about the hit since the last tick (if any):
+	if (hit) {
+		for (auto &[peer, member] : members) {
+			Game::send_hit_message(&peer->outbox, *hit);
+		}
+		hit.reset();
+	}
+
+	//update current game state
+	game.update();
+	//(players' controls may move them for as long as real time has passed)
+	game.refill_input_budget(elapsed);
+
+	//send updated game state to all members:
+	// each member gets the players relevant to it (see Interest.hpp), as changes relative
+	// to the latest snapshot it acknowledged; payloads are serialized once per distinct
+	// baseline and set of relevant players, and shared between members.
+	Snapshot snapshot = game.make_snapshot();
+	if (recorder) recorder->tick(game, elapsed);
+	interest.update(game);
+
+	struct View {
+		Snapshot snapshot;
+		SharedBytes payload;
+	};
+	std::unordered_map< uint64_t, View > views; //(baseline id << 32 | relevant players) -> view
+	for (auto &[peer, member] : members) {
+		member.relevant = interest.relevant(game, member.player, member.relevant);
+		Snapshot const *baseline = member.snapshots.baseline();
+		View &view = views[(uint64_t(baseline ? baseline->id : 0) << 32) | member.relevant];
+		if (!view.payload) {
+			view.snapshot = Interest::view(snapshot, baseline, member.relevant);
+			view.payload = Game::make_state_payload(view.snapshot, baseline);
+		}
+		game.send_state(&peer->outbox, member.player, view.payload);
+		//(later deltas are against what this member was actually sent)
+		member.snapshots.record(view.snapshot);
+	}
+}
+
+//---------------------------------
+
+Shard::Shard(uint32_t index_, TickScheduler::Settings const &tick_settings) : index(index_), scheduler(tick_settings) {
+}
+
+Shard::Shard(uint32_t index_, TickScheduler::Settings const &tick_settings, std::string const &port, Transport transport)
+	: index(index_), scheduler(tick_settings), server(port, transport), places_locally(true) {
+	//(UDP) a lost state message is superseded by the next tick's anyway:
+	server.unreliable_messages = { uint8_t(Message::S2C_State), uint8_t(Message::Ping), uint8_t(Message::Pong) };
+}
+
+Shard::~Shard() {
+	quit = true;
+	if (sim_thread.joinable()) sim_thread.join();
+	if (io_thread.joinable()) io_thread.join();
+}
+
+void Shard::start() {
+	assert(!io_thread.joinable() && !sim_thread.joinable());
+	io_thread = std::thread(&Shard::run_io, this);
+	sim_thread = std::thread(&Shard::run, this);
+}
+
+void Shard::hand_off(ReleasedConnection &&connection, uint32_t room_id, uint64_t token, std::vector< uint8_t > &&received) {
+	std::lock_guard< std::mutex > lock(mutex);
+	handed_off.emplace_back(HandedOff{std::move(connection), room_id, token, std::move(received)});
+	has_handed_off = true;
+}
+
+void Shard::restore(uint32_t room_id, Checkpoint::RoomState const &state, std::chrono::steady_clock::time_point expires) {
+	assert(!sim_thread.joinable());
+	Room &room = rooms.try_emplace(room_id, room_id, record_directory, interest).first->second;
+	room.restore(state, expires);
+}
+
+std::vector< uint32_t > Shard::take_freed() {
+	std::vector< uint32_t > ret;
+	std::lock_guard< std::mutex > lock(mutex);
+	std::swap(ret, freed);
+	return ret;
+}
+
+//---------------------------------
+//I/O thread:
+
+void Shard::adopt_handed_off() {
+	if (!has_handed_off) return;
+
+	std::vector< HandedOff > adopting;
+	{
+		std::lock_guard< std::mutex > lock(mutex);
+		std::swap(adopting, handed_off);
+		has_handed_off = false;
+	}
+
+	for (HandedOff &h : adopting) {
+		Connection *c = server.adopt(std::move(h.connection));
+		join(c, h.room_id, h.token);
+
+		//handle whatever arrived before the hand-off:
+		if (!h.received.empty()) {
+			c->recv_buffer.append(h.received.data(), h.received.size());
+			on_event(c, Connection::OnRecv);
+		}
+	}
+}
+
+void Shard::join(Connection *c, uint32_t room_id, uint64_t token) {
+	joined.set(c->handle, true);
+
+	Incoming in;
+	in.type = Incoming::Join;
+	in.connection = c->handle;
+	in.room_id = room_id;
+	in.token = token;
+	in.queued = std::chrono::steady_clock::now();
+	incoming.send(std::move(in));
+}
+
+void Shard::leave(Connection *c) {
+	if (!joined.get(c->handle)) return; //(never placed)
+	Incoming in;
+	in.type = Incoming::Leave;
+	in.connection = c->handle;
+	in.queued = std::chrono::steady_clock::now();
+	incoming.send(std::move(in));
+	joined.erase(c->handle);
+}
+
+bool Shard::place_locally(Connection *c) {
+	uint64_t token;
+	if (!take_resume(c, &token)) return false;
+	//(the simulation thread picks the room -- the resumed session's, if it is still held)
+	join(c, NoRoom, token);
+	return true;
+}
+
+void Shard::on_event(Connection *c, Connection::Event evt) {
+	if (evt == Connection::OnOpen) {
+		//client connected (to a shard that does its own listening):
+		// (it is placed in a room once its first message arrives)
+		assert(places_locally);
+
+	} else if (evt == Connection::OnClose) {
+		//client disconnected:
+		leave(c);
+
+	} else { assert(evt == Connection::OnRecv);
+		//got data from client:
+		//std::cout << "current buffer:\n" << hex_dump(c->recv_buffer.data(), c->recv_buffer.size()); std::cout.flush(); //DEBUG
+
+		//(shards that do their own listening) place new connections:
+		if (places_locally && !joined.get(c->handle) && !place_locally(c)) return;
+
+		assert(joined.get(c->handle));
+		ConnectionMessageContext context{c, incoming, incoming_dropped};
+
+		//split messages from client (and pass them on):
+		try {
+			connection_messages().dispatch(c, context);
+		} catch (std::exception const &e) {
+			std::cout << "Disconnecting client:" << e.what() << std::endl;
+			c->close();
+			leave(c);
+		}
+
+		//(if the simulation can't keep up, make room by shedding the client sending the most)
+		if (incoming.overflow.size() >= IncomingOverflowLimit) shed_incoming();
+	}
+}
+
+void Shard::shed_incoming() {
+	//count each connection's messages waiting in the overflow:
+	SlotData< uint32_t > waiting;
+	SlotHandle worst;
+	uint32_t most = 0;
+	for (Incoming const &in : incoming.overflow) {
+		if (in.type != Incoming::Received) continue;
+		uint32_t *count = waiting.get(in.connection);
+		if (!count) count = &waiting.set(in.connection, 0u);
+		*count += 1;
+		if (*count > most) {
+			most = *count;
+			worst = in.connection;
+		}
+	}
+	if (!worst) return;
+
+	//drop them (the simulation would only have ignored them once it heard the connection left):
+	auto &overflow = incoming.overflow;
+	overflow.erase(std::remove_if(overflow.begin(), overflow.end(), [&](Incoming const &in) {
+		return in.type == Incoming::Received && in.connection == worst;
+	}), overflow.end());
+	incoming_dropped += most;
+
+	//...and close the connection, if it is still open:
+	Connection *c = server.connections.get(worst);
+	if (!c || !*c) return;
+	std::cout << "[shard " << index << "] disconnecting connection " << worst.index << ": it sent " << most << " messages more than the simulation could keep up with." << std::endl;
+	c->close();
+	leave(c);
+	incoming_shed += 1;
+}
+
+void Shard::take_outgoing() {
+	Outgoing out;
+	while (outgoing.receive(&out)) {
+		//(the connection may have closed since -- and its slot been reused -- in which case its handle is stale)
+		Connection *c = server.connections.get(out.connection);
+		if (!c || !*c) continue;
+		if (out.type == Outgoing::Send) {
+			if (!out.bytes.empty()) c->send_raw(out.bytes.data(), out.bytes.size());
+			if (out.latest_bytes) c->send_latest(out.latest_header.data(), out.latest_header_size, out.latest_bytes);
+		} else { assert(out.type == Outgoing::Close);
+			c->close();
+			//(the simulation has already dropped it)
+			joined.erase(c->handle);
+		}
+		out.latest_bytes.reset(); //(don't hold on to the payload until the next item is taken)
+	}
+}
+
+void Shard::run_io() {
+	auto on_event_ = [this](Connection *c, Connection::Event evt) { on_event(c, evt); };
+	typedef std::chrono::steady_clock Clock;
+
+	//every connection is pinged about once a second, to keep its round-trip time estimate current:
+	Clock::time_point next_ping = Clock::now();
+
+	//statistics (printed with print_stats), in ticks' worth of time so they compare with the tick stats:
+	Clock::time_point stats_start_time = Clock::now();
+	SyscallCounts stats_start = server.syscalls;
+
+	while (!quit) {
+		//wait (briefly) for data from clients, and pass it on to the simulation thread:
+		// (the simulation thread doesn't wake this one, so the timeout bounds how long its messages wait to be sent)
+		adopt_handed_off();
+		server.poll(on_event_, joined.size() == 0 ? 0.01 : 0.001);
+		incoming.flush();
+
+		//queue whatever the simulation has sent since...
+		take_outgoing();
+
+		auto now = Clock::now();
+		if (now >= next_ping) {
+			for (auto &c : server.connections) {
+				if (c) send_ping_message(&c);
+			}
+			next_ping = now + std::chrono::seconds(1);
+		}
+
+		//...and send it right away:
+		server.flush(on_event_);
+
+		double stats_elapsed = std::chrono::duration< double >(now - stats_start_time).count();
+		if (print_stats && stats_elapsed >= 5.0) {
+			SyscallCounts delta = server.syscalls - stats_start;
+			double ticks = stats_elapsed / scheduler.settings.tick;
+			auto per_tick = [&](uint64_t count) { return double(count) / ticks; };
+			std::cout << "[stats] shard " << index << " syscalls/tick: " << per_tick(delta.total())
+			          << " (wait " << per_tick(delta.wait)
+			          << ", recv " << per_tick(delta.recv)
+			          << ", send " << per_tick(delta.send)
+			          << ", accept " << per_tick(delta.accept)
+			          << ", epoll_ctl " << per_tick(delta.control)
+			          << ") over " << server.connections.size() << " connections" << '\n';
+			std::cout << "[stats] shard " << index << " client messages dropped (simulation behind): " << incoming_dropped
+			          << "; connections shed: " << incoming_shed << '\n';
+			std::cout << "[stats] shard " << index << " ";
+			server.write_stats(std::cout, stats_elapsed);
+			server.reset_stats();
+			incoming_dropped = incoming_shed = 0;
+			stats_start = server.syscalls;
+			stats_start_time = now;
+		}
+	}
+}
+
+//---------------------------------
+//simulation thread:
+
+void Shard::note_freed(uint32_t room_id) {
+	//(shards that place their own connections already know)
+	if (places_locally) return;
+	std::lock_guard< std::mutex > lock(mutex);
+	freed.emplace_back(room_id);
+}
+
+void Shard::write_checkpoint() {
+	assert(checkpoints);
+	std::vector< uint8_t > bytes;
+	uint32_t count = 0;
+	for (auto const &[id, room] : rooms) {
+		if (room.members.empty() && room.reserved.empty()) continue;
+		room.checkpoint(bytes);
+		count += 1;
+	}
+	//(the writer's thread does the slow part -- writing the file)
+	checkpoints->submit(index, count, std::move(bytes));
+}
+
+Room &Shard::room_with_space() {
+	//prefer a room where someone is waiting, then an empty room, then a new room:
+	Room *best = nullptr;
+	for (auto &[id, room] : rooms) {
+		if (room.free_slots() == 0) continue;
+		if (!best || room.free_slots() < best->free_slots()) best = &room;
+	}
+	if (best) return *best;
+	uint32_t id = uint32_t(rooms.size());
+	return rooms.try_emplace(id, id, record_directory, interest).first->second;
+}
+
+void Shard::take_incoming() {
+	auto now = std::chrono::steady_clock::now();
+	Incoming in;
+	while (incoming.receive(&in)) {
+		queue_latency.add(std::chrono::duration< double >(now - in.queued).count());
+		if (in.type == Incoming::Join) on_join(in);
+		else if (in.type == Incoming::Leave) on_leave(in.connection);
+		else on_message(in);
+	}
+	outgoing.flush();
+}
+
+void Shard::on_join(Incoming const &in) {
+	Peer *peer = peers.set(in.connection, std::make_unique< Peer >()).get();
+	peer->connection = in.connection;
+
+	Room *room = nullptr;
+	if (in.room_id == NoRoom) {
+		//(shards that do their own listening) the player held for the session, if any, otherwise any room with space:
+		for (auto &[id, r] : rooms) {
+			if (in.token && r.holds(in.token)) room = &r;
+		}
+		if (room) {
+			room->resume(peer, in.token);
+			std::cout << "[shard " << index << "] connection " << in.connection.index << " resumed its session in room " << room->id << "." << std::endl;
+		} else {
+			if (in.token) std::cout << "[shard " << index << "] connection " << in.connection.index << " asked to resume a session that has ended; placing it afresh." << std::endl;
+			room = &room_with_space();
+			room->add(peer, make_token());
+			std::cout << "[shard " << index << "] connection " << in.connection.index << " joined room " << room->id << "." << std::endl;
+		}
+	} else {
+		room = &rooms.try_emplace(in.room_id, in.room_id, record_directory, interest).first->second;
+		if (in.token) {
+			if (!room->resume(peer, in.token)) {
+				//(its player was given up on just as it came back; the client can reconnect to start afresh)
+				std::cout << "[shard " << index << "] connection " << in.connection.index << " came to resume a session in room " << in.room_id << " that has ended." << std::endl;
+				peers.erase(in.connection);
+				Outgoing out;
+				out.type = Outgoing::Close;
+				out.connection = in.connection;
+				outgoing.send(std::move(out));
+				return;
+			}
+			std::cout << "[shard " << index << "] connection " << in.connection.index << " resumed its session in room " << in.room_id << "." << std::endl;
+		} else {
+			room->add(peer, make_token());
+			std::cout << "[shard " << index << "] connection " << in.connection.index << " joined room " << in.room_id << "." << std::endl;
+		}
+	}
+	peer->room = room;
+}
+
+void Shard::on_leave(SlotHandle connection) {
+	std::unique_ptr< Peer > *peer = peers.get(connection);
+	if (!peer) return; //(already dropped)
+	drop(peer->get(), false);
+}
+
+void Shard::on_message(Incoming const &in) {
+	std::unique_ptr< Peer > *found = peers.get(in.connection);
+	if (!found) return; //(dropped, but the I/O thread hadn't heard yet)
+	Peer *peer = found->get();
+	Room &room = *peer->room;
+	ClientMessageContext context{peer, room, room.members.at(peer)};
+
+	try {
+		client_messages().handle(in.message, Payload{in.payload.data(), in.size}, context);
+	} catch (std::exception const &e) {
+		std::cout << "Disconnecting client:" << e.what() << std::endl;
+		drop(peer, true);
+	}
+}
+
+void Shard::drop(Peer *peer, bool close) {
+	SlotHandle connection = peer->connection;
+	assert(peer->room);
+	Room &room = *peer->room;
+	room.remove(peer);
+	note_freed(room.id);
+	if (close) {
+		Outgoing out;
+		out.type = Outgoing::Close;
+		out.connection = connection;
+		outgoing.send(std::move(out));
+	}
+	peers.erase(connection);
+}
+
+void Shard::send_outboxes() {
+	peers.for_each([this](SlotHandle connection, std::unique_ptr< Peer > &peer) {
+		Connection &outbox = peer->outbox;
+		if (!outbox.has_queued()) return;
+		Outgoing out;
+		out.type = Outgoing::Send;
+		out.connection = connection;
+		if (!outbox.send_buffer.empty()) {
+			out.bytes.resize(outbox.send_buffer.size());
+			outbox.send_buffer.peek(out.bytes.data(), out.bytes.size());
+			outbox.send_buffer.clear();
+		}
+		if (outbox.latest_waiting) {
+			assert(outbox.latest_header.size() <= out.latest_header.size());
+			std::copy(outbox.latest_header.begin(), outbox.latest_header.end(), out.latest_header.begin());
+			out.latest_header_size = uint8_t(outbox.latest_header.size());
+			out.latest_bytes = std::move(outbox.latest_bytes);
+			outbox.latest_bytes.reset();
+			outbox.latest_waiting = false;
+		}
+		outgoing.send(std::move(out));
+	});
+}
+
+void Shard::run() {
+	//per-tick statistics (printed with print_stats):
+	uint32_t const StatsTicks = std::max(1u, uint32_t(5.0 / scheduler.settings.tick)); //print every ~5 seconds
+	uint32_t stats_ticks = 0;
+
+	float const elapsed = float(scheduler.settings.tick);
+
+	uint32_t const CheckpointTicks = std::max(1u, uint32_t(checkpoint_interval / scheduler.settings.tick));
+	uint32_t checkpoint_ticks = 0;
+
+	while (!quit) {
+		//handle client messages as they arrive until a tick is due:
+		// (the simulation never touches a socket, so nothing here can block on one)
+		uint32_t ticks = scheduler.wait([&](double timeout) {
+			take_incoming();
+			std::this_thread::sleep_for(std::chrono::duration< double >(std::min(timeout, 0.001)));
+		});
+		take_incoming();
+
+		//update rooms and queue state messages:
+		// (when catching up after an overrun, several ticks run back-to-back)
+		uint32_t active_rooms = 0;
+		for (uint32_t t = 0; t < ticks; ++t) {
+			scheduler.begin_tick();
+			active_rooms = 0;
+			auto now = std::chrono::steady_clock::now();
+			for (auto &[id, room] : rooms) {
+				if (!room.reserved.empty()) {
+					uint32_t removed = room.expire(now);
+					if (removed) std::cout << "[shard " << index << "] gave up on " << removed << " restored player(s) in room " << id << "." << std::endl;
+					for (uint32_t i = 0; i < removed; ++i) note_freed(id);
+				}
+				if (room.members.empty()) continue;
+				room.tick(elapsed);
+				active_rooms += 1;
+			}
+			//...and hand them to the I/O thread right away:
+			send_outboxes();
+			if (checkpoints && ++checkpoint_ticks >= CheckpointTicks) {
+				write_checkpoint();
+				checkpoint_ticks = 0;
+			}
+			scheduler.end_tick();
+			stats_ticks += 1;
+		}
+
+		if (print_stats && stats_ticks >= StatsTicks) {
+			std::cout << "[stats] shard " << index << " " << peers.size() << " players in " << active_rooms << " active rooms" << '\n';
+			std::cout << "[stats] shard " << index << " tick start jitter: ";
+			scheduler.start_jitter.write_summary(std::cout);
+			std::cout << " [buckets ";
+			scheduler.start_jitter.write_buckets(std::cout);
+			std::cout << "]\n";
+			std::cout << "[stats] shard " << index << " tick duration: ";
+			scheduler.tick_duration.write_summary(std::cout);
+			std::cout << " [buckets ";
+			scheduler.tick_duration.write_buckets(std::cout);
+			std::cout << "]; skipped ticks: " << scheduler.skipped_ticks << '\n';
+			std::cout << "[stats] shard " << index << " queue latency (I/O -> simulation): ";
+			queue_latency.write_summary(std::cout);
+			std::cout << " [buckets ";
+			queue_latency.write_buckets(std::cout);
+			std::cout << "]; outgoing items waiting for room in the queue: " << outgoing.overflow.size() << std::endl;
+			stats_ticks = 0;
+			scheduler.start_jitter.clear();
+			scheduler.tick_duration.clear();
+			scheduler.skipped_ticks = 0;
+			queue_latency.clear();
+		}
+	}
+}
+
+//---------------------------------
+
+RoomManager::RoomManager(std::string const &port, Transport transport, uint32_t shard_count, TickScheduler::Settings const &tick_settings, bool print_stats,
+	std::string const &record_directory, std::string const &checkpoint_path, double checkpoint_interval, Interest::Settings const &interest,
+	ListenSettings const &listen, uint32_t acceptor_count) {
+	if (transport == Transport::UDP) {
+		if (shard_count != 1) {
+			std::cout << "[RoomManager] NOTE: UDP connections share one socket, so using one shard (not " << shard_count << ")." << std::endl;
+		}
+		if (acceptor_count > 1) {
+			std::cout << "[RoomManager] NOTE: UDP connections share one socket, so aren't accepted separately (ignoring acceptor count " << acceptor_count << ")." << std::endl;
+		}
+		if (!listen.shm_name.empty()) {
+			std::cout << "[RoomManager] NOTE: shared-memory connections are accepted alongside TCP, not UDP (ignoring shm:" << listen.shm_name << ")." << std::endl;
+		}
+		shards.emplace_back(std::make_unique< Shard >(0, tick_settings, port, transport));
+	} else {
+		//(with several acceptors, each listens on its own socket, and the kernel spreads new connections between them)
+		ListenSettings acceptor_listen = listen;
+		if (acceptor_count > 1) acceptor_listen.reuse_port = true;
+		for (uint32_t i = 0; i < std::max(1u, acceptor_count); ++i) {
+			acceptors.emplace_back(std::make_unique< Server >(port, transport, acceptor_listen));
+			acceptor_listen.shm_name.clear(); //(the first acceptor takes any shared-memory connections)
+		}
+		for (uint32_t i = 0; i < std::max(1u, shard_count); ++i) {
+			shards.emplace_back(std::make_unique< Shard >(i, tick_settings));
+		}
+	}
+	shard_players.assign(shards.size(), 0);
+
+	if (!checkpoint_path.empty()) {
+		checkpoints = std::make_unique< CheckpointWriter >(checkpoint_path, uint32_t(shards.size()));
+	}
+	for (auto &shard : shards) {
+		shard->print_stats = print_stats;
+		shard->record_directory = record_directory;
+		shard->interest = interest;
+		shard->checkpoints = checkpoints.get();
+		shard->checkpoint_interval = checkpoint_interval;
+	}
+
+	if (!checkpoint_path.empty()) {
+		//put back the rooms from the last run's checkpoint:
+		// (they are numbered afresh, and spread over the shards the way new rooms are)
+		std::vector< Checkpoint::RoomState > saved = Checkpoint::load(checkpoint_path);
+		resume_until = std::chrono::steady_clock::now() + std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(ResumeTimeout));
+		uint32_t players = 0;
+		for (Checkpoint::RoomState const &state : saved) {
+			uint32_t least = uint32_t(std::min_element(shard_players.begin(), shard_players.end()) - shard_players.begin());
+			Shard &shard = *shards[least];
+			uint32_t id = uint32_t(rooms.size());
+			rooms.emplace_back();
+			rooms.back().shard = &shard;
+			rooms.back().free = Room::Capacity - uint32_t(state.seats.size());
+			shard_players[least] += uint32_t(state.seats.size());
+			shard.restore(id, state, resume_until);
+			for (Checkpoint::Seat const &seat : state.seats) {
+				resumable.emplace(seat.token, Resumable{&shard, id});
+			}
+			players += uint32_t(state.seats.size());
+		}
+		if (!saved.empty()) {
+			std::cout << "[RoomManager] restored " << saved.size() << " room(s) with " << players << " player(s) from '" << checkpoint_path << "'." << std::endl;
+		}
+	}
+
+	for (auto &shard : shards) {
+		shard->start();
+	}
+	std::cout << "[RoomManager] running " << shards.size() << " shard(s)";
+	if (acceptors.size() > 1) std::cout << " and " << acceptors.size() << " acceptors";
+	std::cout << "." << std::endl;
+}
+
+uint32_t RoomManager::place() {
+	//note slots that have been freed since the last placement:
+	for (auto &shard : shards) {
+		for (uint32_t id : shard->take_freed()) {
+			assert(id < rooms.size());
+			rooms[id].free += 1;
+			shard_players[shard->index] -= 1;
+		}
+	}
+
+	//prefer a room where someone is waiting, then an empty room:
+	uint32_t best = uint32_t(rooms.size());
+	for (uint32_t id = 0; id < rooms.size(); ++id) {
+		if (rooms[id].free == 0) continue;
+		if (best == rooms.size() || rooms[id].free < rooms[best].free) best = id;
+		if (rooms[best].free < Room::Capacity) break;
+	}
+
+	//...otherwise make a new room on the shard with the fewest players:
+	if (best == rooms.size()) {
+		uint32_t least = uint32_t(std::min_element(shard_players.begin(), shard_players.end()) - shard_players.begin());
+		rooms.emplace_back();
+		rooms.back().shard = shards[least].get();
+	}
+
+	RoomRecord &room = rooms[best];
+	assert(room.free > 0);
+	room.free -= 1;
+	shard_players[room.shard->index] += 1;
+	return best;
+}
+
+void RoomManager::run() {
+	if (acceptors.empty()) {
+		//(the shard is doing its own accepting)
+		while (true) {
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+		}
+	}
+
+	for (size_t i = 1; i < acceptors.size(); ++i) {
+		acceptor_threads.emplace_back(&RoomManager::accept, this, std::ref(*acceptors[i]));
+	}
+	accept(*acceptors[0]);
+}
+
+void RoomManager::accept(Server &acceptor) {
+	while (true) {
+		acceptor.poll([&](Connection *c, Connection::Event evt) {
+			//connections are handed off as soon as their first message arrives:
+			if (evt != Connection::OnRecv) return;
+			uint64_t token;
+			if (!take_resume(c, &token)) return;
+			//(the rest of what it sent goes with it)
+			std::vector< uint8_t > received(c->recv_buffer.data(), c->recv_buffer.data() + c->recv_buffer.size());
+
+			std::unique_lock< std::mutex > lock(placement_mutex);
+
+			//a client resuming a session goes back to its player (if it is still being held):
+			auto f = resumable.find(token);
+			if (f != resumable.end() && std::chrono::steady_clock::now() < resume_until) {
+				Resumable where = f->second;
+				resumable.erase(f);
+				lock.unlock();
+				where.shard->hand_off(acceptor.release(c), where.room_id, token, std::move(received));
+				return;
+			}
+			if (token) std::cout << "[RoomManager] connection on " << c->socket << " asked to resume a session that has ended; placing it afresh." << std::endl;
+
+			uint32_t room_id = place();
+			Shard *shard = rooms[room_id].shard;
+			lock.unlock();
+			shard->hand_off(acceptor.release(c), room_id, 0, std::move(received));
+		}, 1.0);
+	}
+}
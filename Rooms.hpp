@@ -0,0 +1,322 @@
+#pragma once
+
+/*
+ * Rooms let one server process host many independent games.
+ *
+ * A Room is one match: a Game plus the connections playing in it.
+ *
+ * A Shard owns a set of rooms along with their connections' sockets, and runs
+ *  them on two threads of its own, so shards never touch each other's state:
+ *  - its I/O thread polls the sockets, splits what arrives into messages,
+ *     answers pings, and sends whatever the simulation thread has queued;
+ *  - its simulation thread ticks the rooms, applying the clients' messages
+ *     and queueing state for them, and never touches a socket -- so a burst of
+ *     traffic can't delay a tick, and a long tick can't hold up the sockets.
+ *  The two are connected by lock-free queues (see SPSCQueue.hpp): parsed client
+ *  messages (and connections joining and leaving) go one way, and each tick's
+ *  outgoing messages -- including the shared state payloads, which aren't
+ *  copied -- go the other. The simulation thread sees each connection as a
+ *  Peer, whose messages are queued in an outbox until the end of the tick.
+ *  If the simulation falls behind, client messages wait on the I/O thread's
+ *  side of the queue only up to a limit; a client that floods it is disconnected.
+ *
+ * RoomManager accepts connections (on the calling thread -- or, to spread a
+ *  flood of connections over several cores, on several acceptor threads, each
+ *  with its own SO_REUSEPORT listening socket), picks a room with a free
+ *  player slot for each -- preferring rooms where someone is already
+ *  waiting for an opponent -- and hands the socket off to the shard that owns
+ *  that room. New rooms go to the shard with the fewest players. Connections
+ *  are placed once their first message arrives (clients send controls every
+ *  frame, so this is right away), so that a client whose first message asks to
+ *  resume a session can go straight back to its old room.
+ *
+ * Between the acceptors and the shards, the only traffic is handed-off sockets
+ *  (acceptor -> shard) and notes about freed player slots (shard -> acceptor),
+ *  both behind a mutex. (acceptors share the placement state, behind another)
+ *
+ * With checkpoints turned on, shards periodically save their rooms (see
+ *  Checkpoint.hpp), and a restarted server puts the saved rooms back, holding
+ *  each saved player for a while for its client to reconnect and resume.
+ *
+ */
+
+#include "Checkpoint.hpp"
+#include "Connection.hpp"
+#include "Game.hpp"
+#include "Interest.hpp"
+#include "MatchLog.hpp"
+#include "SPSCQueue.hpp"
+#include "TickScheduler.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct Room;
+
+//(simulation thread) a client's connection, as seen from the simulation thread:
+// the socket belongs to the shard's I/O thread, so messages for the client are queued in
+// 'outbox' -- a Connection with no socket -- and handed to the I/O thread at the end of each tick.
+struct Peer {
+	SlotHandle connection; //the I/O thread's name for the connection (in its server's connections)
+	Connection outbox;
+	Room *room = nullptr; //the room it plays in (once placed)
+};
+
+struct Room {
+	Room(uint32_t id, std::string const &record_directory = "", Interest::Settings const &interest = Interest::Settings());
+
+	uint32_t id;
+	Game game;
+
+	//clients playing in this room (and which snapshots each has been sent):
+	struct Member {
+		Player *player = nullptr;
+		uint64_t token = 0; //session token (sent to the client, which may use it to resume after a restart)
+		SnapshotHistory snapshots;
+		uint32_t relevant = 0; //players relevant to this member as of the last tick (see Interest.hpp)
+	};
+	std::unordered_map< Peer *, Member > members;
+
+	//(after a restore) players held for clients that haven't reconnected yet:
+	struct Reservation {
+		Player *player = nullptr;
+		uint64_t token = 0;
+		std::chrono::steady_clock::time_point expires;
+	};
+	std::vector< Reservation > reserved;
+
+	//one player each for the gun and the chicken:
+	static constexpr uint32_t Capacity = 2;
+	uint32_t free_slots() const { return Capacity - uint32_t(members.size() + reserved.size()); }
+
+	void add(Peer *peer, uint64_t token); //(room must have a free slot)
+	void remove(Peer *peer); //(resets the game if the room is now empty)
+
+	//put back a room saved in a checkpoint, holding its players until 'expires':
+	// (room must be empty)
+	void restore(Checkpoint::RoomState const &state, std::chrono::steady_clock::time_point expires);
+	//is a player being held for 'token'?
+	bool holds(uint64_t token) const;
+	//give 'peer' the player held for 'token'; returns false if there isn't one:
+	bool resume(Peer *peer, uint64_t token);
+	//remove held players whose time is up; returns how many were removed:
+	uint32_t expire(std::chrono::steady_clock::time_point now);
+	//append the room's state to a checkpoint (see Checkpoint::write_room):
+	void checkpoint(std::vector< uint8_t > &to) const;
+
+	//(if record_directory isn't empty) each match -- from the first player joining an empty room
+	// to the last one leaving -- is logged to a file there (see MatchLog.hpp):
+	std::string record_directory;
+	std::unique_ptr< MatchRecorder > recorder; //log of the current match (if recording)
+	uint32_t matches = 0; //matches started in this room (numbers the logs)
+
+	//which players each member is sent:
+	Interest interest;
+
+	//where the chicken was hit since the last tick (if it was), to be sent to every member by tick():
+	// (the gun fires at most once per tick, so there is at most one hit to send)
+	std::optional< glm::vec3 > hit;
+
+	//update the game by 'elapsed' seconds and queue state messages to every member:
+	void tick(float elapsed);
+};
+
+struct Shard {
+	//a shard whose connections are handed to it by a RoomManager:
+	Shard(uint32_t index, TickScheduler::Settings const &tick_settings);
+	//a shard that listens for (and places) its own connections:
+	Shard(uint32_t index, TickScheduler::Settings const &tick_settings, std::string const &port, Transport transport);
+	~Shard(); //stops and joins the I/O and simulation threads
+
+	Shard(Shard const &) = delete;
+	Shard &operator=(Shard const &) = delete;
+
+	//launch the I/O and simulation threads:
+	void start();
+
+	//(thread-safe) give this shard an accepted connection to be added to room 'room_id':
+	// (if 'token' isn't zero, the connection is resuming a session, and is given the player held for it)
+	// ('received' is data that arrived before the hand-off, and is handled as if it had just arrived)
+	void hand_off(ReleasedConnection &&connection, uint32_t room_id, uint64_t token = 0, std::vector< uint8_t > &&received = {});
+
+	//(before start()) put back a room from a checkpoint, holding its players until 'expires':
+	void restore(uint32_t room_id, Checkpoint::RoomState const &state, std::chrono::steady_clock::time_point expires);
+
+	//(thread-safe) ids of rooms in which a player slot has been freed since the last call:
+	// (one entry per freed slot)
+	std::vector< uint32_t > take_freed();
+
+	uint32_t index;
+	bool print_stats = false; //periodically print per-tick syscall counts, tick timing, queue latency, and connection stats
+	std::string record_directory; //(if not empty) record match logs of this shard's rooms here
+	Interest::Settings interest; //which players each member of this shard's rooms is sent
+
+	//(if not nullptr) periodically save this shard's rooms here:
+	CheckpointWriter *checkpoints = nullptr;
+	double checkpoint_interval = 5.0; //seconds between checkpoints
+
+	TickScheduler scheduler; //(used by the simulation thread)
+
+	//--- owned by the I/O thread once started ---
+	Server server;
+
+	//--- owned by the simulation thread once started ---
+	std::unordered_map< uint32_t, Room > rooms; //by id
+	SlotData< std::unique_ptr< Peer > > peers; //by connection
+
+	//--- between the threads ---
+
+	//I/O -> simulation: connections joining and leaving, and the messages they send:
+	struct Incoming {
+		enum Type : uint8_t {
+			Join, //a connection was placed (or, if room_id is NoRoom, should be placed) in a room
+			Leave, //a connection that joined has closed
+			Received, //a client message (to be handled by the simulation)
+		} type = Received;
+		SlotHandle connection;
+		uint32_t room_id = 0; //(Join)
+		uint64_t token = 0; //(Join) session to resume (or, if handed off without one, 0)
+		uint8_t message = 0; //(Received) type
+		uint8_t size = 0; //(Received) payload size
+		std::array< uint8_t, 16 > payload{}; //(Received) (every message a client sends to the simulation is this small)
+		std::chrono::steady_clock::time_point queued; //(for measuring queue latency)
+	};
+	static constexpr uint32_t NoRoom = ~0u;
+
+	//simulation -> I/O: what to send to (or do with) each connection after a tick:
+	struct Outgoing {
+		enum Type : uint8_t {
+			Send, //queue 'bytes', then the latest-wins message (if any)
+			Close, //close the connection (e.g., it sent something the simulation rejected)
+		} type = Send;
+		SlotHandle connection;
+		std::vector< uint8_t > bytes; //(Send) (usually empty -- most ticks only send state)
+		std::array< uint8_t, 16 > latest_header{}; //(Send) latest-wins message's header...
+		uint8_t latest_header_size = 0;
+		SharedBytes latest_bytes; //...and (shared, not copied) payload; nullptr if none
+	};
+
+	SPSCChannel< Incoming, 4096 > incoming;
+	SPSCChannel< Outgoing, 4096 > outgoing;
+
+	//(when the simulation falls behind) client messages wait in incoming's overflow, up to this many;
+	// past that, they are dropped, and the connection with the most messages waiting is closed (see shed_incoming)
+	// (joins and leaves are never dropped -- there are only ever as many as there are connections)
+	static constexpr size_t IncomingOverflowLimit = 4096;
+
+private:
+	//--- I/O thread ---
+	void run_io();
+	void on_event(Connection *c, Connection::Event evt);
+	void adopt_handed_off();
+	//tell the simulation a connection has joined:
+	void join(Connection *c, uint32_t room_id, uint64_t token);
+	//forget a connection (telling the simulation, if it had joined):
+	void leave(Connection *c);
+	//do what the simulation asked:
+	void take_outgoing();
+	//(incoming's overflow is full) close the connection with the most messages waiting in it, dropping them:
+	void shed_incoming();
+
+	SlotData< bool > joined; //connections the simulation knows about
+
+	uint64_t incoming_dropped = 0; //client messages dropped because incoming's overflow was full (or their connection was shed)
+	uint64_t incoming_shed = 0; //connections closed by shed_incoming
+
+	//(shards that listen for their own connections) put a new connection in a room once its first message has arrived:
+	// (returns false if it hasn't yet)
+	bool place_locally(Connection *c);
+	bool places_locally = false;
+
+	//--- simulation thread ---
+	void run();
+	void take_incoming();
+	void on_join(Incoming const &in);
+	void on_leave(SlotHandle connection);
+	void on_message(Incoming const &in);
+	//remove a peer from its room (and let the I/O thread know to close it, if 'close'):
+	void drop(Peer *peer, bool close);
+	//hand every peer's queued messages to the I/O thread:
+	void send_outboxes();
+	Room &room_with_space();
+	//let the acceptor know a player slot in a room was freed:
+	void note_freed(uint32_t room_id);
+	//save every occupied room to checkpoints:
+	void write_checkpoint();
+
+	Histogram queue_latency; //(simulation thread) how long incoming items waited to be handled (seconds)
+
+	std::thread io_thread;
+	std::thread sim_thread;
+	std::atomic< bool > quit{false};
+
+	std::mutex mutex; //protects handed_off and freed:
+	struct HandedOff {
+		ReleasedConnection connection;
+		uint32_t room_id;
+		uint64_t token; //(0 unless resuming)
+		std::vector< uint8_t > received;
+	};
+	std::vector< HandedOff > handed_off; //connections waiting to be adopted
+	std::atomic< bool > has_handed_off{false}; //(lets the I/O thread skip the lock when nothing is waiting)
+	std::vector< uint32_t > freed; //ids of rooms with newly-freed slots
+};
+
+struct RoomManager {
+	//'shard_count' worker threads will be started:
+	// (UDP connections all share one socket, so can't be handed off; with UDP there is always one shard)
+	// ('record_directory', if not empty, is where rooms record match logs)
+	// ('checkpoint_path', if not empty, is where rooms are saved every 'checkpoint_interval' seconds, and restored from at startup)
+	// ('interest' decides which players each connection is sent)
+	// ('listen' is how to listen for connections; with 'acceptor_count' above one, each acceptor has
+	//  its own listening socket, so listen.reuse_port is set)
+	RoomManager(std::string const &port, Transport transport, uint32_t shard_count, TickScheduler::Settings const &tick_settings, bool print_stats,
+		std::string const &record_directory = "", std::string const &checkpoint_path = "", double checkpoint_interval = 5.0,
+		Interest::Settings const &interest = Interest::Settings(), ListenSettings const &listen = ListenSettings(), uint32_t acceptor_count = 1);
+
+	//accept connections forever:
+	// (the calling thread runs the first acceptor; the rest get threads of their own)
+	void run();
+
+	std::unique_ptr< CheckpointWriter > checkpoints; //(declared before shards, so it outlives their threads)
+
+	std::vector< std::unique_ptr< Server > > acceptors; //(TCP only) listen for new connections
+	std::vector< std::unique_ptr< Shard > > shards;
+
+	//accept connections on 'acceptor' forever:
+	void accept(Server &acceptor);
+	std::vector< std::thread > acceptor_threads; //(for acceptors after the first)
+
+	std::mutex placement_mutex; //protects rooms, shard_players, and resumable (which are shared by the acceptors):
+
+	//the acceptors' view of each room (by id):
+	struct RoomRecord {
+		Shard *shard = nullptr;
+		uint32_t free = Room::Capacity;
+	};
+	std::vector< RoomRecord > rooms;
+	std::vector< uint32_t > shard_players; //players placed in each shard (by shard index)
+
+	//(with placement_mutex held) pick a room for a new connection (creating a room if none have space):
+	uint32_t place();
+
+	//(after a restore) where the player of each session that hasn't been resumed yet is held:
+	// (the shards hold restored players until resume_until)
+	struct Resumable {
+		Shard *shard = nullptr;
+		uint32_t room_id = 0;
+	};
+	std::unordered_map< uint64_t, Resumable > resumable; //by session token
+	std::chrono::steady_clock::time_point resume_until;
+
+	//restored players are held this long for their clients to come back:
+	static constexpr double ResumeTimeout = 30.0;
+};
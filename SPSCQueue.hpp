@@ -0,0 +1,98 @@
+#pragma once
+
+/*
+ * A bounded, lock-free, single-producer single-consumer queue.
+ *
+ * One thread push()es and one (other) thread pop()s; neither ever blocks or
+ *  takes a lock. Items live in a fixed ring of 'Capacity' slots, so nothing is
+ *  allocated after construction; a push to a full queue fails (returns false)
+ *  and it is up to the producer what to do about it.
+ *
+ * Each side keeps a private copy of the other side's index and only reloads the
+ *  shared one when its copy says the queue is full (or empty), and the two
+ *  shared indices live on separate cache lines, so in steady state the threads
+ *  don't bounce a cache line back and forth on every item.
+ *
+ */
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <utility>
+
+template< typename T, size_t Capacity >
+struct SPSCQueue {
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+	//(producer) add an item to the back; returns false (and does nothing) if the queue is full:
+	bool push(T const &value) {
+		if (full()) return false;
+		size_t t = tail.load(std::memory_order_relaxed);
+		slots[t & (Capacity - 1)] = value;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+	//(producer) ...moving the item in (it is left alone if the queue is full):
+	bool push(T &&value) {
+		if (full()) return false;
+		size_t t = tail.load(std::memory_order_relaxed);
+		slots[t & (Capacity - 1)] = std::move(value);
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	//(consumer) take the item at the front; returns false if the queue is empty:
+	bool pop(T *value) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail_seen) {
+			tail_seen = tail.load(std::memory_order_acquire);
+			if (h == tail_seen) return false;
+		}
+		*value = std::move(slots[h & (Capacity - 1)]);
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	static constexpr size_t CacheLine = 64;
+
+	//(producer) is every slot in use?
+	bool full() {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head_seen < Capacity) return false;
+		head_seen = head.load(std::memory_order_acquire);
+		return t - head_seen == Capacity;
+	}
+
+	std::array< T, Capacity > slots;
+
+	//consumer's side:
+	alignas(CacheLine) std::atomic< size_t > head{0}; //next slot to pop
+	size_t tail_seen = 0; //(consumer's copy of tail)
+
+	//producer's side:
+	alignas(CacheLine) std::atomic< size_t > tail{0}; //next slot to push
+	size_t head_seen = 0; //(producer's copy of head)
+};
+
+//an SPSCQueue for items that mustn't be dropped:
+// items that don't fit are kept (in order) on the producer's side, and handed over
+// before any newer ones once there is room, so the producer never blocks or loses an item.
+template< typename T, size_t Capacity >
+struct SPSCChannel {
+	//(producer) send an item:
+	void send(T &&item) {
+		flush();
+		if (!overflow.empty() || !queue.push(std::move(item))) overflow.emplace_back(std::move(item));
+	}
+	//(producer) hand over items that didn't fit earlier (also done by send()):
+	void flush() {
+		while (!overflow.empty() && queue.push(std::move(overflow.front()))) overflow.pop_front();
+	}
+	//(consumer) take the next item; returns false if there isn't one:
+	bool receive(T *item) { return queue.pop(item); }
+
+	SPSCQueue< T, Capacity > queue;
+	std::deque< T > overflow; //(producer's side)
+};
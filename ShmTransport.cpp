@@ -0,0 +1,483 @@
+#include "sockets.hpp"
+
+#include "ShmTransport.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+bool shm_address(std::string const &address, std::string *name) {
+	static std::string const Prefix = "shm:";
+	if (address.compare(0, Prefix.size(), Prefix) != 0) return false;
+	if (name) *name = address.substr(Prefix.size());
+	return true;
+}
+
+#ifdef __linux__
+
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <new>
+#include <system_error>
+#include <vector>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+//---------------------------------
+//Segment layout:
+
+//bytes each ring holds (a power of two, so stream positions wrap with a mask):
+// (more than this waits in the sender's send_buffer, and counts toward its send_limit)
+constexpr uint64_t ShmRingSize = uint64_t(1) << 18;
+static_assert((ShmRingSize & (ShmRingSize - 1)) == 0, "ring size must be a power of two");
+
+//(atomics are shared between processes, so must not hide a lock inside the process)
+static_assert(std::atomic< uint64_t >::is_always_lock_free, "shared-memory rings need lock-free 64-bit atomics");
+static_assert(std::atomic< uint32_t >::is_always_lock_free, "shared-memory rings need lock-free 32-bit atomics");
+
+struct ShmRing {
+	//stream positions (they only ever grow; the data for position p is at data[p % ShmRingSize]):
+	// (the two are on separate cache lines, since each side writes one and reads the other)
+	alignas(64) std::atomic< uint64_t > head{0}; //bytes written (by the writer)
+	alignas(64) std::atomic< uint64_t > tail{0}; //bytes read (by the reader)
+	std::atomic< uint32_t > writer_waiting{0}; //(set by the writer when the ring is full) signal it once there is space
+	std::atomic< uint32_t > closed{0}; //(set by the writer) the writer's side has closed
+	alignas(64) uint8_t data[ShmRingSize];
+};
+
+//seals a segment must have before the server maps it:
+static constexpr int RequiredSeals = F_SEAL_SHRINK | F_SEAL_GROW;
+
+struct ShmSegment {
+	uint32_t magic = Magic;
+	uint32_t ring_size = uint32_t(ShmRingSize);
+	ShmRing to_server;
+	ShmRing to_client;
+	static constexpr uint32_t Magic = 0x6d687363; //'cshm'
+};
+
+//name of the unix-domain socket a Server listens on for 'name':
+// (a leading zero byte puts it in linux's abstract namespace, so no file is created)
+static socklen_t listen_address(std::string const &name, struct sockaddr_un *address) {
+	std::string path = std::string(1, '\0') + "chicken-run-shm:" + name;
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	if (path.size() > sizeof(address->sun_path)) {
+		throw std::runtime_error("Shared-memory name '" + name + "' is too long.");
+	}
+	memcpy(address->sun_path, path.data(), path.size());
+	return socklen_t(offsetof(struct sockaddr_un, sun_path) + path.size());
+}
+
+static void signal_eventfd(int fd, SyscallCounts &syscalls) {
+	uint64_t one = 1;
+	syscalls.send += 1;
+	//(can only fail if the counter is about to overflow -- in which case the other side is awake anyway)
+	[[maybe_unused]] ssize_t ret = write(fd, &one, sizeof(one));
+}
+
+ShmPeer::~ShmPeer() {
+	if (segment) munmap(segment, segment_size);
+	if (wake >= 0) ::close(wake);
+	if (peer_wake >= 0) ::close(peer_wake);
+}
+
+//---------------------------------
+//Setup:
+
+Socket shm_listen(std::string const &name) {
+	struct sockaddr_un address;
+	socklen_t length = listen_address(name, &address);
+
+	Socket s = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (s == InvalidSocket) {
+		throw std::system_error(errno, std::system_category(), "failed to create shared-memory listen socket");
+	}
+	if (bind(s, reinterpret_cast< struct sockaddr * >(&address), length) != 0) {
+		int err = errno;
+		closesocket(s);
+		throw std::system_error(err, std::system_category(), "failed to bind shared-memory name '" + name + "' (is another server using it?)");
+	}
+	if (listen(s, 128) != 0) {
+		int err = errno;
+		closesocket(s);
+		throw std::system_error(err, std::system_category(), "failed to listen for shared-memory connections");
+	}
+	return s;
+}
+
+Socket shm_accept(char const *where, Socket listen_socket, SyscallCounts &syscalls) {
+	while (true) {
+		Socket got = accept4(listen_socket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		syscalls.accept += 1;
+		if (got != InvalidSocket) return got;
+		if (errno == EINTR || errno == ECONNABORTED) continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK) std::cerr << "[" << where << "] accept() (shared memory) returned error " << errno << "(" << strerror(errno) << ")." << std::endl;
+		return InvalidSocket;
+	}
+}
+
+//is 'fd' an eventfd? (the client could send anything -- e.g., a pipe, which a wakeup could block on)
+static bool is_eventfd(int fd) {
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	char target[64];
+	ssize_t length = readlink(path, target, sizeof(target));
+	static char const EventFd[] = "anon_inode:[eventfd]";
+	return length == ssize_t(sizeof(EventFd) - 1) && memcmp(target, EventFd, sizeof(EventFd) - 1) == 0;
+}
+
+ShmSetup shm_finish_accept(char const *where, Connection &c, SyscallCounts &syscalls) {
+	assert(c.shm && !c.shm->segment);
+
+	//the client sends [segment, client's eventfd, server's eventfd] with a single byte of data:
+	char byte = 0;
+	struct iovec iov;
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	alignas(struct cmsghdr) char control[CMSG_SPACE(3 * sizeof(int))];
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	ssize_t ret = recvmsg(c.socket, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+	syscalls.recv += 1;
+	if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return ShmSetup::Waiting;
+	if (ret <= 0) {
+		std::cerr << "[" << where << "] shared-memory client on " << c.socket << " went away before sending its segment." << std::endl;
+		return ShmSetup::Failed;
+	}
+
+	//take whatever descriptors arrived (so they are closed, even if they aren't what was expected):
+	std::vector< int > fds;
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+		size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		size_t at = fds.size();
+		fds.resize(at + count);
+		memcpy(fds.data() + at, CMSG_DATA(cmsg), count * sizeof(int));
+	}
+	bool usable = (fds.size() == 3 && !(msg.msg_flags & MSG_CTRUNC));
+	if (!usable) {
+		for (int fd : fds) ::close(fd);
+	}
+
+	auto peer = std::make_unique< ShmPeer >();
+	if (usable) {
+		peer->peer_wake = fds[1];
+		peer->wake = fds[2];
+		usable = is_eventfd(peer->wake) && is_eventfd(peer->peer_wake);
+		if (usable) {
+			//(reading or signalling them mustn't block, whatever the client created them with)
+			for (int fd : {peer->wake, peer->peer_wake}) {
+				fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+			}
+		}
+
+		//(a segment the client could shrink would crash the server when it touched the missing pages)
+		int seals = fcntl(fds[0], F_GET_SEALS);
+		struct stat st;
+		if (usable && seals >= 0 && (seals & RequiredSeals) == RequiredSeals
+		 && fstat(fds[0], &st) == 0 && size_t(st.st_size) == sizeof(ShmSegment)) {
+			void *mapped = mmap(nullptr, sizeof(ShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+			if (mapped != MAP_FAILED) {
+				peer->segment = mapped;
+				peer->segment_size = sizeof(ShmSegment);
+			}
+		}
+		::close(fds[0]); //(the mapping keeps the segment alive)
+	}
+
+	ShmSegment *segment = reinterpret_cast< ShmSegment * >(peer->segment);
+	if (!usable || !segment || segment->magic != ShmSegment::Magic || segment->ring_size != ShmRingSize) {
+		std::cerr << "[" << where << "] shared-memory client on " << c.socket << " didn't send a usable segment." << std::endl;
+		return ShmSetup::Failed; //(peer's destructor cleans up whatever did arrive)
+	}
+	peer->in = &segment->to_server;
+	peer->out = &segment->to_client;
+
+	c.shm = std::move(peer);
+	return ShmSetup::Ready;
+}
+
+void shm_connect(std::string const &name, Connection *connection_, SyscallCounts &syscalls) {
+	assert(connection_);
+	Connection &connection = *connection_;
+	assert(!connection);
+
+	struct sockaddr_un address;
+	socklen_t length = listen_address(name, &address);
+
+	std::cout << "[shm_connect] connecting to shared-memory server '" << name << "'..." << std::endl;
+
+	Socket s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (s == InvalidSocket) {
+		throw std::system_error(errno, std::system_category(), "failed to create socket");
+	}
+	if (connect(s, reinterpret_cast< struct sockaddr * >(&address), length) != 0) {
+		int err = errno;
+		closesocket(s);
+		throw std::runtime_error("Failed to connect to shared-memory server '" + name + "': " + std::string(strerror(err)));
+	}
+
+	//make the segment (and the eventfds for each side to wait on):
+	auto peer = std::make_unique< ShmPeer >();
+	// (the segment's size is sealed, since the server won't map a segment that could shrink under it -- touching the missing pages would crash it)
+	int segment_fd = memfd_create(("chicken-run-shm:" + name).c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	peer->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	peer->peer_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (segment_fd < 0 || peer->wake < 0 || peer->peer_wake < 0 || ftruncate(segment_fd, sizeof(ShmSegment)) != 0
+	 || fcntl(segment_fd, F_ADD_SEALS, RequiredSeals | F_SEAL_SEAL) != 0) {
+		int err = errno;
+		if (segment_fd >= 0) ::close(segment_fd);
+		closesocket(s);
+		throw std::system_error(err, std::system_category(), "failed to create shared-memory segment");
+	}
+	void *mapped = mmap(nullptr, sizeof(ShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, segment_fd, 0);
+	if (mapped == MAP_FAILED) {
+		int err = errno;
+		::close(segment_fd);
+		closesocket(s);
+		throw std::system_error(err, std::system_category(), "failed to map shared-memory segment");
+	}
+	peer->segment = mapped;
+	peer->segment_size = sizeof(ShmSegment);
+	ShmSegment *segment = new (mapped) ShmSegment();
+	peer->in = &segment->to_client;
+	peer->out = &segment->to_server;
+
+	//hand the server the segment, its eventfd to signal us with, and its eventfd to wait on:
+	char byte = 0;
+	struct iovec iov;
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	alignas(struct cmsghdr) char control[CMSG_SPACE(3 * sizeof(int))];
+	memset(control, 0, sizeof(control));
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+	int fds[3] = {segment_fd, peer->wake, peer->peer_wake};
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	ssize_t ret = sendmsg(s, &msg, MSG_NOSIGNAL);
+	syscalls.send += 1;
+	::close(segment_fd); //(the mapping -- and, once it has it, the server -- keep the segment alive)
+	if (ret != 1) {
+		int err = errno;
+		closesocket(s);
+		throw std::runtime_error("Failed to hand shared-memory segment to server '" + name + "': " + std::string(strerror(err)));
+	}
+
+	//(from here on, the socket is only watched for the server going away)
+	int flags = fcntl(s, F_GETFL);
+	fcntl(s, F_SETFL, flags | O_NONBLOCK);
+
+	std::cout << "[shm_connect] connected." << std::endl;
+	connection.socket = s;
+	connection.shm = std::move(peer);
+}
+
+void shm_watch(int epoll_fd, Connection &c, bool add, SyscallCounts &syscalls) {
+	assert(c.shm);
+	if (!add) {
+		syscalls.control += 2;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c.shm->wake, nullptr) != 0 || epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c.socket, nullptr) != 0) {
+			throw std::system_error(errno, std::system_category(), "failed to remove shared-memory connection from epoll");
+		}
+		return;
+	}
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.data.ptr = &c;
+
+	//the eventfd (edge-triggered: reading it resets it):
+	ev.events = EPOLLIN | EPOLLET;
+	syscalls.control += 1;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c.shm->wake, &ev) != 0) {
+		throw std::system_error(errno, std::system_category(), "failed to watch shared-memory eventfd");
+	}
+	//the socket, for hangups only (level-triggered, so one that coincides with a wakeup isn't missed):
+	ev.events = EPOLLRDHUP;
+	syscalls.control += 1;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c.socket, &ev) != 0) {
+		throw std::system_error(errno, std::system_category(), "failed to watch shared-memory socket");
+	}
+
+	//(the ring may have data that arrived while nobody was watching -- e.g., before a hand-off)
+	signal_eventfd(c.shm->wake, syscalls);
+}
+
+//---------------------------------
+//Data:
+
+//copy between a ring and a buffer, starting at stream position 'at' (wrapping around the end of the ring):
+static void ring_write(ShmRing &ring, uint64_t at, uint8_t const *data, size_t size) {
+	size_t offset = size_t(at & (ShmRingSize - 1));
+	size_t first = std::min(size, size_t(ShmRingSize) - offset);
+	memcpy(ring.data + offset, data, first);
+	memcpy(ring.data, data + first, size - first);
+}
+
+static void ring_read(ShmRing const &ring, uint64_t at, uint8_t *data, size_t size) {
+	size_t offset = size_t(at & (ShmRingSize - 1));
+	size_t first = std::min(size, size_t(ShmRingSize) - offset);
+	memcpy(data, ring.data + offset, first);
+	memcpy(data + first, ring.data, size - first);
+}
+
+bool shm_recv(Connection &c, size_t *received, SyscallCounts &syscalls) {
+	assert(c.shm && received);
+	ShmPeer &peer = *c.shm;
+	ShmRing &ring = *peer.in;
+
+	//reset the eventfd (if it was what woke us):
+	uint64_t count = 0;
+	bool woken = (read(peer.wake, &count, sizeof(count)) == ssize_t(sizeof(count)));
+	syscalls.recv += 1;
+
+	//take everything written so far:
+	// (the reader publishes tail and then re-checks head -- and the writer publishes head and then checks tail --
+	//  so either this loop sees the writer's latest data or the writer sees the ring was emptied, and signals)
+	*received = 0;
+	uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+	while (true) {
+		uint64_t head = ring.head.load();
+		if (head == tail) break;
+		//(the other process writes head -- and could write tail -- so a writer more than a ring ahead is broken, or hostile)
+		if (head - tail > ShmRingSize) {
+			std::cerr << "[shm_recv] shared-memory peer on " << c.socket << " wrote an impossible ring position; disconnecting." << std::endl;
+			return false;
+		}
+		size_t size = size_t(head - tail);
+		ring_read(ring, tail, c.recv_buffer.prepare(size), size);
+		c.recv_buffer.commit(size);
+		*received += size;
+		tail = head;
+		ring.tail.store(tail);
+		if (ring.writer_waiting.exchange(0)) signal_eventfd(peer.peer_wake, syscalls);
+	}
+
+	if (ring.closed.load()) return false;
+	//a wakeup that wasn't the eventfd was the socket: see if the other side has gone away:
+	if (!woken && *received == 0) {
+		char byte;
+		ssize_t ret = recv(c.socket, &byte, 1, MSG_DONTWAIT);
+		syscalls.recv += 1;
+		if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) return false;
+	}
+	return true;
+}
+
+bool shm_send(Connection &c, SyscallCounts &syscalls) {
+	assert(c.shm);
+	ShmPeer &peer = *c.shm;
+	ShmRing &ring = *peer.out;
+	if (peer.in->closed.load()) return false;
+
+	//the latest-wins slot goes out once everything queued ahead of it has:
+	if (c.send_buffer.empty()) c.queue_latest();
+
+	uint64_t const start = ring.head.load(std::memory_order_relaxed);
+	uint64_t head = start;
+	uint64_t tail = ring.tail.load();
+	//(the other process writes tail, so a reader past head -- or more than a ring behind it -- is broken, or hostile)
+	auto impossible = [&]() {
+		if (head - tail <= ShmRingSize) return false;
+		std::cerr << "[shm_send] shared-memory peer on " << c.socket << " wrote an impossible ring position; disconnecting." << std::endl;
+		return true;
+	};
+	if (impossible()) return false;
+	while (!c.send_buffer.empty()) {
+		size_t space = size_t(ShmRingSize - (head - tail));
+		if (space == 0) {
+			//full: ask the reader to signal once it makes room (then check again, in case it just did):
+			ring.writer_waiting.store(1);
+			tail = ring.tail.load();
+			if (impossible()) return false;
+			if (head - tail == ShmRingSize) break;
+			continue;
+		}
+		size_t count = 0;
+		c.send_buffer.for_each_segment(64, [&](uint8_t const *data, size_t size) {
+			size_t step = std::min(size, space - count);
+			ring_write(ring, head + count, data, step);
+			count += step;
+		});
+		c.stats.bytes_out += count;
+		c.note_sent(count);
+		c.send_buffer.consume(count);
+		head += count;
+		if (c.send_buffer.empty()) c.queue_latest();
+	}
+
+	if (head != start) {
+		ring.head.store(head);
+		//if the reader had taken everything before this, it may be asleep:
+		if (ring.tail.load() == start) signal_eventfd(peer.peer_wake, syscalls);
+	}
+	return true;
+}
+
+void shm_close(Connection &c) {
+	assert(c.shm);
+	if (c.shm->out) {
+		c.shm->out->closed.store(1);
+		uint64_t one = 1;
+		[[maybe_unused]] ssize_t ret = write(c.shm->peer_wake, &one, sizeof(one));
+	}
+	c.shm.reset();
+	closesocket(c.socket);
+	c.socket = InvalidSocket;
+}
+
+#else //not linux
+
+ShmPeer::~ShmPeer() = default;
+
+static void shm_unsupported() {
+	throw std::runtime_error("The shared-memory transport is only available on linux.");
+}
+
+Socket shm_listen(std::string const &) {
+	shm_unsupported();
+	return InvalidSocket;
+}
+Socket shm_accept(char const *, Socket, SyscallCounts &) {
+	return InvalidSocket;
+}
+ShmSetup shm_finish_accept(char const *, Connection &, SyscallCounts &) {
+	return ShmSetup::Failed;
+}
+void shm_connect(std::string const &, Connection *, SyscallCounts &) {
+	shm_unsupported();
+}
+void shm_watch(int, Connection &, bool, SyscallCounts &) {
+	shm_unsupported();
+}
+bool shm_recv(Connection &, size_t *, SyscallCounts &) {
+	return false;
+}
+bool shm_send(Connection &, SyscallCounts &) {
+	return false;
+}
+void shm_close(Connection &c) {
+	c.shm.reset();
+	closesocket(c.socket);
+	c.socket = InvalidSocket;
+}
+
+#endif //__linux__
@@ -0,0 +1,102 @@
+#pragma once
+
+/*
+ * Shared-memory transport for a Server and Clients on the same machine.
+ *
+ * This is an internal header used by the Connection implementation; code using
+ *  Server/Client shouldn't need to include it. (A Server accepts these connections
+ *  when given ListenSettings::shm_name; a Client makes one when its host is "shm:<name>".)
+ *
+ * Each connection is a pair of single-producer single-consumer byte rings (one
+ *  per direction) in a shared memory segment. Bytes are copied straight from the
+ *  sender's send_buffer into a ring and from there into the receiver's recv_buffer,
+ *  without going through the network stack. The byte stream is the same as over
+ *  TCP, so everything above the transport works unchanged.
+ *
+ * Setup: the server listens on a unix-domain socket named for the shm name (in
+ *  linux's abstract namespace, so nothing is left behind on the filesystem). A
+ *  client connects to it, creates the segment (a memfd) and two eventfds, and
+ *  passes all three over the socket. The server doesn't wait for them: an
+ *  accepted socket is watched like any other until they arrive (or it gives up
+ *  on it), so a client that connects and sends nothing can't hold up the rest.
+ *  The socket then stays open -- unused -- so each side notices if the other
+ *  goes away, even without closing cleanly.
+ *
+ * Wakeups: each side waits on its own eventfd, which (unlike a futex) can sit in
+ *  the same epoll set as the rest of a Server's or Client's sockets. A writer
+ *  signals only if the reader had emptied the ring (and so may be asleep), and a
+ *  reader signals only if the writer is waiting for space, so a busy connection
+ *  needs few system calls.
+ *
+ * Linux only (memfd, eventfd, abstract unix sockets); elsewhere, using it throws.
+ *
+ */
+
+#include "Connection.hpp"
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+struct ShmRing;
+
+//per-connection state for shared-memory connections:
+// (the connection's socket is the unix-domain socket it was set up over)
+struct ShmPeer {
+	ShmPeer() = default;
+	~ShmPeer(); //unmaps the segment and closes the eventfds
+	ShmPeer(ShmPeer const &) = delete;
+	ShmPeer &operator=(ShmPeer const &) = delete;
+
+	void *segment = nullptr; //(mapped)
+	size_t segment_size = 0;
+	ShmRing *in = nullptr; //ring this side reads
+	ShmRing *out = nullptr; //ring this side writes
+	int wake = -1; //eventfd this side waits on (the other side signals it)
+	int peer_wake = -1; //eventfd the other side waits on
+
+	//(Server) until the segment arrives (i.e., while segment is nullptr), the connection is dropped if it isn't here by:
+	std::chrono::steady_clock::time_point setup_deadline;
+};
+
+//(Server) how long a client gets to send its segment after connecting:
+constexpr std::chrono::milliseconds ShmSetupTimeout(1000);
+
+//if 'address' is a shared-memory address ("shm:<name>"), returns true (and sets *name, if given):
+bool shm_address(std::string const &address, std::string *name = nullptr);
+
+//create a (non-blocking) socket listening for shared-memory connections under 'name', for a Server:
+Socket shm_listen(std::string const &name);
+
+//(Server) accept a waiting connection from 'listen_socket':
+// returns its (non-blocking) socket, or InvalidSocket if none are waiting
+// (the connection is usable once shm_finish_accept() has its segment)
+Socket shm_accept(char const *where, Socket listen_socket, SyscallCounts &syscalls);
+
+//(Server) take an accepted connection's segment and eventfds, if the client has sent them:
+// (call when its socket is readable; never blocks)
+// on Ready, connection.shm is set up; on Failed, the connection should be closed
+enum class ShmSetup {
+	Waiting, //nothing yet
+	Ready,
+	Failed, //the client went away, or sent something unusable
+};
+ShmSetup shm_finish_accept(char const *where, Connection &connection, SyscallCounts &syscalls);
+
+//(Client) connect to the Server listening under 'name' (throws on failure):
+void shm_connect(std::string const &name, Connection *connection, SyscallCounts &syscalls);
+
+//(linux) add a connection's socket and eventfd to an epoll instance, or remove them:
+// (an added connection is woken right away, so data already in its ring is read by the next poll)
+void shm_watch(int epoll_fd, Connection &connection, bool add, SyscallCounts &syscalls);
+
+//append everything in the connection's incoming ring to its recv_buffer:
+// sets *received to the number of bytes appended; returns false if the other side has gone away
+bool shm_recv(Connection &connection, size_t *received, SyscallCounts &syscalls);
+
+//move as much of the connection's send_buffer (and then its latest-wins slot) into its outgoing ring as fits:
+// returns false if the other side has gone away
+bool shm_send(Connection &connection, SyscallCounts &syscalls);
+
+//called when a connection is closed (tells the other side, then closes the socket and frees the segment):
+void shm_close(Connection &connection);
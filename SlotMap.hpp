@@ -0,0 +1,185 @@
+#pragma once
+
+/*
+ * A pool of objects named by generation-checked integer handles.
+ *
+ * Items live in slots, which are stored in fixed-size chunks: an item never
+ *  moves once added (so pointers to it stay good until it is erased), and
+ *  neighbouring items are neighbours in memory, so walking the pool touches a
+ *  few contiguous arrays rather than chasing list nodes. Erased slots are
+ *  reused (most recently freed first) before any new chunk is allocated.
+ *
+ * A handle is a slot index plus the slot's generation, which is bumped every
+ *  time the slot is erased: a handle to an erased item is recognized as stale
+ *  even after its slot has been reused. Handles are plain values, so they can
+ *  be passed between threads (e.g., in queues) where pointers would dangle.
+ *
+ * Data about each item can be kept outside the pool -- indexed by slot rather
+ *  than hashed by pointer -- with SlotData.
+ *
+ */
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+struct SlotHandle {
+	uint32_t index = ~0u;
+	uint32_t generation = 0;
+
+	explicit operator bool() const { return index != ~0u; }
+	bool operator==(SlotHandle const &o) const { return index == o.index && generation == o.generation; }
+	bool operator!=(SlotHandle const &o) const { return !(*this == o); }
+};
+
+template< typename T, size_t ChunkSize = 64 >
+struct SlotMap {
+	static_assert(ChunkSize > 0, "chunks must hold at least one slot");
+
+	SlotMap() = default;
+	SlotMap(SlotMap const &) = delete;
+	SlotMap &operator=(SlotMap const &) = delete;
+
+	//add a (default-constructed) item and return its handle:
+	SlotHandle emplace() {
+		uint32_t index;
+		if (!free.empty()) {
+			index = free.back();
+			free.pop_back();
+		} else {
+			if (slot_count % ChunkSize == 0) chunks.emplace_back(std::make_unique< Slot[] >(ChunkSize));
+			index = slot_count++;
+		}
+		Slot &slot = at(index);
+		assert(!slot.item);
+		slot.item.emplace();
+		live += 1;
+		return SlotHandle{index, slot.generation};
+	}
+
+	//remove an item (its handle, and any copies, become stale):
+	void erase(SlotHandle handle) {
+		assert(get(handle));
+		Slot &slot = at(handle.index);
+		slot.item.reset();
+		slot.generation += 1;
+		free.emplace_back(handle.index);
+		live -= 1;
+	}
+
+	//the item named by 'handle', or nullptr if it has been erased:
+	T *get(SlotHandle handle) {
+		if (handle.index >= slot_count) return nullptr;
+		Slot &slot = at(handle.index);
+		return (slot.item && slot.generation == handle.generation ? &*slot.item : nullptr);
+	}
+	T const *get(SlotHandle handle) const { return const_cast< SlotMap * >(this)->get(handle); }
+
+	//the item named by 'handle' (which must not be stale):
+	T &operator[](SlotHandle handle) {
+		T *item = get(handle);
+		assert(item);
+		return *item;
+	}
+
+	//handle of the item in slot 'index' (which must hold one):
+	SlotHandle handle(uint32_t index) const {
+		assert(index < slot_count && at(index).item);
+		return SlotHandle{index, at(index).generation};
+	}
+
+	size_t size() const { return live; } //items
+	bool empty() const { return live == 0; }
+	uint32_t slots() const { return slot_count; } //slot indices are all below this
+
+	//visit items in slot order (erasing the current item while iterating is fine):
+	template< typename Map, typename Item >
+	struct Iterator {
+		Map *map;
+		uint32_t index;
+		Item &operator*() const { return *map->at(index).item; }
+		Item *operator->() const { return &*map->at(index).item; }
+		SlotHandle handle() const { return map->handle(index); }
+		Iterator &operator++() {
+			index += 1;
+			skip();
+			return *this;
+		}
+		bool operator==(Iterator const &o) const { return index == o.index; }
+		bool operator!=(Iterator const &o) const { return index != o.index; }
+		void skip() {
+			while (index < map->slot_count && !map->at(index).item) index += 1;
+		}
+	};
+	typedef Iterator< SlotMap, T > iterator;
+	typedef Iterator< SlotMap const, T const > const_iterator;
+
+	iterator begin() { iterator it{this, 0}; it.skip(); return it; }
+	iterator end() { return iterator{this, slot_count}; }
+	const_iterator begin() const { const_iterator it{this, 0}; it.skip(); return it; }
+	const_iterator end() const { return const_iterator{this, slot_count}; }
+
+private:
+	struct Slot {
+		std::optional< T > item;
+		uint32_t generation = 0;
+	};
+	Slot &at(uint32_t index) { return chunks[index / ChunkSize][index % ChunkSize]; }
+	Slot const &at(uint32_t index) const { return chunks[index / ChunkSize][index % ChunkSize]; }
+
+	std::vector< std::unique_ptr< Slot[] > > chunks; //(never freed or moved, so items stay put)
+	uint32_t slot_count = 0; //slots handed out so far
+	size_t live = 0;
+	std::vector< uint32_t > free; //erased slots, to be reused
+};
+
+//a value for (some of) a SlotMap's items, stored by slot index:
+// each value remembers the handle it was set for, so it is never mistaken for the value of a later item in the same slot.
+template< typename V >
+struct SlotData {
+	//the value for 'handle', or nullptr if none has been set (or it was set for an earlier item in the slot):
+	V *get(SlotHandle handle) {
+		if (handle.index >= entries.size() || entries[handle.index].handle != handle) return nullptr;
+		return &entries[handle.index].value;
+	}
+
+	//set the value for 'handle' (replacing any value in its slot):
+	V &set(SlotHandle handle, V &&value) {
+		assert(handle);
+		if (handle.index >= entries.size()) entries.resize(handle.index + 1);
+		Entry &entry = entries[handle.index];
+		if (!entry.handle) live += 1;
+		entry.handle = handle;
+		entry.value = std::move(value);
+		return entry.value;
+	}
+
+	//forget the value for 'handle' (if there is one):
+	void erase(SlotHandle handle) {
+		if (!get(handle)) return;
+		entries[handle.index] = Entry();
+		live -= 1;
+	}
+
+	size_t size() const { return live; }
+
+	//call fn(handle, value) for each value, in slot order:
+	template< typename F >
+	void for_each(F const &fn) {
+		for (Entry &entry : entries) {
+			if (entry.handle) fn(entry.handle, entry.value);
+		}
+	}
+
+private:
+	struct Entry {
+		SlotHandle handle; //(invalid if no value)
+		V value = V();
+	};
+	std::vector< Entry > entries; //by slot index
+	size_t live = 0;
+};
@@ -0,0 +1,64 @@
+#include "TickScheduler.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <thread>
+
+//poll timeouts (epoll_wait, select) are only accurate to about a millisecond:
+static constexpr double PollGranularity = 0.001;
+
+TickScheduler::TickScheduler(Settings const &settings_) : settings(settings_) {
+	assert(settings.tick > 0.0);
+	assert(settings.max_catch_up >= 1);
+	start = Clock::now();
+	next_tick = start + std::chrono::duration_cast< Clock::duration >(std::chrono::duration< double >(settings.tick));
+	ticks_run = 1;
+}
+
+uint32_t TickScheduler::wait(std::function< void(double) > const &poll) {
+	auto seconds_until = [](Clock::time_point when) {
+		return std::chrono::duration< double >(when - Clock::now()).count();
+	};
+	auto time_before = [&](double seconds) {
+		return next_tick - std::chrono::duration_cast< Clock::duration >(std::chrono::duration< double >(seconds));
+	};
+
+	//poll for I/O until close to the tick:
+	while (true) {
+		double remain = seconds_until(next_tick) - settings.spin_tail - PollGranularity;
+		if (remain <= 0.0) break;
+		poll(remain);
+	}
+
+	//sleep until the spin tail:
+	if (seconds_until(next_tick) > settings.spin_tail) {
+		std::this_thread::sleep_until(time_before(settings.spin_tail));
+	}
+
+	//spin the rest of the way:
+	while (Clock::now() < next_tick) {
+		std::this_thread::yield();
+	}
+
+	//how late is this tick, and how many more are due?
+	double late = -seconds_until(next_tick);
+	start_jitter.add(late);
+	uint64_t due = 1 + uint64_t(std::floor(late / settings.tick));
+	uint32_t run = uint32_t(std::min< uint64_t >(due, settings.max_catch_up));
+	skipped_ticks += due - run;
+
+	//(tick times are computed from the start time rather than accumulated, so rounding doesn't drift)
+	ticks_run += due;
+	next_tick = start + std::chrono::duration_cast< Clock::duration >(std::chrono::duration< double >(settings.tick * double(ticks_run)));
+
+	return run;
+}
+
+void TickScheduler::begin_tick() {
+	tick_began = Clock::now();
+}
+
+void TickScheduler::end_tick() {
+	tick_duration.add(std::chrono::duration< double >(Clock::now() - tick_began).count());
+}
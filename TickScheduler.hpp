@@ -0,0 +1,62 @@
+#pragma once
+
+/*
+ * Fixed-timestep scheduler for the server's tick loop.
+ *
+ * Tick start times are multiples of the tick length after the start time, so
+ *  they don't drift however long each wait or tick takes. Waiting happens in
+ *  three stages:
+ *   - the caller's poll function (e.g., Server::poll) handles network I/O for
+ *     most of the wait; since poll timeouts are only millisecond-accurate, it
+ *     is asked to return a little early,
+ *   - then the thread sleeps until just before the tick (sleep_until),
+ *   - then (if spin_tail > 0) it busy-waits for the final stretch, trading a
+ *     little CPU for sub-millisecond accuracy.
+ *
+ * If ticks overrun (or the process stalls), up to max_catch_up ticks are run
+ *  back-to-back to catch up; beyond that, the missed ticks are skipped (and
+ *  counted) rather than making the simulation race to catch up.
+ *
+ * Tick start jitter (how late each tick started) and tick durations are
+ *  recorded in histograms for telemetry.
+ *
+ */
+
+#include "Histogram.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+struct TickScheduler {
+	typedef std::chrono::steady_clock Clock;
+
+	struct Settings {
+		double tick = 1.0 / 30.0; //seconds per tick
+		uint32_t max_catch_up = 5; //most ticks to run back-to-back after falling behind
+		double spin_tail = 0.0; //seconds at the end of each wait to busy-wait for
+	};
+
+	TickScheduler(Settings const &settings);
+
+	//wait until the next tick is due, calling 'poll(timeout)' to wait for (most of) the time:
+	// returns the number of ticks to run now (at least one; more if catching up)
+	uint32_t wait(std::function< void(double) > const &poll);
+
+	//call around the work done for each tick (to measure tick durations):
+	void begin_tick();
+	void end_tick();
+
+	Settings settings;
+
+	//telemetry (cleared by whoever reports it):
+	Histogram start_jitter; //how late each tick started, in seconds
+	Histogram tick_duration; //time between begin_tick() and end_tick(), in seconds
+	uint64_t skipped_ticks = 0; //ticks dropped because the loop fell too far behind
+
+private:
+	Clock::time_point next_tick; //when the next tick is due
+	Clock::time_point tick_began;
+	uint64_t ticks_run = 0;
+	Clock::time_point start;
+};
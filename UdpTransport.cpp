@@ -0,0 +1,637 @@
+#include "sockets.hpp"
+
+#include "UdpTransport.hpp"
+#include "little_endian.hpp"
+
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <system_error>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
+
+//packet kinds:
+enum : uint8_t {
+	PacketConnect = 1,
+	PacketAccept = 2,
+	PacketData = 3,
+	PacketDisconnect = 4,
+};
+
+//message channels:
+enum : uint8_t {
+	ChannelUnreliable = 0,
+	ChannelReliable = 1,
+};
+
+//header sizes:
+constexpr size_t PacketHeaderSize = 1 + 4; //kind, token
+constexpr size_t DataHeaderSize = PacketHeaderSize + 2 + 2 + 4; //seq, ack, ack_bits
+constexpr size_t MessageHeaderSize = 1 + 2 + 2; //channel, id, length
+static_assert(DataHeaderSize + MessageHeaderSize + UdpMaxMessageSize <= UdpMaxPacketSize, "messages fit in packets");
+
+//limit on reliable messages in flight (keeps ids unambiguous and memory bounded):
+constexpr size_t MaxReliableInFlight = 1024;
+//limit on packets sent per connection per service (bounds bursts):
+constexpr uint32_t MaxPacketsPerService = 32;
+
+//is sequence number 'a' newer than 'b' (allowing for wrap-around)?
+static bool seq_greater(uint16_t a, uint16_t b) {
+	return a != b && uint16_t(a - b) < 0x8000;
+}
+
+static void set_nonblocking(Socket s) {
+	#ifdef _WIN32
+	unsigned long one = 1;
+	if (0 != ioctlsocket(s, FIONBIO, &one)) {
+		throw std::runtime_error("failed to make UDP socket non-blocking");
+	}
+	#else
+	int flags = fcntl(s, F_GETFL, 0);
+	if (flags < 0 || fcntl(s, F_SETFL, flags | O_NONBLOCK) < 0) {
+		throw std::system_error(errno, std::system_category(), "failed to make UDP socket non-blocking");
+	}
+	#endif
+}
+
+//send a packet to a peer (drops the packet if the socket buffer is full -- it's UDP, after all):
+static void send_packet(UdpPeer &peer, std::vector< uint8_t > const &packet, SyscallCounts &syscalls) {
+	ssize_t ret;
+	if (peer.address.empty()) {
+		//(client socket is connected)
+		ret = ::send(peer.socket, reinterpret_cast< char const * >(packet.data()), int(packet.size()), 0);
+	} else {
+		ret = ::sendto(peer.socket, reinterpret_cast< char const * >(packet.data()), int(packet.size()), 0,
+			reinterpret_cast< struct sockaddr const * >(peer.address.data()), socklen_t(peer.address.size()));
+	}
+	syscalls.send += 1;
+	if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+		std::cerr << "[UDP] send failed: " << strerror(errno) << std::endl;
+	}
+	peer.last_send = UdpPeer::Clock::now();
+}
+
+static std::vector< uint8_t > control_packet(uint8_t kind, uint32_t token) {
+	std::vector< uint8_t > packet;
+	put_u8(packet, kind);
+	put_u32(packet, token);
+	return packet;
+}
+
+//wait up to 'timeout' seconds for 'socket' to become readable:
+static void wait_readable(Socket socket, double timeout, SyscallCounts &syscalls) {
+	fd_set read_fds;
+	FD_ZERO(&read_fds);
+	FD_SET(socket, &read_fds);
+	struct timeval tv;
+	timeout = std::max(0.0, timeout);
+	tv.tv_sec = std::lround(std::floor(timeout));
+	tv.tv_usec = std::lround((timeout - std::floor(timeout)) * 1e6);
+	select(int(socket) + 1, &read_fds, NULL, NULL, &tv);
+	syscalls.wait += 1;
+}
+
+//---------------------------------
+
+Socket udp_bind(std::string const &port) {
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	struct addrinfo *res = nullptr;
+	int addrinfo_ret = getaddrinfo(NULL, port.c_str(), &hints, &res);
+	if (addrinfo_ret != 0) {
+		throw std::runtime_error("getaddrinfo error: " + std::string(gai_strerror(addrinfo_ret)));
+	}
+
+	Socket bound = InvalidSocket;
+	std::cout << "[udp_bind] binding to " << port << " (UDP):" << std::endl;
+	for (struct addrinfo *info = res; info != nullptr; info = info->ai_next) {
+		Socket s = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+		if (s == InvalidSocket) {
+			std::cout << "\t(failed to create socket: " << strerror(errno) << ")" << std::endl;
+			continue;
+		}
+		if (bind(s, info->ai_addr, int(info->ai_addrlen)) < 0) {
+			std::cout << "\t(failed to bind: " << strerror(errno) << ")" << std::endl;
+			closesocket(s);
+			continue;
+		}
+		std::cout << "\tsuccess!" << std::endl;
+		bound = s;
+		break;
+	}
+	freeaddrinfo(res);
+
+	if (bound == InvalidSocket) {
+		throw std::runtime_error("Failed to bind to UDP port " + port);
+	}
+	set_nonblocking(bound);
+	return bound;
+}
+
+void udp_connect(std::string const &host, std::string const &port, Connection *connection_, SyscallCounts &syscalls) {
+	assert(connection_);
+	Connection &connection = *connection_;
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_protocol = IPPROTO_UDP;
+
+	struct addrinfo *res = nullptr;
+	int addrinfo_ret = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+	if (addrinfo_ret != 0) {
+		throw std::runtime_error("getaddrinfo error: " + std::string(gai_strerror(addrinfo_ret)));
+	}
+
+	//token identifies this connection to the server:
+	uint32_t token = std::random_device()();
+
+	//number of handshake attempts per address, and time between them:
+	constexpr uint32_t Attempts = 10;
+	constexpr double AttemptInterval = 0.25;
+
+	std::cout << "[udp_connect] connecting to " << host << ":" << port << " (UDP):" << std::endl;
+	for (struct addrinfo *info = res; info != nullptr && !connection; info = info->ai_next) {
+		Socket s = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+		if (s == InvalidSocket) {
+			std::cout << "\t(failed to create socket: " << strerror(errno) << ")" << std::endl;
+			continue;
+		}
+		//a connected UDP socket only sends to / receives from the server:
+		if (connect(s, info->ai_addr, int(info->ai_addrlen)) < 0) {
+			std::cout << "\t(failed to connect: " << strerror(errno) << ")" << std::endl;
+			closesocket(s);
+			continue;
+		}
+		set_nonblocking(s);
+
+		auto peer = std::make_unique< UdpPeer >();
+		peer->socket = s;
+		peer->owns_socket = true;
+		peer->token = token;
+
+		bool accepted = false;
+		std::vector< uint8_t > connect_packet = control_packet(PacketConnect, token);
+		for (uint32_t attempt = 0; attempt < Attempts && !accepted; ++attempt) {
+			send_packet(*peer, connect_packet, syscalls);
+			wait_readable(s, AttemptInterval, syscalls);
+			uint8_t buffer[UdpMaxPacketSize];
+			while (true) {
+				ssize_t ret = recv(s, reinterpret_cast< char * >(buffer), int(sizeof(buffer)), 0);
+				syscalls.recv += 1;
+				if (ret < 0) break;
+				if (size_t(ret) == PacketHeaderSize && buffer[0] == PacketAccept && get_u32(buffer + 1) == token) {
+					accepted = true;
+					break;
+				}
+			}
+		}
+		if (!accepted) {
+			std::cout << "\t(no response)" << std::endl;
+			closesocket(s);
+			continue;
+		}
+		std::cout << "\tsuccess!" << std::endl;
+
+		peer->last_recv = peer->last_send = UdpPeer::Clock::now();
+		connection.socket = s;
+		connection.udp = std::move(peer);
+	}
+	freeaddrinfo(res);
+
+	if (!connection) {
+		throw std::runtime_error("Failed to connect to any of the addresses tried for server (UDP).");
+	}
+}
+
+void udp_close(Connection &connection) {
+	assert(connection.udp);
+	UdpPeer &peer = *connection.udp;
+	if (peer.socket == InvalidSocket) return;
+
+	//let the other side know (twice, in case one packet is lost):
+	SyscallCounts ignored;
+	std::vector< uint8_t > packet = control_packet(PacketDisconnect, peer.token);
+	send_packet(peer, packet, ignored);
+	send_packet(peer, packet, ignored);
+
+	if (peer.owns_socket) {
+		::closesocket(peer.socket);
+	}
+	peer.socket = InvalidSocket;
+}
+
+void udp_forget(UdpEndpoint &endpoint, Connection &connection) {
+	assert(connection.udp);
+	auto f = endpoint.peers.find(connection.udp->address);
+	if (f != endpoint.peers.end() && f->second == &connection) {
+		endpoint.peers.erase(f);
+	}
+}
+
+//---------------------------------
+
+//handle a data packet from a peer:
+// (returns false if the connection was closed)
+static bool handle_data(
+	char const *where,
+	Connection &c,
+	uint8_t const *data, size_t size,
+	std::function< void(Connection *, Connection::Event event) > const &on_event) {
+
+	assert(c.udp);
+	UdpPeer &peer = *c.udp;
+	auto now = UdpPeer::Clock::now();
+
+	auto malformed = [&](char const *why) {
+		std::cerr << "[" << where << "] malformed packet (" << why << "), disconnecting." << std::endl;
+		c.close();
+		if (on_event) on_event(&c, Connection::OnClose);
+		return false;
+	};
+
+	if (size < DataHeaderSize) return malformed("short header");
+	uint16_t seq = get_u16(data + PacketHeaderSize);
+	uint16_t ack = get_u16(data + PacketHeaderSize + 2);
+	uint32_t ack_bits = get_u32(data + PacketHeaderSize + 4);
+
+	peer.last_recv = now;
+	c.stats.bytes_in += size;
+	//packets carrying messages are acknowledged promptly; empty ones just wait for the next packet:
+	// (otherwise the two sides would trade acks of acks forever)
+	if (size > DataHeaderSize) peer.ack_owed = true;
+
+	{ //note that 'seq' was received:
+		if (!peer.received_any) {
+			peer.received_any = true;
+			peer.remote_seq = seq;
+			peer.remote_ack_bits = 0;
+		} else if (seq_greater(seq, peer.remote_seq)) {
+			uint16_t diff = uint16_t(seq - peer.remote_seq);
+			if (diff < 32) peer.remote_ack_bits = (peer.remote_ack_bits << diff) | (1u << (diff - 1));
+			else if (diff == 32) peer.remote_ack_bits = (1u << 31);
+			else peer.remote_ack_bits = 0;
+			peer.remote_seq = seq;
+		} else if (seq != peer.remote_seq) {
+			uint16_t diff = uint16_t(peer.remote_seq - seq);
+			if (diff <= 32) peer.remote_ack_bits |= (1u << (diff - 1));
+		}
+	}
+
+	{ //process acks of our packets:
+		for (uint32_t i = 0; i <= 32; ++i) {
+			if (i > 0 && !(ack_bits & (1u << (i - 1)))) continue;
+			uint16_t acked = uint16_t(ack - i);
+			UdpPeer::SentPacket &sent = peer.sent_packets[acked % UdpPeer::SentPacketHistory];
+			if (!sent.valid || sent.seq != acked || sent.acked) continue;
+			sent.acked = true;
+			double sample = std::chrono::duration< double >(now - sent.time).count();
+			peer.rtt += 0.1 * (sample - peer.rtt);
+			for (uint16_t id : sent.reliable_ids) {
+				if (peer.reliable_out.empty()) break;
+				uint16_t index = uint16_t(id - peer.reliable_out.front().id);
+				if (index < peer.reliable_out.size()) {
+					peer.reliable_out[index].acked = true;
+				}
+			}
+			sent.reliable_ids.clear();
+		}
+		while (!peer.reliable_out.empty() && peer.reliable_out.front().acked) {
+			peer.reliable_out.pop_front();
+		}
+	}
+
+	//deliver messages:
+	bool delivered = false;
+	auto deliver = [&](uint8_t const *message, size_t length) {
+		c.recv_buffer.append(message, length);
+		c.note_received(length);
+		delivered = true;
+	};
+
+	size_t at = DataHeaderSize;
+	while (at < size) {
+		if (size - at < MessageHeaderSize) return malformed("short message header");
+		uint8_t channel = data[at];
+		uint16_t id = get_u16(data + at + 1);
+		uint16_t length = get_u16(data + at + 3);
+		at += MessageHeaderSize;
+		if (size - at < length) return malformed("short message");
+		uint8_t const *message = data + at;
+		at += length;
+
+		//messages must be complete [type][size24][payload] frames:
+		if (length < 4) return malformed("short frame");
+		uint32_t frame_size = uint32_t(message[1]) | (uint32_t(message[2]) << 8) | (uint32_t(message[3]) << 16);
+		if (frame_size + 4 != length) return malformed("frame size mismatch");
+
+		if (channel == ChannelUnreliable) {
+			//only deliver if newer than everything delivered so far:
+			if (!peer.delivered_unreliable || seq_greater(id, peer.latest_unreliable)) {
+				peer.delivered_unreliable = true;
+				peer.latest_unreliable = id;
+				deliver(message, length);
+			}
+		} else if (channel == ChannelReliable) {
+			uint16_t ahead = uint16_t(id - peer.next_deliver_id);
+			if (ahead == 0) {
+				deliver(message, length);
+				peer.next_deliver_id += 1;
+				//deliver any messages that were waiting on this one:
+				for (auto f = peer.reliable_in.find(peer.next_deliver_id); f != peer.reliable_in.end(); f = peer.reliable_in.find(peer.next_deliver_id)) {
+					deliver(f->second.data(), f->second.size());
+					peer.reliable_in.erase(f);
+					peer.next_deliver_id += 1;
+				}
+			} else if (ahead < MaxReliableInFlight) {
+				peer.reliable_in.emplace(id, std::vector< uint8_t >(message, message + length));
+			} else {
+				//(an old, already-delivered message that was resent)
+			}
+		} else {
+			return malformed("unknown channel");
+		}
+	}
+
+	if (delivered && on_event) {
+		on_event(&c, Connection::OnRecv);
+		c.note_parsed();
+		if (!c) return false;
+	}
+	return true;
+}
+
+//move queued messages from send_buffer to channels, then send packets as needed:
+// (returns false if the connection was closed)
+static bool service_peer(
+	char const *where,
+	Connection &c,
+	std::vector< uint8_t > const &unreliable_messages,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	SyscallCounts &syscalls) {
+
+	assert(c.udp);
+	UdpPeer &peer = *c.udp;
+	auto now = UdpPeer::Clock::now();
+
+	if (std::chrono::duration< double >(now - peer.last_recv).count() > UdpTimeout) {
+		std::cerr << "[" << where << "] connection timed out, disconnecting." << std::endl;
+		c.close();
+		if (on_event) on_event(&c, Connection::OnClose);
+		return false;
+	}
+
+	//the latest-wins slot goes out once everything queued ahead of it has:
+	if (c.send_buffer.empty()) c.queue_latest();
+
+	c.stats.send_queue_high_water = std::max(c.stats.send_queue_high_water, c.send_buffer.size());
+
+	//split send_buffer into messages:
+	while (c.send_buffer.size() >= 4 && peer.reliable_out.size() < MaxReliableInFlight) {
+		uint8_t header[4];
+		c.send_buffer.peek(header, 4);
+		size_t length = 4 + (uint32_t(header[1]) | (uint32_t(header[2]) << 8) | (uint32_t(header[3]) << 16));
+		if (c.send_buffer.size() < length) break; //(message not completely queued yet)
+
+		bool unreliable = std::find(unreliable_messages.begin(), unreliable_messages.end(), header[0]) != unreliable_messages.end();
+		if (length > UdpMaxMessageSize) {
+			c.send_buffer.consume(length);
+			if (unreliable) {
+				std::cerr << "[" << where << "] dropping " << length << "-byte message (too large for UDP transport)." << std::endl;
+				continue;
+			}
+			std::cerr << "[" << where << "] " << length << "-byte message is too large for UDP transport, disconnecting." << std::endl;
+			c.close();
+			if (on_event) on_event(&c, Connection::OnClose);
+			return false;
+		}
+
+		std::vector< uint8_t > bytes(length);
+		c.send_buffer.peek(bytes.data(), length);
+		c.send_buffer.consume(length);
+		c.stats.messages_out += 1;
+		if (unreliable) {
+			peer.unreliable_out.emplace_back(std::move(bytes));
+		} else {
+			peer.reliable_out.emplace_back();
+			peer.reliable_out.back().id = peer.next_reliable_id++;
+			peer.reliable_out.back().bytes = std::move(bytes);
+		}
+		if (c.send_buffer.empty()) c.queue_latest();
+	}
+
+	//(messages wait in send_buffer while too many reliable messages are unacknowledged)
+	if (c.send_buffer.size() > c.send_limit) {
+		std::cerr << "[" << where << "] " << c.send_buffer.size() << " bytes waiting to be sent (limit " << c.send_limit << "), disconnecting." << std::endl;
+		c.stats.overflows += 1;
+		c.close();
+		if (on_event) on_event(&c, Connection::OnClose);
+		return false;
+	}
+
+	//unacknowledged reliable messages are resent after a bit longer than a round trip:
+	double resend_interval = std::clamp(2.0 * peer.rtt, 0.05, 1.0);
+
+	size_t reliable_at = 0; //next reliable message to consider sending
+	auto reliable_due = [&](UdpPeer::ReliableMessage const &m) {
+		return !m.acked && (!m.sent || std::chrono::duration< double >(now - m.last_sent).count() >= resend_interval);
+	};
+
+	static thread_local std::vector< uint8_t > packet;
+	for (uint32_t count = 0; count < MaxPacketsPerService; ++count) {
+		uint16_t seq = peer.next_seq;
+		UdpPeer::SentPacket &sent = peer.sent_packets[seq % UdpPeer::SentPacketHistory];
+		sent.reliable_ids.clear();
+
+		packet.clear();
+		put_u8(packet, PacketData);
+		put_u32(packet, peer.token);
+		put_u16(packet, seq);
+		put_u16(packet, peer.remote_seq);
+		put_u32(packet, peer.remote_ack_bits);
+
+		auto fits = [&](size_t length) {
+			return packet.size() + MessageHeaderSize + length <= UdpMaxPacketSize;
+		};
+
+		bool more = false; //are there messages left over for another packet?
+
+		//newest-wins messages go first:
+		while (!peer.unreliable_out.empty() && fits(peer.unreliable_out.front().size())) {
+			auto const &bytes = peer.unreliable_out.front();
+			put_u8(packet, ChannelUnreliable);
+			put_u16(packet, peer.next_unreliable_id++);
+			put_u16(packet, uint16_t(bytes.size()));
+			packet.insert(packet.end(), bytes.begin(), bytes.end());
+			peer.unreliable_out.pop_front();
+		}
+		if (!peer.unreliable_out.empty()) more = true;
+
+		//then reliable messages that are due to be (re-)sent:
+		for (; reliable_at < peer.reliable_out.size(); ++reliable_at) {
+			auto &m = peer.reliable_out[reliable_at];
+			if (!reliable_due(m)) continue;
+			if (!fits(m.bytes.size())) {
+				more = true;
+				break;
+			}
+			put_u8(packet, ChannelReliable);
+			put_u16(packet, m.id);
+			put_u16(packet, uint16_t(m.bytes.size()));
+			packet.insert(packet.end(), m.bytes.begin(), m.bytes.end());
+			m.sent = true;
+			m.last_sent = now;
+			sent.reliable_ids.emplace_back(m.id);
+		}
+
+		bool has_messages = (packet.size() > DataHeaderSize);
+		bool keepalive_due = std::chrono::duration< double >(now - peer.last_send).count() >= UdpKeepaliveInterval;
+		if (!has_messages && !peer.ack_owed && !keepalive_due) break;
+
+		sent.seq = seq;
+		sent.valid = true;
+		sent.acked = false;
+		sent.time = now;
+		peer.next_seq += 1;
+		peer.ack_owed = false;
+		send_packet(peer, packet, syscalls);
+		c.stats.bytes_out += packet.size();
+
+		if (!more) break;
+	}
+
+	return true;
+}
+
+//receive and handle all waiting packets:
+static void receive_packets(
+	char const *where,
+	UdpEndpoint &endpoint,
+	Connections &connections,
+	std::vector< Connection * > &pending,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	SyscallCounts &syscalls) {
+
+	uint8_t buffer[UdpMaxPacketSize];
+	while (true) {
+		struct sockaddr_storage from;
+		socklen_t from_len = sizeof(from);
+		ssize_t ret = recvfrom(endpoint.socket, reinterpret_cast< char * >(buffer), int(sizeof(buffer)), 0,
+			reinterpret_cast< struct sockaddr * >(&from), &from_len);
+		syscalls.recv += 1;
+		if (ret < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED) {
+				std::cerr << "[" << where << "] recvfrom() returned error " << errno << "(" << strerror(errno) << ")." << std::endl;
+			}
+			return;
+		}
+		size_t size = size_t(ret);
+		if (size < PacketHeaderSize) continue; //(not one of our packets)
+		uint8_t kind = buffer[0];
+		uint32_t token = get_u32(buffer + 1);
+
+		Connection *c = nullptr;
+		if (endpoint.is_server) {
+			std::string address(reinterpret_cast< char const * >(&from), from_len);
+			auto f = endpoint.peers.find(address);
+			if (f == endpoint.peers.end()) {
+				if (kind != PacketConnect) continue;
+				//new connection:
+				c = &add_connection(connections);
+				c->socket = endpoint.socket;
+				c->pending = &pending;
+				c->udp = std::make_unique< UdpPeer >();
+				c->udp->socket = endpoint.socket;
+				c->udp->address = address;
+				c->udp->token = token;
+				c->udp->last_recv = c->udp->last_send = UdpPeer::Clock::now();
+				endpoint.peers.emplace(address, c);
+				std::cerr << "[" << where << "] client connected (UDP)." << std::endl; //INFO
+				send_packet(*c->udp, control_packet(PacketAccept, token), syscalls);
+				if (on_event) on_event(c, Connection::OnOpen);
+				continue;
+			}
+			c = f->second;
+		} else {
+			assert(connections.size() == 1);
+			c = &*connections.begin();
+		}
+
+		if (!*c || !c->udp || c->udp->token != token) continue;
+
+		if (kind == PacketConnect) {
+			//(client didn't get our accept)
+			c->udp->last_recv = UdpPeer::Clock::now();
+			if (endpoint.is_server) send_packet(*c->udp, control_packet(PacketAccept, token), syscalls);
+		} else if (kind == PacketAccept) {
+			//(duplicate accept)
+		} else if (kind == PacketDisconnect) {
+			std::cerr << "[" << where << "] other side disconnected." << std::endl;
+			c->close();
+			if (on_event) on_event(c, Connection::OnClose);
+		} else if (kind == PacketData) {
+			handle_data(where, *c, buffer, size, on_event);
+		}
+
+		//the (client's) socket may have been closed by a handler:
+		if (!endpoint.is_server && !*c) return;
+	}
+}
+
+void udp_poll(
+	char const *where,
+	UdpEndpoint &endpoint,
+	Connections &connections,
+	std::vector< Connection * > &pending,
+	std::vector< uint8_t > const &unreliable_messages,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	double timeout,
+	SyscallCounts &syscalls) {
+
+	if (!endpoint.is_server && !*connections.begin()) return; //(client connection was closed)
+
+	//data queued since the last poll can go right out:
+	udp_flush(where, endpoint, connections, pending, unreliable_messages, on_event, syscalls);
+
+	if (!endpoint.is_server && !*connections.begin()) return;
+
+	wait_readable(endpoint.socket, timeout, syscalls);
+	receive_packets(where, endpoint, connections, pending, on_event, syscalls);
+
+	//send anything queued by handlers (and acks):
+	udp_flush(where, endpoint, connections, pending, unreliable_messages, on_event, syscalls);
+}
+
+void udp_flush(
+	char const *where,
+	UdpEndpoint &endpoint,
+	Connections &connections,
+	std::vector< Connection * > &pending,
+	std::vector< uint8_t > const &unreliable_messages,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	SyscallCounts &syscalls) {
+
+	(void)endpoint;
+
+	//every connection is serviced (for timers), so the pending list isn't needed:
+	for (Connection *c : pending) {
+		c->is_pending = false;
+	}
+	pending.clear();
+
+	for (auto &c : connections) {
+		if (!c || !c.udp) continue;
+		service_peer(where, c, unreliable_messages, on_event, syscalls);
+	}
+}
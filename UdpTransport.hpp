@@ -0,0 +1,139 @@
+#pragma once
+
+/*
+ * UDP transport for Server and Client (see Transport::UDP in Connection.hpp).
+ *
+ * This is an internal header used by the Connection implementation; code using
+ *  Server/Client shouldn't need to include it.
+ *
+ * Messages queued in a Connection's send_buffer are expected to be framed as
+ *  [type][size (24 bits, little endian)][size bytes of payload] (as all the
+ *  game's messages are). Each message is sent on one of two channels:
+ *   - unreliable-sequenced (types listed in unreliable_messages): may be lost,
+ *     and older messages that arrive after newer ones are dropped.
+ *   - reliable-ordered (all other types): resent until acknowledged and
+ *     delivered in the order they were sent.
+ *  Received messages are appended (framing intact) to recv_buffer.
+ *
+ * Packet format (all integers little endian):
+ *  [kind u8][token u32]
+ *   kind Connect/Accept/Disconnect: no more data
+ *   kind Data: [seq u16][ack u16][ack_bits u32] then zero or more
+ *              [channel u8][id u16][length u16][length bytes of message]
+ *  'token' is chosen by the client when connecting; packets with the wrong
+ *   token for their source address are ignored.
+ *  'ack' is the newest packet seq received; bit i of 'ack_bits' acknowledges ack-1-i.
+ *
+ */
+
+#include "Connection.hpp"
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <string>
+#include <vector>
+
+//Packets are kept below a typical path MTU to avoid IP fragmentation:
+constexpr size_t UdpMaxPacketSize = 1200;
+//...which limits the size of a single message:
+constexpr size_t UdpMaxMessageSize = UdpMaxPacketSize - 32;
+
+//connections time out after this long without hearing from the other side:
+constexpr double UdpTimeout = 5.0;
+//empty packets are sent at least this often (to carry acks and keep connections alive):
+constexpr double UdpKeepaliveInterval = 0.1;
+
+//per-connection state for UDP connections:
+struct UdpPeer {
+	typedef std::chrono::steady_clock Clock;
+
+	Socket socket = InvalidSocket; //socket used to send (shared with other peers on the server)
+	bool owns_socket = false; //(client) close socket when the connection is closed
+	std::string address; //(server) raw sockaddr bytes of the other side
+	uint32_t token = 0;
+
+	Clock::time_point last_recv; //time the last packet was received
+	Clock::time_point last_send; //time the last packet was sent
+	bool ack_owed = false; //received messages since last sending a packet
+
+	//packet sequencing:
+	uint16_t next_seq = 0; //seq of next packet sent
+	bool received_any = false;
+	uint16_t remote_seq = 0; //newest seq received
+	uint32_t remote_ack_bits = 0; //which of the 32 seqs before remote_seq were received
+
+	//record of recently sent packets (for matching acks to reliable messages):
+	struct SentPacket {
+		uint16_t seq = 0;
+		bool valid = false;
+		bool acked = false;
+		Clock::time_point time;
+		std::vector< uint16_t > reliable_ids;
+	};
+	static constexpr size_t SentPacketHistory = 256;
+	std::vector< SentPacket > sent_packets = std::vector< SentPacket >(SentPacketHistory); //indexed by seq % SentPacketHistory
+
+	//reliable-ordered channel:
+	struct ReliableMessage {
+		uint16_t id = 0;
+		std::vector< uint8_t > bytes;
+		bool acked = false;
+		bool sent = false;
+		Clock::time_point last_sent;
+	};
+	std::deque< ReliableMessage > reliable_out; //oldest un-acknowledged first
+	uint16_t next_reliable_id = 0;
+	uint16_t next_deliver_id = 0; //next reliable id to append to recv_buffer
+	std::map< uint16_t, std::vector< uint8_t > > reliable_in; //received out of order, waiting for earlier messages
+
+	//unreliable-sequenced channel:
+	std::deque< std::vector< uint8_t > > unreliable_out; //to go in the next packet
+	uint16_t next_unreliable_id = 0;
+	bool delivered_unreliable = false;
+	uint16_t latest_unreliable = 0; //newest id delivered
+
+	//round-trip time estimate (from acks), used to time resends:
+	double rtt = 0.1;
+};
+
+//UDP state for a Server or Client:
+struct UdpEndpoint {
+	Socket socket = InvalidSocket;
+	bool is_server = false;
+	std::unordered_map< std::string, Connection * > peers; //(server) by address
+};
+
+//create a socket bound to 'port' for a Server:
+Socket udp_bind(std::string const &port);
+
+//create a socket for a Client and perform the connection handshake (throws on failure):
+void udp_connect(std::string const &host, std::string const &port, Connection *connection, SyscallCounts &syscalls);
+
+//send/receive and service timers for all connections:
+void udp_poll(
+	char const *where,
+	UdpEndpoint &endpoint,
+	Connections &connections,
+	std::vector< Connection * > &pending,
+	std::vector< uint8_t > const &unreliable_messages,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	double timeout,
+	SyscallCounts &syscalls);
+
+//send queued messages without waiting:
+void udp_flush(
+	char const *where,
+	UdpEndpoint &endpoint,
+	Connections &connections,
+	std::vector< Connection * > &pending,
+	std::vector< uint8_t > const &unreliable_messages,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	SyscallCounts &syscalls);
+
+//called when a connection is closed (tells the other side):
+void udp_close(Connection &connection);
+
+//called before a (closed) connection is discarded:
+void udp_forget(UdpEndpoint &endpoint, Connection &connection);
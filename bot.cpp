@@ -0,0 +1,497 @@
+//Headless load generator: connects many bot players to a server and measures how it copes.
+// Each bot is a separate Client sending controls at a fixed rate (following a script or
+// moving randomly) and decoding the state messages it gets back, just like a real client.
+// Reports throughput, input latency (controls sent -> state acknowledging them arrives),
+// state arrival intervals, and disconnects.
+// Also reports how fast the server takes on new connections (connection attempt -> session
+// message arrives), which -- with a high --ramp and several --connectors -- benchmarks how
+// many connections per second it can accept, e.g., in a reconnect storm after a restart.
+
+#include "Connection.hpp"
+#include "Game.hpp"
+#include "Histogram.hpp"
+#include "MessageDispatcher.hpp"
+#include "UdpTransport.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+struct Bot {
+	uint32_t index = 0;
+	std::unique_ptr< Client > client;
+	bool open = false; //(running -- though the connection may still be opening)
+	bool connected = false; //has the connection opened?
+	double connect_start = -1.0; //when the connection attempt began
+	bool joined = false; //has the session message (which is sent once the client is placed in a room) arrived?
+
+	Game game; //(decodes state messages)
+	Player::Controls controls;
+	std::mt19937 mt;
+
+	double next_send = 0.0; //time to send the next controls message
+	double next_change = 0.0; //(random pattern) time to pick new buttons
+	double last_state = -1.0; //arrival time of the previous state message
+
+	//(seq, send time) of controls the server hasn't acknowledged yet:
+	std::deque< std::pair< uint32_t, double > > unacked;
+	uint32_t next_seq = 1;
+
+	size_t leftover = 0; //bytes left in recv_buffer after the last parse (to count new bytes)
+	Histogram latency; //this bot's input latency over the whole run
+};
+
+//totals for one report interval (or for the whole run):
+struct Stats {
+	uint64_t states = 0; //state messages received
+	uint64_t hits = 0; //hit messages received
+	uint64_t controls = 0; //controls messages sent
+	uint64_t skipped_sends = 0; //controls messages not sent because this process fell behind schedule
+	uint64_t bytes_in = 0;
+	uint64_t bytes_out = 0;
+	uint64_t disconnects = 0; //connections closed by the server (or by errors)
+	uint64_t connect_failures = 0;
+	uint64_t joins = 0; //session messages received (one per bot)
+	double last_join = 0.0; //when the latest one arrived
+	Histogram join_time; //connection attempt -> session message received
+	Histogram latency; //controls sent -> state acknowledging them received
+	Histogram interval; //time between state messages on one connection
+
+	void add(Stats const &o) {
+		states += o.states;
+		hits += o.hits;
+		controls += o.controls;
+		skipped_sends += o.skipped_sends;
+		bytes_in += o.bytes_in;
+		bytes_out += o.bytes_out;
+		disconnects += o.disconnects;
+		connect_failures += o.connect_failures;
+		joins += o.joins;
+		last_join = std::max(last_join, o.last_join);
+		join_time.merge(o.join_time);
+		latency.merge(o.latency);
+		interval.merge(o.interval);
+	}
+};
+
+int main(int argc, char **argv) {
+	//------------ argument parsing ------------
+
+	auto usage = []() {
+		std::cerr << "Usage:\n\t./bot <host> <port> [--bots <count>] [--rate <hz>] [--pattern random|square|idle] [--fire-rate <shots/s>]\n"
+		             "\t                    [--ramp <bots/s>] [--connectors <threads>] [--duration <s>] [--report <s>] [--seed <n>] [--udp] [--verbose]\n"
+		             "\t--bots       number of bot connections (default: 100)\n"
+		             "\t--rate       controls messages sent per second by each bot (default: 60)\n"
+		             "\t--pattern    'random' changes buttons every 0.2-1s, 'square' walks in a square, 'idle' sends no buttons (default: random)\n"
+		             "\t--fire-rate  average shots per second fired by bots playing the gun (default: 0.5)\n"
+		             "\t--ramp       bots connected per second (default: 100)\n"
+		             "\t--connectors threads starting connections, so slow ones (e.g., UDP handshakes) don't hold up the rest (default: 1)\n"
+		             "\t--duration   seconds to run after all bots have connected; 0 runs forever (default: 30)\n"
+		             "\t--report     seconds between progress reports (default: 5)\n"
+		             "\t--seed       seed for random patterns (default: 1)\n"
+		             "\t--udp        use the UDP transport instead of TCP\n"
+		             "\t--verbose    show each connection's connect messages" << std::endl;
+	};
+
+	if (argc < 3) {
+		usage();
+		return 1;
+	}
+
+	uint32_t bot_count = 100;
+	double rate = 60.0;
+	enum { Random, Square, Idle } pattern = Random;
+	double fire_rate = 0.5;
+	double ramp = 100.0;
+	uint32_t connector_count = 1;
+	double duration = 30.0;
+	double report_interval = 5.0;
+	uint32_t seed = 1;
+	Transport transport = Transport::TCP;
+	bool verbose = false;
+	for (int argi = 3; argi < argc; ++argi) {
+		std::string arg = argv[argi];
+		bool has_value = (argi + 1 < argc);
+		if (arg == "--bots" && has_value) {
+			bot_count = uint32_t(std::max(1, std::atoi(argv[++argi])));
+		} else if (arg == "--rate" && has_value) {
+			rate = std::atof(argv[++argi]);
+		} else if (arg == "--pattern" && has_value) {
+			std::string name = argv[++argi];
+			if (name == "random") pattern = Random;
+			else if (name == "square") pattern = Square;
+			else if (name == "idle") pattern = Idle;
+			else {
+				usage();
+				return 1;
+			}
+		} else if (arg == "--fire-rate" && has_value) {
+			fire_rate = std::max(0.0, std::atof(argv[++argi]));
+		} else if (arg == "--ramp" && has_value) {
+			ramp = std::atof(argv[++argi]);
+		} else if (arg == "--connectors" && has_value) {
+			connector_count = uint32_t(std::max(1, std::atoi(argv[++argi])));
+		} else if (arg == "--duration" && has_value) {
+			duration = std::max(0.0, std::atof(argv[++argi]));
+		} else if (arg == "--report" && has_value) {
+			report_interval = std::atof(argv[++argi]);
+		} else if (arg == "--seed" && has_value) {
+			seed = uint32_t(std::atoi(argv[++argi]));
+		} else if (arg == "--udp") {
+			transport = Transport::UDP;
+		} else if (arg == "--verbose") {
+			verbose = true;
+		} else {
+			usage();
+			return 1;
+		}
+	}
+	if (!(rate > 0.0) || !(ramp > 0.0) || !(report_interval > 0.0)) {
+		usage();
+		return 1;
+	}
+
+	#ifndef _WIN32
+	{ //each bot needs a socket (and, on linux, an epoll instance), so raise the open file limit as far as allowed:
+		struct rlimit limit;
+		if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+			limit.rlim_cur = limit.rlim_max;
+			setrlimit(RLIMIT_NOFILE, &limit);
+		}
+		if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < 2 * rlim_t(bot_count) + 16) {
+			std::cerr << "NOTE: open file limit (" << limit.rlim_cur << ") may be too low for " << bot_count << " bots." << std::endl;
+		}
+	}
+	#endif
+
+	//------------ bots ------------
+
+	auto start = std::chrono::steady_clock::now();
+	auto seconds = [&start]() {
+		return std::chrono::duration< double >(std::chrono::steady_clock::now() - start).count();
+	};
+
+	std::vector< Bot > bots(bot_count);
+	for (uint32_t i = 0; i < bot_count; ++i) {
+		bots[i].index = i;
+		bots[i].mt.seed(seed * 7919u + i);
+	}
+
+	Stats interval; //since the last report
+	Stats total;
+
+	#ifdef __linux__
+	//one epoll instance watching every bot's own epoll instance (or UDP socket), so only bots with
+	// something to receive get polled:
+	int epoll_fd = epoll_create1(0);
+	if (epoll_fd < 0) throw std::system_error(errno, std::system_category(), "failed to create epoll instance");
+	#endif
+
+	//reports go to stdout; Client's constructor also describes each connection attempt there,
+	// which is a lot of output for a lot of bots, so (unless --verbose) that is discarded:
+	std::ostream out(std::cout.rdbuf());
+	if (!verbose) std::cout.rdbuf(nullptr);
+
+	//creating a Client can block (for seconds, with UDP, if the server is slow to answer handshakes), so bots'
+	// Clients are created on separate threads and handed to the main loop, keeping the measurements honest:
+	// (connector k connects bots k, k + connector_count, ...)
+	std::mutex connector_mutex; //protects connector_done:
+	std::vector< Bot * > connector_done; //bots whose connection attempt has finished
+	std::atomic< uint32_t > connectors_finished{0};
+	std::atomic< bool > quit{false};
+	std::vector< std::thread > connectors;
+	for (uint32_t k = 0; k < connector_count; ++k) {
+		connectors.emplace_back([&, k]() {
+			for (uint32_t i = k; i < bot_count; i += connector_count) {
+				if (quit) break;
+				Bot &bot = bots[i];
+				std::this_thread::sleep_until(start + std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(bot.index / ramp)));
+				bot.connect_start = seconds();
+				try {
+					bot.client = std::make_unique< Client >(argv[1], argv[2], transport);
+				} catch (std::exception const &e) {
+					std::cerr << "bot " << bot.index << " failed to connect: " << e.what() << std::endl;
+				}
+				std::lock_guard< std::mutex > lock(connector_mutex);
+				connector_done.emplace_back(&bot);
+			}
+			connectors_finished += 1;
+		});
+	}
+
+	auto adopt = [&](Bot &bot) {
+		if (!bot.client) {
+			interval.connect_failures += 1;
+			return;
+		}
+		bot.client->unreliable_messages = { uint8_t(Message::C2S_Ack), uint8_t(Message::Ping), uint8_t(Message::Pong) };
+		bot.open = true;
+
+		#ifdef __linux__
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = &bot;
+		int fd = (bot.client->udp ? int(bot.client->udp->socket) : bot.client->epoll_fd);
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+			throw std::system_error(errno, std::system_category(), "failed to watch bot connection");
+		}
+		#endif
+	};
+
+	//handlers for messages from the server:
+	struct ServerMessageContext {
+		Bot &bot;
+		Connection *connection;
+		double now;
+	};
+	MessageDispatcher< ServerMessageContext > server_messages;
+	server_messages.on< Message::S2C_State >([&](ServerMessageContext &ctx, Payload const &payload) {
+		Bot &bot = ctx.bot;
+		bot.game.recv_state_message(payload);
+		interval.states += 1;
+		if (bot.last_state >= 0.0) interval.interval.add(ctx.now - bot.last_state);
+		bot.last_state = ctx.now;
+		//inputs acknowledged by this state:
+		while (!bot.unacked.empty() && bot.unacked.front().first <= bot.game.local_input_ack) {
+			double latency = ctx.now - bot.unacked.front().second;
+			interval.latency.add(latency);
+			bot.latency.add(latency);
+			bot.unacked.pop_front();
+		}
+	});
+	server_messages.on< Message::S2C_Hit >([&](ServerMessageContext &, Payload const &payload) {
+		glm::vec3 hit_position;
+		Game::recv_hit_message(payload, &hit_position);
+		interval.hits += 1;
+	});
+	server_messages.on< Message::Ping >([](ServerMessageContext &ctx, Payload const &payload) {
+		recv_ping_message(ctx.connection, payload);
+	});
+	server_messages.on< Message::S2C_Session >([&](ServerMessageContext &ctx, Payload const &) {
+		//(bots don't reconnect, so have no use for their session tokens -- but it means the server has placed them)
+		if (ctx.bot.joined) return;
+		ctx.bot.joined = true;
+		interval.joins += 1;
+		interval.last_join = ctx.now;
+		interval.join_time.add(ctx.now - ctx.bot.connect_start);
+	});
+
+	auto on_event = [&](Bot &bot, Connection *c, Connection::Event evt) {
+		if (evt == Connection::OnOpen) {
+			bot.connected = true;
+			//(spread sends out so bots don't all send at once)
+			bot.next_send = seconds() + std::uniform_real_distribution< double >(0.0, 1.0 / rate)(bot.mt);
+			return;
+		}
+		if (evt == Connection::OnClose) {
+			if (bot.open && !bot.connected) {
+				std::cerr << "bot " << bot.index << " failed to connect." << std::endl;
+				interval.connect_failures += 1;
+			} else if (bot.open) {
+				std::cerr << "bot " << bot.index << " disconnected." << std::endl;
+				interval.disconnects += 1;
+			}
+			bot.open = false;
+			return;
+		}
+		if (evt != Connection::OnRecv) return;
+
+		double now = seconds();
+		interval.bytes_in += c->recv_buffer.size() - bot.leftover;
+		try {
+			uint32_t latest_received = bot.game.latest_received;
+			ServerMessageContext context{bot, c, now};
+			server_messages.dispatch(c, context);
+			if (bot.game.latest_received != latest_received) {
+				bot.game.send_ack_message(c);
+				interval.bytes_out += 4 + 4;
+			}
+		} catch (std::exception const &e) {
+			std::cerr << "bot " << bot.index << " got a malformed message: " << e.what() << std::endl;
+			c->close();
+			interval.disconnects += 1;
+			bot.open = false;
+		}
+		bot.leftover = c->recv_buffer.size();
+	};
+
+	//choose buttons for the next controls message:
+	auto steer = [&](Bot &bot, double now) {
+		Player::Controls &controls = bot.controls;
+		if (pattern == Random) {
+			if (now >= bot.next_change) {
+				std::uniform_int_distribution< int > coin(0, 1);
+				controls.left.pressed = coin(bot.mt);
+				controls.right.pressed = coin(bot.mt);
+				controls.up.pressed = coin(bot.mt);
+				controls.down.pressed = coin(bot.mt);
+				bot.next_change = now + std::uniform_real_distribution< double >(0.2, 1.0)(bot.mt);
+			}
+		} else if (pattern == Square) {
+			//one second along each side (bots start at different corners):
+			uint32_t side = (uint32_t(now) + bot.index) % 4;
+			controls.right.pressed = (side == 0);
+			controls.up.pressed = (side == 1);
+			controls.left.pressed = (side == 2);
+			controls.down.pressed = (side == 3);
+		}
+	};
+
+	auto report = [&](char const *what, Stats const &stats, double elapsed) {
+		uint32_t open = 0;
+		for (auto const &bot : bots) {
+			if (bot.open && bot.connected) open += 1;
+		}
+		out << "[" << what << "] " << seconds() << "s: " << open << "/" << bot_count << " bots connected, "
+		          << stats.disconnects << " disconnects, " << stats.connect_failures << " connect failures\n"
+		          << "  sent " << double(stats.controls) / elapsed << " controls/s (" << stats.skipped_sends << " skipped as this process fell behind), " << double(stats.bytes_out) / elapsed / 1024.0 << " KiB/s;"
+		          << " received " << double(stats.states) / elapsed << " states/s, " << double(stats.hits) / elapsed << " hits/s, "
+		          << double(stats.bytes_in) / elapsed / 1024.0 << " KiB/s\n"
+		          << "  joined " << stats.joins << " bots; join time: ";
+		stats.join_time.write_summary(out);
+		out << "\n  input latency: ";
+		stats.latency.write_summary(out);
+		out << "\n  state interval: ";
+		stats.interval.write_summary(out);
+		out << std::endl;
+	};
+
+	//------------ main loop ------------
+
+	double all_connected = -1.0; //time the last bot was connected
+	double last_report = 0.0;
+
+	while (true) {
+		double now = seconds();
+
+		//start running newly-connected bots:
+		if (all_connected < 0.0) {
+			bool finished = (connectors_finished == connector_count); //(checked before taking the list, so no bot is missed)
+			std::vector< Bot * > done;
+			{
+				std::lock_guard< std::mutex > lock(connector_mutex);
+				std::swap(done, connector_done);
+			}
+			for (Bot *bot : done) adopt(*bot);
+			if (finished) all_connected = now;
+		}
+		if (all_connected >= 0.0 && duration > 0.0 && now - all_connected >= duration) break;
+
+		//receive:
+		#ifdef __linux__
+		{
+			static std::vector< struct epoll_event > events(1024);
+			int count = epoll_wait(epoll_fd, events.data(), int(events.size()), 1);
+			if (count < 0 && errno != EINTR) throw std::system_error(errno, std::system_category(), "epoll_wait failed");
+			for (int e = 0; e < count; ++e) {
+				Bot &bot = *reinterpret_cast< Bot * >(events[e].data.ptr);
+				if (!bot.open) continue;
+				bot.client->poll([&](Connection *c, Connection::Event evt) { on_event(bot, c, evt); }, 0.0);
+			}
+			//(bots not yet connected may have nothing to wake epoll -- e.g., while looking up the server's address -- so are polled regardless)
+			for (auto &bot : bots) {
+				if (bot.open && !bot.connected) bot.client->poll([&](Connection *c, Connection::Event evt) { on_event(bot, c, evt); }, 0.0);
+			}
+		}
+		#else
+		for (auto &bot : bots) {
+			if (!bot.open) continue;
+			bot.client->poll([&](Connection *c, Connection::Event evt) { on_event(bot, c, evt); }, 0.0);
+		}
+		#endif
+
+		//send controls (and the occasional shot):
+		now = seconds();
+		for (auto &bot : bots) {
+			if (!bot.open || !bot.connected || now < bot.next_send) continue;
+			steer(bot, now);
+			bot.controls.seq = bot.next_seq++;
+			bot.controls.elapsed = float(std::min(1.0 / rate, double(Game::MaxInputElapsed)));
+			bot.controls.send_controls_message(&bot.client->connection);
+			bot.unacked.emplace_back(bot.controls.seq, now);
+			interval.controls += 1;
+			interval.bytes_out += 4 + 5 + 4 + 4;
+			if (bot.game.local_player == &bot.game.gun && std::uniform_real_distribution< double >(0.0, 1.0)(bot.mt) < fire_rate / rate) {
+				Shot shot;
+				shot.view_snapshot = bot.game.latest_received;
+				shot.send_shot_message(&bot.client->connection);
+				interval.bytes_out += 4 + 4 + 4;
+			}
+			//(if the server stops acknowledging, forget the oldest inputs rather than keeping them forever)
+			while (bot.unacked.size() > 1024) bot.unacked.pop_front();
+			bot.client->flush([&](Connection *c, Connection::Event evt) { on_event(bot, c, evt); });
+			//(send times are kept on a fixed schedule; after a stall, skip ahead rather than bursting)
+			bot.next_send += 1.0 / rate;
+			if (bot.next_send < now) {
+				interval.skipped_sends += uint64_t((now - bot.next_send) * rate) + 1;
+				bot.next_send = now;
+			}
+		}
+
+		//report:
+		now = seconds();
+		if (now - last_report >= report_interval) {
+			report("interval", interval, now - last_report);
+			total.add(interval);
+			interval = Stats();
+			last_report = now;
+		}
+	}
+
+	total.add(interval);
+
+	quit = true;
+	for (auto &connector : connectors) {
+		connector.join();
+	}
+
+	//------------ final report ------------
+
+	double run_time = seconds();
+	report("total", total, run_time);
+	{ //how the slowest bots fared:
+		std::vector< double > p99s;
+		for (auto const &bot : bots) {
+			if (bot.latency.count) p99s.emplace_back(bot.latency.percentile(0.99));
+		}
+		if (!p99s.empty()) {
+			std::sort(p99s.begin(), p99s.end());
+			out << "  per-bot p99 input latency: median " << p99s[p99s.size() / 2] * 1e3
+			          << "ms, worst 1% " << p99s[p99s.size() * 99 / 100] * 1e3
+			          << "ms, worst " << p99s.back() * 1e3 << "ms" << std::endl;
+		}
+	}
+	if (total.joins) { //how fast the server took on connections:
+		out << "  accepted " << total.joins << " connections in " << total.last_join << "s (" << double(total.joins) / std::max(total.last_join, 1e-9)
+		          << " connections/s, from the first connection attempt to the last bot placed); join time buckets (us:count): ";
+		total.join_time.write_buckets(out);
+		out << std::endl;
+	}
+	out << "  total input latency buckets (us:count): ";
+	total.latency.write_buckets(out);
+	out << std::endl;
+
+	#ifdef __linux__
+	::close(epoll_fd);
+	#endif
+
+	return 0;
+}
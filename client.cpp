@@ -14,6 +14,7 @@
 #include <stdexcept>
 #include <memory>
 #include <algorithm>
+#include <cstdlib>
 
 #ifdef _WIN32
 extern "C" { uint32_t GetACP(); }
@@ -34,13 +35,47 @@ int main(int argc, char **argv) {
 	try {
 #endif
 	//------------ command line arguments ------------
-	if (argc != 3) {
-		std::cerr << "Usage:\n\t./client <host> <port>" << std::endl;
+	auto usage = []() {
+		std::cerr << "Usage:\n\t./client <host> <port> [--udp] [--interp-delay <ms>] [--input-rate <hz>]\n"
+		             "\t--udp           use the UDP transport instead of TCP\n"
+		             "\t--input-rate    controls messages sent per second, whatever the frame rate (default: 60)\n"
+		             "\t--interp-delay  draw remote players this far in the past (default: adapts to network jitter)" << std::endl;
+	};
+	if (argc < 3) {
+		usage();
 		return 1;
 	}
 
+	Transport transport = Transport::TCP;
+	InterpolationBuffer::Settings interpolation_settings;
+	double input_rate = ClientNetwork::DefaultInputRate;
+	for (int argi = 3; argi < argc; ++argi) {
+		std::string arg = argv[argi];
+		if (arg == "--udp") {
+			transport = Transport::UDP;
+		} else if (arg == "--interp-delay" && argi + 1 < argc) {
+			interpolation_settings.delay = std::max(0.0, std::atof(argv[argi + 1]) / 1000.0);
+			interpolation_settings.adaptive = false;
+			argi += 1;
+		} else if (arg == "--input-rate" && argi + 1 < argc) {
+			input_rate = std::atof(argv[argi + 1]);
+			if (!(input_rate > 0.0)) {
+				usage();
+				return 1;
+			}
+			argi += 1;
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
 	//------------ connect to server --------------
-	Client client(argv[1], argv[2]);
+	//(over TCP, this only starts connecting: the connection opens in the background while the window
+	// is created and assets load, and the network thread picks it up from there)
+	Client client(argv[1], argv[2], transport);
+	//(UDP) only the newest ack matters to the server (and resent pings would spoil round-trip times):
+	client.unreliable_messages = { uint8_t(Message::C2S_Ack), uint8_t(Message::Ping), uint8_t(Message::Pong) };
 
 	//------------  initialization ------------
 
@@ -109,7 +144,7 @@ int main(int argc, char **argv) {
 	call_load_functions();
 
 	//------------ create game mode + make current --------------
-	Mode::set_current(std::make_shared< PlayMode >(client));
+	Mode::set_current(std::make_shared< PlayMode >(client, interpolation_settings, input_rate));
 
 	//------------ main loop ------------
 
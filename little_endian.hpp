@@ -0,0 +1,57 @@
+#pragma once
+
+/*
+ * Little-endian packing helpers, for formats (on the wire and on disk) that
+ *  mustn't depend on the host's byte order.
+ *
+ * put_* append a value to a byte vector; get_* read one from bytes that the
+ *  caller has already checked are there.
+ *
+ * Floats are packed as their IEEE 754 bits.
+ *
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+static_assert(sizeof(float) == 4, "floats are packed as 32 bits");
+
+inline void put_u8(std::vector< uint8_t > &to, uint8_t v) {
+	to.emplace_back(v);
+}
+inline void put_u16(std::vector< uint8_t > &to, uint16_t v) {
+	to.emplace_back(uint8_t(v));
+	to.emplace_back(uint8_t(v >> 8));
+}
+inline void put_u32(std::vector< uint8_t > &to, uint32_t v) {
+	to.emplace_back(uint8_t(v));
+	to.emplace_back(uint8_t(v >> 8));
+	to.emplace_back(uint8_t(v >> 16));
+	to.emplace_back(uint8_t(v >> 24));
+}
+inline void put_u64(std::vector< uint8_t > &to, uint64_t v) {
+	put_u32(to, uint32_t(v));
+	put_u32(to, uint32_t(v >> 32));
+}
+inline void put_f32(std::vector< uint8_t > &to, float v) {
+	uint32_t bits;
+	std::memcpy(&bits, &v, sizeof(bits));
+	put_u32(to, bits);
+}
+
+inline uint16_t get_u16(uint8_t const *at) {
+	return uint16_t(at[0]) | (uint16_t(at[1]) << 8);
+}
+inline uint32_t get_u32(uint8_t const *at) {
+	return uint32_t(at[0]) | (uint32_t(at[1]) << 8) | (uint32_t(at[2]) << 16) | (uint32_t(at[3]) << 24);
+}
+inline uint64_t get_u64(uint8_t const *at) {
+	return uint64_t(get_u32(at)) | (uint64_t(get_u32(at + 4)) << 32);
+}
+inline float get_f32(uint8_t const *at) {
+	uint32_t bits = get_u32(at);
+	float v;
+	std::memcpy(&v, &bits, sizeof(v));
+	return v;
+}
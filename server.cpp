@@ -1,15 +1,13 @@
 
-#include "Connection.hpp"
+#include "Rooms.hpp"
+#include "MatchLog.hpp"
+#include "Benchmarks.hpp"
 
-#include "hex_dump.hpp"
-
-#include "Game.hpp"
-
-#include <chrono>
+#include <algorithm>
+#include <cstdlib>
 #include <stdexcept>
 #include <iostream>
-#include <cassert>
-#include <unordered_map>
+#include <thread>
 
 #ifdef _WIN32
 extern "C" { uint32_t GetACP(); }
@@ -32,89 +30,173 @@ int main(int argc, char **argv) {
 
 	//------------ argument parsing ------------
 
-	if (argc != 2) {
-		std::cerr << "Usage:\n\t./server <port>" << std::endl;
+	auto usage = []() {
+		std::cerr << "Usage:\n\t./server <port> [--stats] [--udp] [--shards <count>] [--tick-rate <hz>] [--max-catch-up <ticks>] [--spin-tail <us>] [--record <dir>]\n"
+		             "\t         [--checkpoint <file>] [--checkpoint-interval <seconds>] [--interest-radius <units>] [--backlog <count>] [--acceptors <count>] [--shm <name>]\n"
+		             "\t./server --replay <match log> [--repeat <count>]\n"
+		             "\t./server --bench-snapshots [<iterations>]\n"
+		             "\t./server --bench-queues [<items>]\n"
+		             "\t--stats         periodically print per-tick syscall counts, tick timing histograms, and per-connection\n"
+		             "\t                stats (round-trip times, throughput, send queue depth) for the worst connections\n"
+		             "\t--udp           use the UDP transport instead of TCP\n"
+		             "\t--shards        number of worker threads running rooms (default: one per core)\n"
+		             "\t--tick-rate     server ticks per second (default: 30)\n"
+		             "\t--max-catch-up  most ticks run back-to-back after falling behind; the rest are skipped (default: 5)\n"
+		             "\t--spin-tail     busy-wait for the last this-many microseconds before each tick, for accuracy (default: 0)\n"
+		             "\t--record        log every match to a file in this (existing) directory, for replaying later\n"
+		             "\t--checkpoint    every few seconds, save every match to this file; at startup, restore the matches in it\n"
+		             "\t                (clients that reconnect after a restart get their players back)\n"
+		             "\t--checkpoint-interval  seconds between checkpoints (default: 5)\n"
+		             "\t--interest-radius  only send each client the players within this distance (in x/z) of its own, plus\n"
+		             "\t                anyone firing (default: 40, which covers the whole play area)\n"
+		             "\t--backlog       (TCP) connections the kernel queues while they wait to be accepted (default: 1024)\n"
+		             "\t--acceptors     (TCP) threads accepting connections, each listening on its own SO_REUSEPORT socket (default: 1)\n"
+		             "\t--shm           (TCP) also accept connections from clients on this machine over shared memory, at address shm:<name> (linux only)\n"
+		             "\t--replay        re-simulate a logged match as fast as possible, checking that it plays out the same;\n"
+		             "\t                exits with status 1 if it doesn't\n"
+		             "\t--repeat        (with --replay) replay this many times, and report the fastest\n"
+		             "\t--bench-snapshots  time encoding and decoding state payloads (bit-packed, full and delta, and the old\n"
+		             "\t                byte-aligned format) and report bytes per snapshot; exits with status 1 if any decode\n"
+		             "\t                doesn't match what was encoded (default: 1000000 iterations)\n"
+		             "\t--bench-queues  stress the queues between each shard's I/O and simulation threads (paced, and flooded\n"
+		             "\t                so items overflow) and report item latency; exits with status 1 if any item arrives\n"
+		             "\t                out of order or not at all (default: 1000000 items)" << std::endl;
+	};
+
+	if (argc < 2) {
+		usage();
 		return 1;
 	}
 
-	//------------ initialization ------------
+	if (std::string(argv[1]) == "--replay") {
+		uint32_t repeat = 1;
+		if (argc == 5 && std::string(argv[3]) == "--repeat") {
+			repeat = uint32_t(std::max(1, std::atoi(argv[4])));
+		} else if (argc != 3) {
+			usage();
+			return 1;
+		}
 
-	Server server(argv[1]);
+		MatchReplay replay(argv[2]);
+		MatchReplay::Result best;
+		for (uint32_t r = 0; r < repeat; ++r) {
+			MatchReplay::Result result = replay.run();
+			if (r == 0 || result.seconds < best.seconds) best = result;
+		}
+		std::cout << "[replay] " << replay.path << ": " << best.ticks << " ticks (" << best.simulated << "s of play) and "
+		          << best.events << " events in " << best.seconds * 1e3 << "ms; "
+		          << double(best.ticks) / std::max(best.seconds, 1e-9) << " ticks/s, "
+		          << best.simulated / std::max(best.seconds, 1e-9) << "x real time" << (repeat > 1 ? " (fastest of " + std::to_string(repeat) + ")" : "") << "\n";
+		if (best.truncated) std::cout << "[replay] NOTE: the log ends partway through a record (was the server stopped while recording?)\n";
+		if (best.mismatches) {
+			std::cout << "[replay] MISMATCH: " << best.mismatches << " ticks ended in a different state than recorded (first: tick " << best.first_mismatch << ")." << std::endl;
+			return 1;
+		}
+		std::cout << "[replay] every tick matched the recording (final state hash " << std::hex << best.final_hash << std::dec << ")." << std::endl;
+		return 0;
+	}
 
-	//------------ main loop ------------
+	if (std::string(argv[1]) == "--bench-snapshots") {
+		uint32_t iterations = 1000000;
+		if (argc == 3) {
+			iterations = uint32_t(std::max(1, std::atoi(argv[2])));
+		} else if (argc != 2) {
+			usage();
+			return 1;
+		}
+		return bench_snapshots(iterations) ? 0 : 1;
+	}
 
-	//keep track of which connection is controlling which player:
-	std::unordered_map< Connection *, Player * > connection_to_player;
-	//keep track of game state:
-	Game game;
-
-	while (true) {
-		static auto next_tick = std::chrono::steady_clock::now() + std::chrono::duration< double >(Game::Tick);
-		//process incoming data from clients until a tick has elapsed:
-		while (true) {
-			auto now = std::chrono::steady_clock::now();
-			double remain = std::chrono::duration< double >(next_tick - now).count();
-			if (remain < 0.0) {
-				next_tick += std::chrono::duration< double >(Game::Tick);
-				break;
-			}
+	if (std::string(argv[1]) == "--bench-queues") {
+		uint32_t items = 1000000;
+		if (argc == 3) {
+			items = uint32_t(std::max(1, std::atoi(argv[2])));
+		} else if (argc != 2) {
+			usage();
+			return 1;
+		}
+		return bench_queues(items) ? 0 : 1;
+	}
 
-			//helper used on client close (due to quit) and server close (due to error):
-			auto remove_connection = [&](Connection *c) {
-				auto f = connection_to_player.find(c);
-				assert(f != connection_to_player.end());
-				game.remove_player(f->second);
-				connection_to_player.erase(f);
-			};
-
-			server.poll([&](Connection *c, Connection::Event evt){
-				if (evt == Connection::OnOpen) {
-					//client connected:
-
-					//create some player info for them:
-					connection_to_player.emplace(c, game.spawn_player());
-
-				} else if (evt == Connection::OnClose) {
-					//client disconnected:
-
-					remove_connection(c);
-
-				} else { assert(evt == Connection::OnRecv);
-					//got data from client:
-					//std::cout << "current buffer:\n" << hex_dump(c->recv_buffer); std::cout.flush(); //DEBUG
-
-					//look up in players list:
-					auto f = connection_to_player.find(c);
-					assert(f != connection_to_player.end());
-					Player &player = *f->second;
-
-					//handle messages from client:
-					try {
-						bool handled_message;
-						do {
-							handled_message = false;
-							if (player.controls.recv_controls_message(c)) handled_message = true;
-							//TODO: extend for more message types as needed
-						} while (handled_message);
-					} catch (std::exception const &e) {
-						std::cout << "Disconnecting client:" << e.what() << std::endl;
-						c->close();
-						remove_connection(c);
-					}
-				}
-			}, remain);
+	bool print_stats = false;
+	std::string record_directory;
+	std::string checkpoint_path;
+	double checkpoint_interval = 5.0;
+	Interest::Settings interest;
+	ListenSettings listen;
+	uint32_t acceptors = 1;
+	Transport transport = Transport::TCP;
+	uint32_t shards = std::max(1u, std::thread::hardware_concurrency());
+	TickScheduler::Settings tick_settings;
+	tick_settings.tick = Game::Tick;
+	for (int argi = 2; argi < argc; ++argi) {
+		std::string arg = argv[argi];
+		if (arg == "--stats") {
+			print_stats = true;
+		} else if (arg == "--udp") {
+			transport = Transport::UDP;
+		} else if (arg == "--shards" && argi + 1 < argc) {
+			shards = uint32_t(std::max(1, std::atoi(argv[argi + 1])));
+			argi += 1;
+		} else if (arg == "--tick-rate" && argi + 1 < argc) {
+			double rate = std::atof(argv[argi + 1]);
+			if (!(rate > 0.0)) {
+				usage();
+				return 1;
+			}
+			tick_settings.tick = 1.0 / rate;
+			argi += 1;
+		} else if (arg == "--max-catch-up" && argi + 1 < argc) {
+			tick_settings.max_catch_up = uint32_t(std::max(1, std::atoi(argv[argi + 1])));
+			argi += 1;
+		} else if (arg == "--record" && argi + 1 < argc) {
+			record_directory = argv[argi + 1];
+			argi += 1;
+		} else if (arg == "--checkpoint" && argi + 1 < argc) {
+			checkpoint_path = argv[argi + 1];
+			argi += 1;
+		} else if (arg == "--checkpoint-interval" && argi + 1 < argc) {
+			checkpoint_interval = std::atof(argv[argi + 1]);
+			if (!(checkpoint_interval > 0.0)) {
+				usage();
+				return 1;
+			}
+			argi += 1;
+		} else if (arg == "--interest-radius" && argi + 1 < argc) {
+			interest.radius = float(std::atof(argv[argi + 1]));
+			if (!(interest.radius > 0.0f)) {
+				usage();
+				return 1;
+			}
+			argi += 1;
+		} else if (arg == "--backlog" && argi + 1 < argc) {
+			listen.backlog = std::max(1, std::atoi(argv[argi + 1]));
+			argi += 1;
+		} else if (arg == "--shm" && argi + 1 < argc) {
+			listen.shm_name = argv[argi + 1];
+			argi += 1;
+		} else if (arg == "--acceptors" && argi + 1 < argc) {
+			acceptors = uint32_t(std::max(1, std::atoi(argv[argi + 1])));
+			argi += 1;
+		} else if (arg == "--spin-tail" && argi + 1 < argc) {
+			tick_settings.spin_tail = std::max(0.0, std::atof(argv[argi + 1]) * 1e-6);
+			argi += 1;
+		} else {
+			usage();
+			return 1;
 		}
+	}
 
-		//update current game state
-		game.update(Game::Tick);
+	//------------ initialization ------------
 
-		//send updated game state to all clients
-		for (auto &[c, player] : connection_to_player) {
-			game.send_state_message(c, player);
-		}
+	//each client is placed in a room (a separate game) with a free player slot;
+	// rooms are run by worker threads ("shards"):
+	// (with a checkpoint, matches from the last run are put back first)
+	RoomManager manager(argv[1], transport, shards, tick_settings, print_stats, record_directory, checkpoint_path, checkpoint_interval, interest, listen, acceptors);
 
-	}
+	//------------ main loop ------------
 
+	manager.run();
 
 	return 0;
 
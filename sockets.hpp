@@ -0,0 +1,42 @@
+#pragma once
+
+//--------- OS-specific socket-related headers ---------
+//shared by the Connection implementation files
+// (only include this from .cpp files, so the rest of the code isn't exposed to windows.h)
+
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS 1 //so we can use strerror()
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN 1
+#endif
+#undef APIENTRY
+#include <winsock2.h>
+#include <ws2tcpip.h> //for getaddrinfo
+#undef max
+#undef min
+
+#pragma comment(lib, "Ws2_32.lib") //link against the winsock2 library
+
+#define MSG_DONTWAIT 0 //on windows, sockets are set to non-blocking with an ioctl
+typedef int ssize_t;
+
+#else
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h> //for TCP_NODELAY
+#include <unistd.h>
+#include <netdb.h>
+#include <fcntl.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#define closesocket close
+
+#endif
+//------------------------------------------------------